@@ -0,0 +1,96 @@
+#include "change-dir.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+const char *state_file_name = "osm2pgsql.state";
+
+// length of the extension of a change file, 0 for other files
+size_t change_file_ext(const std::string &name)
+{
+    for (const char *ext : { ".osc", ".osc.gz", ".osc.bz2" }) {
+        const size_t len = strlen(ext);
+        if (name.size() > len && name.compare(name.size() - len, len, ext) == 0) {
+            return len;
+        }
+    }
+    return 0;
+}
+
+} // anonymous namespace
+
+change_dir_t::change_dir_t(const std::string &dir)
+: m_dir(dir)
+{
+    if (!fs::is_directory(m_dir)) {
+        throw std::runtime_error((boost::format("Change file directory %1% not found.\n") % dir).str());
+    }
+
+    std::ifstream state((fs::path(m_dir) / state_file_name).string());
+    if (state) {
+        std::getline(state, m_last);
+    }
+}
+
+std::vector<std::string> change_dir_t::new_files() const
+{
+    std::string prefix = fs::path(m_dir).generic_string();
+    if (prefix.empty() || prefix.back() != '/') {
+        prefix += '/';
+    }
+
+    std::vector<std::string> files;
+    for (fs::recursive_directory_iterator it(m_dir), end; it != end; ++it) {
+        if (!fs::is_regular_file(it->status())) {
+            continue;
+        }
+        std::string name = it->path().generic_string().substr(prefix.size());
+        if (change_file_ext(name) && name > m_last) {
+            files.push_back(std::move(name));
+        }
+    }
+    std::sort(files.begin(), files.end());
+
+    return files;
+}
+
+std::string change_dir_t::path(const std::string &name) const
+{
+    return (fs::path(m_dir) / name).string();
+}
+
+void change_dir_t::applied(const std::string &name)
+{
+    // write a new state file and move it into place, so that there is a
+    // complete one when the process dies in between
+    const fs::path state = fs::path(m_dir) / state_file_name;
+    const fs::path tmp = fs::path(m_dir) / (std::string(state_file_name) + ".tmp");
+    {
+        std::ofstream out(tmp.string(), std::ios::trunc);
+        out << name << '\n';
+        out.close();
+        if (!out) {
+            throw std::runtime_error((boost::format("Writing state file %1% failed.\n") % tmp.string()).str());
+        }
+    }
+    fs::rename(tmp, state);
+
+    m_last = name;
+}
+
+std::string change_dir_t::expire_list(const std::string &base, const std::string &name)
+{
+    std::string seq = name.substr(0, name.size() - change_file_ext(name));
+    std::replace(seq.begin(), seq.end(), '/', '-');
+
+    return base + "." + seq;
+}
@@ -0,0 +1,45 @@
+#ifndef CHANGE_DIR_HPP
+#define CHANGE_DIR_HPP
+
+#include <string>
+#include <vector>
+
+/**
+ * A directory with change files which are applied one after the other by
+ * a long running update (see --watch-dir).
+ *
+ * Change files (.osc, .osc.gz or .osc.bz2) may also be in subdirectories,
+ * like in the layout of the replication servers (000/123/456.osc.gz). They
+ * are applied in the order of their path relative to the directory. The
+ * path of the last applied file is kept in a state file in the directory,
+ * all files up to and including it are skipped.
+ */
+class change_dir_t
+{
+public:
+    explicit change_dir_t(const std::string &dir);
+
+    /// relative paths of the change files after the last applied one, in order
+    std::vector<std::string> new_files() const;
+
+    /// full path of a file returned by new_files()
+    std::string path(const std::string &name) const;
+
+    /// remember that the file was applied, this updates the state file
+    void applied(const std::string &name);
+
+    const std::string &last_applied() const { return m_last; }
+
+    /**
+     * Name of the expire list for the changes up to and including the file:
+     * the base name followed by the path of the file without its extension,
+     * e.g. dirty_tiles.000-123-456 for 000/123/456.osc.gz.
+     */
+    static std::string expire_list(const std::string &base, const std::string &name);
+
+private:
+    std::string m_dir;
+    std::string m_last;
+};
+
+#endif
@@ -0,0 +1,66 @@
+# Locate LuaJIT library
+#
+# This module defines
+#
+#   LUAJIT_FOUND          - if false, do not try to link to LuaJIT
+#   LUAJIT_LIBRARIES      - the LuaJIT library (and libm where needed)
+#   LUAJIT_INCLUDE_DIR    - where to find lua.h and luajit.h
+#   LUAJIT_VERSION_STRING - the version of LuaJIT found
+#
+# LuaJIT implements the Lua 5.1 API, so the include convention is the same
+# as with FindLua:
+#
+#   #include "lua.h"
+
+find_path(LUAJIT_INCLUDE_DIR luajit.h
+  HINTS
+    ENV LUAJIT_DIR
+  PATH_SUFFIXES include/luajit-2.1 include/luajit-2.0 include/luajit include
+  PATHS
+    ~/Library/Frameworks
+    /Library/Frameworks
+    /sw
+    /opt/local
+    /opt/csw
+    /opt
+)
+
+find_library(LUAJIT_LIBRARY
+  NAMES luajit-5.1 luajit lua51
+  HINTS
+    ENV LUAJIT_DIR
+  PATH_SUFFIXES lib
+  PATHS
+    ~/Library/Frameworks
+    /Library/Frameworks
+    /sw
+    /opt/local
+    /opt/csw
+    /opt
+)
+
+if (LUAJIT_LIBRARY)
+  if (UNIX AND NOT APPLE)
+    find_library(LUAJIT_MATH_LIBRARY m)
+    set(LUAJIT_LIBRARIES "${LUAJIT_LIBRARY};${LUAJIT_MATH_LIBRARY}")
+  else()
+    set(LUAJIT_LIBRARIES "${LUAJIT_LIBRARY}")
+  endif()
+endif()
+
+if (LUAJIT_INCLUDE_DIR AND EXISTS "${LUAJIT_INCLUDE_DIR}/luajit.h")
+  file(STRINGS "${LUAJIT_INCLUDE_DIR}/luajit.h" luajit_version_str
+       REGEX "^#define[ \t]+LUAJIT_VERSION[ \t]+\"LuaJIT .+\"")
+  string(REGEX REPLACE "^#define[ \t]+LUAJIT_VERSION[ \t]+\"LuaJIT ([^\"]+)\".*" "\\1"
+         LUAJIT_VERSION_STRING "${luajit_version_str}")
+  unset(luajit_version_str)
+endif()
+
+include(FindPackageHandleStandardArgs)
+# handle the QUIETLY and REQUIRED arguments and set LUAJIT_FOUND to TRUE if
+# all listed variables are TRUE
+find_package_handle_standard_args(LuaJIT
+                                  REQUIRED_VARS LUAJIT_LIBRARIES LUAJIT_INCLUDE_DIR
+                                  VERSION_VAR LUAJIT_VERSION_STRING)
+
+mark_as_advanced(LUAJIT_INCLUDE_DIR LUAJIT_LIBRARY LUAJIT_MATH_LIBRARY)
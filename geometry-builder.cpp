@@ -24,6 +24,7 @@
 #include <algorithm>
 #include <cmath>
 #include <cstddef>
+#include <functional>
 #include <sstream>
 #include <stdexcept>
 #include <memory>
@@ -38,6 +39,7 @@
 #include <geos/geom/prep/PreparedGeometryFactory.h>
 #include <geos/geom/GeometryFactory.h>
 #include <geos/geom/Coordinate.h>
+#include <geos/geom/Envelope.h>
 #include <geos/geom/CoordinateSequence.h>
 #include <geos/geom/CoordinateSequenceFactory.h>
 #include <geos/geom/Geometry.h>
@@ -47,6 +49,7 @@
 #include <geos/geom/MultiLineString.h>
 #include <geos/geom/Polygon.h>
 #include <geos/geom/MultiPolygon.h>
+#include <geos/index/strtree/STRtree.h>
 #include <geos/io/WKBReader.h>
 #include <geos/io/WKBWriter.h>
 #include <geos/util/GEOSException.h>
@@ -57,6 +60,7 @@ using namespace geos::operation::linemerge;
 
 #include "geometry-builder.hpp"
 #include "reprojection.hpp"
+#include "wkb-writer.hpp"
 
 typedef std::unique_ptr<Geometry> geom_ptr;
 typedef std::unique_ptr<CoordinateSequence> coord_ptr;
@@ -101,10 +105,18 @@ geom_ptr create_multi_line(GeometryFactory &gf, const multinodelist_t &xnodes)
     return geom_ptr(gf.createMultiLineString(lines.release()));
 }
 
-bool is_polygon_line(CoordinateSequence * coords)
+bool is_polygon_line(const nodelist_t &nodes)
 {
-    return (coords->getSize() >= 4)
-           && (coords->getAt(coords->getSize() - 1).equals2D(coords->getAt(0)));
+    return (nodes.size() >= 4)
+           && nodes.back().lon == nodes.front().lon
+           && nodes.back().lat == nodes.front().lat;
+}
+
+double node_distance(const osmNode &a, const osmNode &b)
+{
+    const double dx = a.lon - b.lon;
+    const double dy = a.lat - b.lat;
+    return std::sqrt(dx * dx + dy * dy);
 }
 
 /**
@@ -169,6 +181,7 @@ struct polygondata
 {
     std::unique_ptr<Polygon>    polygon;
     std::unique_ptr<LinearRing> ring;
+    std::unique_ptr<const geos::geom::prep::PreparedGeometry> prepared;
     double          area;
     bool            iscontained;
     unsigned        containedbyid;
@@ -177,6 +190,17 @@ struct polygondata
     : polygon(std::move(p)), ring(r), area(a),
       iscontained(false), containedbyid(0)
     {}
+
+    bool contains(const polygondata &other)
+    {
+        // only rings which are candidates for containing another one
+        // are prepared
+        if (!prepared) {
+            geos::geom::prep::PreparedGeometryFactory pgf;
+            prepared.reset(pgf.create(polygon.get()));
+        }
+        return prepared->contains(other.polygon.get());
+    }
 };
 
 struct polygondata_comparearea {
@@ -185,6 +209,101 @@ struct polygondata_comparearea {
     }
 };
 
+/**
+ * Decide which rings are outer rings and which are holes.
+ *
+ * The rings are sorted by area, largest first. The direct parent of each
+ * ring is the smallest bigger ring containing it. Candidates for the
+ * parent are looked up in an STR tree of the ring envelopes, so that only
+ * rings whose envelope covers the envelope of the ring are tested. A ring
+ * inside an outer ring is a hole of that ring, a ring inside a hole is an
+ * outer ring again (an island in a lake).
+ *
+ * Afterwards iscontained is set for all holes, with containedbyid
+ * pointing to the outer ring they belong to.
+ *
+ * \return the number of outer rings
+ */
+unsigned assign_rings(std::vector<polygondata> &polys)
+{
+    std::sort(polys.begin(), polys.end(), polygondata_comparearea());
+
+    geos::index::strtree::STRtree tree;
+    for (auto &poly : polys) {
+        tree.insert(poly.polygon->getEnvelopeInternal(), &poly);
+    }
+
+    unsigned toplevelpolygons = 0;
+    std::vector<void *> candidates;
+    std::vector<unsigned> parents;
+
+    for (unsigned j = 0; j < polys.size(); ++j) {
+        const Envelope *env = polys[j].polygon->getEnvelopeInternal();
+
+        candidates.clear();
+        tree.query(env, candidates);
+
+        // only bigger rings can contain this one
+        parents.clear();
+        for (void *c : candidates) {
+            const unsigned i = static_cast<polygondata *>(c) - polys.data();
+            if (i < j && polys[i].polygon->getEnvelopeInternal()->contains(*env)) {
+                parents.push_back(i);
+            }
+        }
+
+        // the smallest ring containing this one is its direct parent
+        std::sort(parents.begin(), parents.end(), std::greater<unsigned>());
+        for (unsigned i : parents) {
+            if (polys[i].contains(polys[j])) {
+                if (!polys[i].iscontained) {
+                    polys[j].iscontained = true;
+                    polys[j].containedbyid = i;
+                }
+                break;
+            }
+        }
+
+        if (!polys[j].iscontained) {
+            ++toplevelpolygons;
+        }
+    }
+
+    return toplevelpolygons;
+}
+
+/**
+ * Create a polygon with its holes for each outer ring found by
+ * assign_rings(). The rings are moved out of polys.
+ */
+std::unique_ptr<std::vector<Geometry *> >
+create_polygons(GeometryFactory &gf, std::vector<polygondata> &polys)
+{
+    std::vector<std::vector<unsigned> > holes(polys.size());
+    for (unsigned j = 0; j < polys.size(); ++j) {
+        if (polys[j].iscontained) {
+            holes[polys[j].containedbyid].push_back(j);
+        }
+    }
+
+    std::unique_ptr<std::vector<Geometry *> > polygons(new std::vector<Geometry *>);
+    for (unsigned i = 0; i < polys.size(); ++i) {
+        if (polys[i].iscontained) continue;
+
+        std::unique_ptr<std::vector<Geometry *> > interior(new std::vector<Geometry *>);
+        interior->reserve(holes[i].size());
+        for (unsigned j : holes[i]) {
+            interior->push_back(polys[j].ring.release());
+        }
+
+        Polygon* poly(gf.createPolygon(polys[i].ring.release(), interior.release()));
+        poly->normalize();
+        polygons->push_back(poly);
+    }
+
+    return polygons;
+}
+
 } // anonymous namespace
 
 
@@ -233,16 +352,19 @@ geometry_builder::pg_geom_t geometry_builder::get_wkb_simple(const nodelist_t &n
 
     try
     {
-        GeometryFactory gf;
-        auto coords = nodes2coords(gf, nodes);
-        if (polygon && is_polygon_line(coords.get())) {
-            auto geom = create_simple_poly(gf, std::move(coords));
+        nodelist_t coords;
+        wkb::remove_repeated(nodes, coords);
+
+        // only polygons need Geos for the validity check, lines are
+        // written out directly
+        if (polygon && is_polygon_line(coords)) {
+            GeometryFactory gf;
+            auto geom = create_simple_poly(gf, nodes2coords(gf, coords));
             wkb.set(geom.get(), true, projection);
         } else {
-            if (coords->getSize() < 2)
+            if (coords.size() < 2)
                 throw std::runtime_error("Excluding degenerate line.");
-            geom_ptr geom(gf.createLineString(coords.release()));
-            wkb.set(geom.get(), false);
+            wkb = pg_geom_t(wkb::linestring(coords), false);
         }
     }
     catch (const std::bad_alloc&)
@@ -269,23 +391,24 @@ geometry_builder::pg_geoms_t geometry_builder::get_wkb_split(const nodelist_t &n
 
     try
     {
-        GeometryFactory gf;
-        auto coords = nodes2coords(gf, nodes);
+        nodelist_t coords;
+        wkb::remove_repeated(nodes, coords);
 
-        if (polygon && is_polygon_line(coords.get())) {
-            auto geom = create_simple_poly(gf, std::move(coords));
+        if (polygon && is_polygon_line(coords)) {
+            GeometryFactory gf;
+            auto geom = create_simple_poly(gf, nodes2coords(gf, coords));
             wkbs.emplace_back(geom.get(), true, projection);
         } else {
-            if (coords->getSize() < 2)
+            if (coords.size() < 2)
                 throw std::runtime_error("Excluding degenerate line.");
 
             double distance = 0;
-            std::unique_ptr<CoordinateSequence> segment(gf.getCoordinateSequenceFactory()->create((size_t)0, (size_t)2));
-            segment->add(coords->getAt(0));
-            for(size_t i=1; i<coords->getSize(); i++) {
-                const Coordinate this_pt = coords->getAt(i);
-                const Coordinate prev_pt = coords->getAt(i-1);
-                const double delta = this_pt.distance(prev_pt);
+            nodelist_t segment;
+            segment.push_back(coords[0]);
+            for(size_t i=1; i<coords.size(); i++) {
+                const osmNode this_pt = coords[i];
+                const osmNode prev_pt = coords[i-1];
+                const double delta = node_distance(this_pt, prev_pt);
                 assert(!std::isnan(delta));
                 // figure out if the addition of this point would take the total
                 // length of the line in `segment` over the `split_at` distance.
@@ -297,19 +420,17 @@ geometry_builder::pg_geoms_t geometry_builder::get_wkb_split(const nodelist_t &n
                     // the `split_at` distance.
                     for (size_t j = 0; j < splits; ++j) {
                         double frac = (double(j + 1) * split_at - distance) / delta;
-                        const Coordinate interpolated(frac * (this_pt.x - prev_pt.x) + prev_pt.x,
-                                                      frac * (this_pt.y - prev_pt.y) + prev_pt.y);
-                        segment->add(interpolated);
-                        geom_ptr geom(gf.createLineString(segment.release()));
+                        const osmNode interpolated(frac * (this_pt.lon - prev_pt.lon) + prev_pt.lon,
+                                                   frac * (this_pt.lat - prev_pt.lat) + prev_pt.lat);
+                        segment.push_back(interpolated);
+                        wkbs.emplace_back(wkb::linestring(segment), false);
 
-                        wkbs.emplace_back(geom.get(), false);
-
-                        segment.reset(gf.getCoordinateSequenceFactory()->create((size_t)0, (size_t)2));
-                        segment->add(interpolated);
+                        segment.clear();
+                        segment.push_back(interpolated);
                   }
                   // reset the distance based on the final splitting point for
                   // the next iteration.
-                  distance = segment->getAt(0).distance(this_pt);
+                  distance = node_distance(segment[0], this_pt);
 
                 } else {
                   // if not split then just push this point onto the sequence
@@ -318,13 +439,11 @@ geometry_builder::pg_geoms_t geometry_builder::get_wkb_split(const nodelist_t &n
                 }
 
                 // always add this point
-                segment->add(this_pt);
+                segment.push_back(this_pt);
 
                 // on the last iteration, close out the line.
-                if (i == coords->getSize()-1) {
-                    geom_ptr geom(gf.createLineString(segment.release()));
-
-                    wkbs.emplace_back(geom.get(), false);
+                if (i == coords.size()-1) {
+                    wkbs.emplace_back(wkb::linestring(segment), false);
                 }
             }
         }
@@ -430,68 +549,8 @@ geometry_builder::pg_geoms_t geometry_builder::build_polygons(const multinodelis
 
         if (!polys.empty())
         {
-            std::sort(polys.begin(), polys.end(), polygondata_comparearea());
-
-            unsigned toplevelpolygons = 0;
-            int istoplevelafterall;
-            size_t totalpolys = polys.size();
-
-            geos::geom::prep::PreparedGeometryFactory pgf;
-            for (unsigned i=0 ;i < totalpolys; ++i)
-            {
-                if (polys[i].iscontained) continue;
-                toplevelpolygons++;
-                const geos::geom::prep::PreparedGeometry* preparedtoplevelpolygon = pgf.create(polys[i].polygon.get());
-
-                for (unsigned j=i+1; j < totalpolys; ++j)
-                {
-                    // Does preparedtoplevelpolygon contain the smaller polygon[j]?
-                    if (polys[j].containedbyid == 0 && preparedtoplevelpolygon->contains(polys[j].polygon.get()))
-                    {
-                        // are we in a [i] contains [k] contains [j] situation
-                        // which would actually make j top level
-                        istoplevelafterall = 0;
-                        for (unsigned k=i+1; k < j; ++k)
-                        {
-                            if (polys[k].iscontained && polys[k].containedbyid == i && polys[k].polygon->contains(polys[j].polygon.get()))
-                            {
-                                istoplevelafterall = 1;
-                                break;
-                            }
-                        }
-                        if (istoplevelafterall == 0)
-                        {
-                            polys[j].iscontained = true;
-                            polys[j].containedbyid = i;
-                        }
-                    }
-                }
-                pgf.destroy(preparedtoplevelpolygon);
-            }
-            // polys now is a list of polygons tagged with which ones are inside each other
-
-            // List of polygons for multipolygon
-            std::unique_ptr<std::vector<Geometry*>> polygons(new std::vector<Geometry*>);
-
-            // For each top level polygon create a new polygon including any holes
-            for (unsigned i=0 ;i < totalpolys; ++i)
-            {
-                if (polys[i].iscontained) continue;
-
-                // List of holes for this top level polygon
-                std::unique_ptr<std::vector<Geometry*> > interior(new std::vector<Geometry*>);
-                for (unsigned j=i+1; j < totalpolys; ++j)
-                {
-                   if (polys[j].iscontained && polys[j].containedbyid == i)
-                   {
-                       interior->push_back(polys[j].ring.release());
-                   }
-                }
-
-                Polygon* poly(gf.createPolygon(polys[i].ring.release(), interior.release()));
-                poly->normalize();
-                polygons->push_back(poly);
-            }
+            unsigned toplevelpolygons = assign_rings(polys);
+            auto polygons = create_polygons(gf, polys);
 
             // Make a multipolygon if required
             if ((toplevelpolygons > 1) && enable_multi)
@@ -617,85 +676,8 @@ geometry_builder::pg_geoms_t geometry_builder::build_both(const multinodelist_t
 
         if (!polys.empty())
         {
-            std::sort(polys.begin(), polys.end(), polygondata_comparearea());
-
-            unsigned toplevelpolygons = 0;
-            int istoplevelafterall;
-            size_t totalpolys = polys.size();
-
-            geos::geom::prep::PreparedGeometryFactory pgf;
-            for (unsigned i=0 ;i < totalpolys; ++i)
-            {
-                if (polys[i].iscontained) continue;
-                toplevelpolygons++;
-                const geos::geom::prep::PreparedGeometry* preparedtoplevelpolygon = pgf.create(polys[i].polygon.get());
-
-                for (unsigned j=i+1; j < totalpolys; ++j)
-                {
-                    // Does preparedtoplevelpolygon contain the smaller polygon[j]?
-                    if (polys[j].containedbyid == 0 && preparedtoplevelpolygon->contains(polys[j].polygon.get()))
-                    {
-                        // are we in a [i] contains [k] contains [j] situation
-                        // which would actually make j top level
-                        istoplevelafterall = 0;
-                        for (unsigned k=i+1; k < j; ++k)
-                        {
-                            if (polys[k].iscontained && polys[k].containedbyid == i && polys[k].polygon->contains(polys[j].polygon.get()))
-                            {
-                                istoplevelafterall = 1;
-                                break;
-                            }
-#if 0
-                            else if (polys[k].polygon->intersects(polys[j].polygon) || polys[k].polygon->touches(polys[j].polygon))
-                            {
-                                // FIXME: This code does not work as intended
-                                // It should be setting the polys[k].ring in order to update this object
-                                // but the value of polys[k].polygon calculated is normally NULL
-
-                                // Add polygon this polygon (j) to k since they intersect
-                                // Mark ourselfs to be dropped (2), delete the original k
-                                Geometry* polyunion = polys[k].polygon->Union(polys[j].polygon);
-                                delete(polys[k].polygon);
-                                polys[k].polygon = dynamic_cast<Polygon*>(polyunion);
-                                polys[j].iscontained = 2; // Drop
-                                istoplevelafterall = 2;
-                                break;
-                            }
-#endif
-                        }
-                        if (istoplevelafterall == 0)
-                        {
-                            polys[j].iscontained = true;
-                            polys[j].containedbyid = i;
-                        }
-                    }
-                }
-              pgf.destroy(preparedtoplevelpolygon);
-            }
-            // polys now is a list of polygons tagged with which ones are inside each other
-
-            // List of polygons for multipolygon
-            std::unique_ptr<std::vector<Geometry*> > polygons(new std::vector<Geometry*>);
-
-            // For each top level polygon create a new polygon including any holes
-            for (unsigned i=0 ;i < totalpolys; ++i)
-            {
-                if (polys[i].iscontained) continue;
-
-                // List of holes for this top level polygon
-                std::unique_ptr<std::vector<Geometry*> > interior(new std::vector<Geometry*>);
-                for (unsigned j=i+1; j < totalpolys; ++j)
-                {
-                   if (polys[j].iscontained && polys[j].containedbyid == i)
-                   {
-                       interior->push_back(polys[j].ring.release());
-                   }
-                }
-
-                Polygon* poly(gf.createPolygon(polys[i].ring.release(), interior.release()));
-                poly->normalize();
-                polygons->push_back(poly);
-            }
+            unsigned toplevelpolygons = assign_rings(polys);
+            auto polygons = create_polygons(gf, polys);
 
             // Make a multipolygon if required
             if ((toplevelpolygons > 1) && enable_multi)
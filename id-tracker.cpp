@@ -5,58 +5,139 @@
 #include <limits>
 #include <algorithm>
 
-#include <boost/optional.hpp>
+#include <cassert>
 
 #define BLOCK_BITS (16)
 #define BLOCK_SIZE (1 << BLOCK_BITS)
 #define BLOCK_MASK (BLOCK_SIZE - 1)
 
+// a chunk holds the blocks of 2^32 consecutive ids
+#define CHUNK_BITS (32 - BLOCK_BITS)
+#define CHUNK_SIZE (1 << CHUNK_BITS)
+
+// more ids than this in a block are stored in a bitmap
+#define ARRAY_MAX (4096)
+
 namespace {
-/* block used to be just a std::vector<bool> of fixed size. however,
- * it seems there's significant overhead in exposing std::vector<bool>::iterator
- * and so this is now a minimal re-implementation.
+
+int first_bit(uint64_t word)
+{
+#if defined(__GNUC__)
+    return __builtin_ctzll(word);
+#else
+    int idx = 0;
+    while ((word & 1) == 0) { ++idx; word >>= 1; }
+    return idx;
+#endif
+}
+
+/* the ids of a block of BLOCK_SIZE ids, like the containers of a roaring
+ * bitmap: a sorted array of the offsets while there are only a few of
+ * them, a bitmap with one bit per id (8k) once that would be smaller.
  *
- * each block is BLOCK_SIZE bits, stored as a vector of uint32_t elements.
- */
-struct block {
-    block() : bits(BLOCK_SIZE >> 5, 0) {}
-    inline bool operator[](size_t i) const { return (bits[i >> 5] & (1 << (i & 0x1f))) > 0; }
-    //returns true if the value actually caused a bit to flip
-    inline bool set(size_t i, bool value) {
-        uint32_t &bit = bits[i >> 5];
-        uint32_t old = bit;
-        uint32_t mask = 1 << (i & 0x1f);
-        //allow the bit to become 1 if not already
-        if (value) {
-            bit |= mask;
-        }//force the bit to 0 if its not already
-        else {
-            bit &= ~mask;
+ * ids are always taken out from the front. in the array they are left in
+ * place and only skipped until the array is changed next time, in the
+ * bitmap the word which might have the first bit set is remembered. */
+class block {
+public:
+    block() : m_first(0), m_count(0) {}
+
+    size_t count() const { return m_count; }
+
+    bool get(uint32_t i) const
+    {
+        if (m_bits.empty()) {
+            return std::binary_search(m_array.begin() + m_first, m_array.end(), uint16_t(i));
+        }
+        return (m_bits[i >> 6] >> (i & 0x3f)) & 1;
+    }
+
+    //returns true if the id wasn't set before
+    bool set(uint32_t i)
+    {
+        if (!m_bits.empty()) {
+            uint64_t &word = m_bits[i >> 6];
+            const uint64_t mask = uint64_t(1) << (i & 0x3f);
+            if (word & mask) {
+                return false;
+            }
+            word |= mask;
+            m_first = std::min(m_first, i >> 6);
+            ++m_count;
+            return true;
+        }
+
+        if (m_first > 0) {
+            m_array.erase(m_array.begin(), m_array.begin() + m_first);
+            m_first = 0;
         }
-        //did it actually change the value
-        return old != bit;
+
+        auto it = std::lower_bound(m_array.begin(), m_array.end(), uint16_t(i));
+        if (it != m_array.end() && *it == i) {
+            return false;
+        }
+
+        if (m_array.size() < ARRAY_MAX) {
+            m_array.insert(it, uint16_t(i));
+        } else {
+            to_bitmap();
+            m_bits[i >> 6] |= uint64_t(1) << (i & 0x3f);
+            m_first = std::min(m_first, i >> 6);
+        }
+        ++m_count;
+        return true;
     }
-    // find the next bit which is set, starting from an initial offset
-    // of start. this offset is a bit like an iterator, but not fully
-    // supporting iterator movement forwards and backwards.
-    //
-    // returns BLOCK_SIZE if a set bit isn't found
-    size_t next_set(size_t start) const {
-        uint32_t bit_i = start >> 5;
-
-        while ((bit_i < (BLOCK_SIZE >> 5)) && (bits[bit_i] == 0)) {
-            ++bit_i;
+
+    // the smallest id, the block must not be empty
+    uint32_t first()
+    {
+        if (m_bits.empty()) {
+            return m_array[m_first];
         }
+        while (m_bits[m_first] == 0) {
+            ++m_first;
+        }
+        return (m_first << 6) | first_bit(m_bits[m_first]);
+    }
 
-        if (bit_i >= (BLOCK_SIZE >> 5)) { return BLOCK_SIZE; }
-        uint32_t bit = bits[bit_i];
-        size_t idx = bit_i << 5;
-        while ((bit & 1) == 0) { ++idx; bit >>= 1; }
-        return idx;
+    // remove the smallest id, the block must not be empty
+    uint32_t pop_first()
+    {
+        const uint32_t i = first();
+        if (m_bits.empty()) {
+            ++m_first;
+        } else {
+            m_bits[i >> 6] &= ~(uint64_t(1) << (i & 0x3f));
+        }
+        --m_count;
+        return i;
     }
+
 private:
-    std::vector<uint32_t> bits;
+    void to_bitmap()
+    {
+        m_bits.assign(BLOCK_SIZE >> 6, 0);
+        for (auto it = m_array.begin() + m_first; it != m_array.end(); ++it) {
+            m_bits[*it >> 6] |= uint64_t(1) << (*it & 0x3f);
+        }
+        m_first = m_array.empty() ? 0 : m_array[m_first] >> 6;
+        std::vector<uint16_t>().swap(m_array);
+    }
+
+    std::vector<uint16_t> m_array;
+    std::vector<uint64_t> m_bits;
+    // index into the array or word of the bitmap
+    uint32_t m_first;
+    uint32_t m_count;
+};
+
+struct chunk {
+    chunk() : blocks(CHUNK_SIZE), used(0) {}
+
+    std::vector<std::unique_ptr<block>> blocks;
+    size_t used;
 };
+
 } // anonymous namespace
 
 struct id_tracker::pimpl {
@@ -64,72 +145,98 @@ struct id_tracker::pimpl {
     ~pimpl();
 
     bool get(osmid_t id) const;
-    bool set(osmid_t id, bool value);
-    osmid_t pop_min();
+    bool set(osmid_t id);
+    template <typename F>
+    void pop_before(osmid_t end, size_t max_count, F &&func);
 
-    typedef std::map<osmid_t, block> map_t;
+    // ids are split into the chunk (the upper 32 bits), the block in the
+    // chunk and the offset in the block. there are usually only a few
+    // chunks, so finding one is cheap, blocks are found by index.
+    typedef std::map<osmid_t, chunk> map_t;
     map_t pending;
     osmid_t old_id;
     size_t count;
-    // a cache of the next starting point to search for in the block.
-    // this significantly speeds up pop_min() because it doesn't need
-    // to repeatedly search the beginning of the block each time.
-    boost::optional<size_t> next_start;
+    // no id smaller than this is marked, so that pop_before() doesn't
+    // need to search the empty blocks at the beginning again and again.
+    osmid_t next_start;
 };
 
 bool id_tracker::pimpl::get(osmid_t id) const {
-    const osmid_t block = id >> BLOCK_BITS, offset = id & BLOCK_MASK;
-    map_t::const_iterator itr = pending.find(block);
-    bool result = false;
-
-    if (itr != pending.end()) {
-        result = itr->second[offset];
+    map_t::const_iterator itr = pending.find(id >> 32);
+    if (itr == pending.end()) {
+        return false;
     }
 
-    return result;
+    const block *b = itr->second.blocks[(id >> BLOCK_BITS) & (CHUNK_SIZE - 1)].get();
+    return b && b->get(id & BLOCK_MASK);
 }
 
-bool id_tracker::pimpl::set(osmid_t id, bool value) {
-    const osmid_t block = id >> BLOCK_BITS, offset = id & BLOCK_MASK;
-    bool flipped = pending[block].set(offset, value);
-    // a set may potentially invalidate a next_start, as the bit
-    // set might be before the position of next_start.
-    if (next_start) { next_start = boost::none; }
-    return flipped;
+bool id_tracker::pimpl::set(osmid_t id) {
+    chunk &c = pending[id >> 32];
+    std::unique_ptr<block> &b = c.blocks[(id >> BLOCK_BITS) & (CHUNK_SIZE - 1)];
+    if (!b) {
+        b.reset(new block());
+        ++c.used;
+    }
+
+    next_start = std::min(next_start, id);
+    return b->set(id & BLOCK_MASK);
 }
 
-// find the first element in a block set to true
-osmid_t id_tracker::pimpl::pop_min() {
-    osmid_t id = max();
+// take out the marked ids below end in order, at most max_count of them
+template <typename F>
+void id_tracker::pimpl::pop_before(osmid_t end, size_t max_count, F &&func) {
+    map_t::iterator itr = pending.lower_bound(next_start >> 32);
+
+    while (itr != pending.end() && max_count > 0) {
+        const osmid_t chunk_base = itr->first * (osmid_t(1) << 32);
+        if (chunk_base >= end) {
+            return;
+        }
 
-    while (next_start || !pending.empty()) {
-        map_t::iterator itr = pending.begin();
-        block &b = itr->second;
-        size_t start = next_start.get_value_or(0);
+        chunk &c = itr->second;
+        size_t idx = (chunk_base < next_start) ? (next_start >> BLOCK_BITS) & (CHUNK_SIZE - 1) : 0;
+        for (; idx < CHUNK_SIZE && c.used > 0; ++idx) {
+            std::unique_ptr<block> &b = c.blocks[idx];
+            if (!b) {
+                continue;
+            }
 
-        size_t b_itr = b.next_set(start);
-        if (b_itr != BLOCK_SIZE) {
-            b.set(b_itr, false);
-            id = (itr->first << BLOCK_BITS) | b_itr;
-            next_start = b_itr;
-            break;
+            const osmid_t block_base = chunk_base + (osmid_t(idx) << BLOCK_BITS);
+            if (block_base >= end) {
+                return;
+            }
+            next_start = block_base;
 
+            while (b->count() > 0 && max_count > 0) {
+                const osmid_t id = block_base + b->first();
+                if (id >= end) {
+                    next_start = id;
+                    return;
+                }
+                b->pop_first();
+                --count;
+                --max_count;
+                func(id);
+            }
+
+            if (b->count() > 0) {
+                return;
+            }
+            b.reset();
+            --c.used;
+        }
+
+        if (c.used == 0) {
+            itr = pending.erase(itr);
         } else {
-            // no elements in this block - might as well delete
-            // the whole thing.
-            pending.erase(itr);
-            // since next_start is relative to the current
-            // block, which is ceasing to exist, then we need to
-            // reset it.
-            next_start = boost::none;
+            ++itr;
         }
     }
-
-    return id;
 }
 
 id_tracker::pimpl::pimpl()
-    : pending(), old_id(min()), count(0), next_start(boost::none) {
+    : pending(), old_id(min()), count(0), next_start(max()) {
 }
 
 id_tracker::pimpl::~pimpl() {
@@ -144,7 +251,7 @@ id_tracker::~id_tracker() {
 
 void id_tracker::mark(osmid_t id) {
     //setting returns true if the id wasn't already marked
-    impl->count += size_t(impl->set(id, true));
+    impl->count += size_t(impl->set(id));
     //we've marked something so we need to be able to pop it
     //the assert below will fail though if we've already popped
     //some that were > id so we have to essentially reset to
@@ -157,18 +264,27 @@ bool id_tracker::is_marked(osmid_t id) {
 }
 
 osmid_t id_tracker::pop_mark() {
-    osmid_t id = impl->pop_min();
+    osmid_t id = max();
+    impl->pop_before(max(), 1, [&id](osmid_t popped) { id = popped; });
 
     assert((id > impl->old_id) || !id_tracker::is_valid(id));
     impl->old_id = id;
 
-    //we just go rid of one (if there were some to get rid of)
-    if(impl->count > 0)
-        impl->count--;
-
     return id;
 }
 
+size_t id_tracker::pop_marks_before(osmid_t id, idlist_t &out, size_t max_count) {
+    const size_t start = out.size();
+    impl->pop_before(id, max_count, [&out](osmid_t popped) { out.push_back(popped); });
+
+    if (out.size() > start) {
+        assert(out[start] > impl->old_id);
+        impl->old_id = out.back();
+    }
+
+    return out.size() - start;
+}
+
 size_t id_tracker::size() const { return impl->count; }
 
 osmid_t id_tracker::last_returned() const { return impl->old_id; }
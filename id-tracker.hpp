@@ -14,10 +14,12 @@
   *
   * Instead, the size of the leaf nodes is increased. This was initially a
   * vector<bool>, but the cost of exposing the iterator was too high.
-  * Instead, it's a uint32, with a function to find the next bit set in the block
+  * Instead, like in a roaring bitmap, each block of 64k ids is a sorted
+  * array of the few ids marked in it, or a bitmap if there are many. The
+  * blocks are found by index in a vector for every 2^32 ids.
   *
   * These details aren't exposed in the public interface, which just has
-  * pop_mark.
+  * pop_mark and pop_marks_before.
   */
 struct id_tracker : public boost::noncopyable {
     id_tracker();
@@ -29,6 +31,12 @@ struct id_tracker : public boost::noncopyable {
      * Finds an osmid_t that is marked
      */
     osmid_t pop_mark();
+    /**
+     * Takes out the marked ids smaller than id in ascending order, up to
+     * max_count of them, and appends them to out.
+     * \return the number of ids added to out
+     */
+    size_t pop_marks_before(osmid_t id, idlist_t &out, size_t max_count);
     size_t size() const;
     osmid_t last_returned() const;
 
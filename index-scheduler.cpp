@@ -0,0 +1,75 @@
+#include "index-scheduler.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <ctime>
+#include <exception>
+#include <future>
+#include <mutex>
+
+index_scheduler_t::index_scheduler_t(size_t parallelism)
+: m_parallelism(parallelism)
+{}
+
+void index_scheduler_t::add(job_t &&job)
+{
+    m_jobs.push_back(std::move(job));
+}
+
+void index_scheduler_t::run()
+{
+    std::stable_sort(m_jobs.begin(), m_jobs.end(),
+                     [](job_t const &a, job_t const &b) { return a.size > b.size; });
+
+    std::atomic<size_t> next_job(0);
+    std::atomic<bool> failed(false);
+    std::mutex error_mutex;
+    std::exception_ptr error;
+
+    auto worker = [&]() {
+        while (!failed) {
+            size_t i = next_job++;
+            if (i >= m_jobs.size()) {
+                return;
+            }
+            try {
+                run_job(m_jobs[i]);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                failed = true;
+            }
+        }
+    };
+
+    const size_t num_workers = m_parallelism > 0 ? std::min(m_parallelism, m_jobs.size())
+                                                 : m_jobs.size();
+    std::vector<std::future<void> > workers;
+    for (size_t i = 0; i < num_workers; ++i) {
+        workers.push_back(std::async(std::launch::async, worker));
+    }
+    for (auto &w : workers) {
+        w.get();
+    }
+
+    m_jobs.clear();
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void index_scheduler_t::run_job(job_t const &job)
+{
+    for (auto const &step : job.steps) {
+        time_t start, end;
+        time(&start);
+        fprintf(stderr, "%s\n", step.first.c_str());
+        step.second();
+        time(&end);
+        fprintf(stderr, "%s finished in %ds\n", step.first.c_str(), (int)(end - start));
+    }
+}
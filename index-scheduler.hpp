@@ -0,0 +1,57 @@
+#ifndef INDEX_SCHEDULER_HPP
+#define INDEX_SCHEDULER_HPP
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+/**
+ * Runs the long database tasks at the end of an import (clustering, index
+ * creation, analyzing) with a limited number of them at the same time.
+ *
+ * Tables and the middle add one job per database table. The steps of a job
+ * run one after the other on the same connection, while the jobs run in
+ * parallel. The biggest tables are started first, so that they don't end
+ * up running alone at the end.
+ */
+class index_scheduler_t : public boost::noncopyable
+{
+public:
+    struct job_t
+    {
+        job_t(std::string const &name_, uint64_t size_) : name(name_), size(size_) {}
+
+        /// Add a step, the description is used for the progress messages.
+        void add_step(std::string const &description, std::function<void()> const &step)
+        {
+            steps.emplace_back(description, step);
+        }
+
+        std::string name;
+        uint64_t size; ///< size of the table in bytes, used for the order
+        std::vector<std::pair<std::string, std::function<void()> > > steps;
+    };
+
+    /// Run up to parallelism jobs at the same time, all of them with 0.
+    explicit index_scheduler_t(size_t parallelism);
+
+    void add(job_t &&job);
+
+    /**
+     * Run all jobs and wait for them to finish. If a step fails, no new
+     * jobs are started and the first error is rethrown.
+     */
+    void run();
+
+private:
+    void run_job(job_t const &job);
+
+    size_t m_parallelism;
+    std::vector<job_t> m_jobs;
+};
+
+#endif
@@ -16,7 +16,9 @@ using namespace std;
 #define alloca _alloca
 #endif
 
+#include <algorithm>
 #include <stdexcept>
+#include <string>
 #include <unordered_map>
 
 #include <cassert>
@@ -24,12 +26,12 @@ using namespace std;
 #include <cstdlib>
 #include <cstring>
 #include <ctime>
-#include <future>
 
 #include <boost/format.hpp>
 
 #include <libpq-fe.h>
 
+#include "index-scheduler.hpp"
 #include "middle-pgsql.hpp"
 #include "node-persistent-cache.hpp"
 #include "node-ram-cache.hpp"
@@ -52,7 +54,8 @@ middle_pgsql_t::table_desc::table_desc(const char *name_,
                                        const char *copy_,
                                        const char *analyze_,
                                        const char *stop_,
-                                       const char *array_indexes_)
+                                       const char *array_indexes_,
+                                       bool copy_binary_)
     : name(name_),
       start(start_),
       create(create_),
@@ -63,76 +66,104 @@ middle_pgsql_t::table_desc::table_desc(const char *name_,
       analyze(analyze_),
       stop(stop_),
       array_indexes(array_indexes_),
+      copy_binary(copy_binary_),
       copyMode(0),
       transactionMode(0),
       sql_conn(nullptr)
 {}
 
 namespace {
-// Decodes a portion of an array literal from postgres */
-// Argument should point to beginning of literal, on return points to delimiter */
-inline const char *decode_upto( const char *src, char *dst )
+/* element types of arrays in binary format, see pg_type.h */
+#define INT8_OID 20
+#define TEXT_OID 25
+
+void append_array_header(std::string &dst, uint32_t elem_type, size_t count)
 {
-  int quoted = (*src == '"');
-  if( quoted ) src++;
+    // an empty array has no dimensions
+    append_be<int32_t>(dst, count ? 1 : 0);
+    append_be<int32_t>(dst, 0); // no NULL elements
+    append_be<uint32_t>(dst, elem_type);
+    if (count) {
+        append_be<int32_t>(dst, count);
+        append_be<int32_t>(dst, 1); // lower bound
+    }
+}
 
-  while( quoted ? (*src != '"') : (*src != ',' && *src != '}') )
-  {
-    if( *src == '\\' )
-    {
-      switch( src[1] )
-      {
-        case 'n': *dst++ = '\n'; break;
-        case 't': *dst++ = '\t'; break;
-        default: *dst++ = src[1]; break;
-      }
-      src+=2;
-    }
-    else
-      *dst++ = *src++;
-  }
-  if( quoted ) src++;
-  *dst = 0;
-  return src;
+// Calls func(data, len) for each element of a one-dimensional array in
+// binary format. The length is -1 for NULL elements.
+template <typename F>
+void pgsql_parse_binary_array(const char *data, F func)
+{
+    int32_t ndim = read_be<int32_t>(data);
+    if (ndim == 0) {
+        return;
+    }
+    assert(ndim == 1);
+
+    int32_t count = read_be<int32_t>(data + 12);
+    const char *elem = data + 20;
+    for (int32_t i = 0; i < count; ++i) {
+        int32_t len = read_be<int32_t>(elem);
+        elem += 4;
+        func(elem, len);
+        if (len > 0) {
+            elem += len;
+        }
+    }
 }
 
-void pgsql_parse_tags(const char *string, taglist_t &tags)
+void pgsql_parse_binary_tags(PGresult *res, int row, int col, taglist_t &tags)
 {
-  char key[1024];
-  char val[1024];
-
-  if( *string == '\0' )
-    return;
-
-  if( *string++ != '{' )
-    return;
-  while( *string != '}' )
-  {
-    string = decode_upto( string, key );
-    // String points to the comma */
-    string++;
-    string = decode_upto( string, val );
-    // String points to the comma or closing '}' */
-    tags.push_back(tag_t(key, val));
-    if( *string == ',' )
-      string++;
-  }
+    if (PQgetisnull(res, row, col)) {
+        return;
+    }
+
+    std::string key;
+    bool is_key = true;
+    pgsql_parse_binary_array(PQgetvalue(res, row, col),
+                             [&](const char *data, int32_t len) {
+        std::string value(data, len > 0 ? len : 0);
+        if (is_key) {
+            key = std::move(value);
+        } else {
+            tags.push_back(tag_t(key, value));
+        }
+        is_key = !is_key;
+    });
 }
 
-// Parses an array of integers */
-void pgsql_parse_nodes(const char *string, idlist_t &nds)
+void pgsql_parse_binary_nodes(PGresult *res, int row, int col, idlist_t &nds)
 {
-  if( *string++ != '{' )
-    return;
-
-  while( *string != '}' )
-  {
-    char *ptr;
-    nds.push_back(strtoosmid( string, &ptr, 10 ));
-    string = ptr;
-    if( *string == ',' )
-      string++;
-  }
+    if (PQgetisnull(res, row, col)) {
+        return;
+    }
+
+    pgsql_parse_binary_array(PQgetvalue(res, row, col),
+                             [&nds](const char *data, int32_t) {
+        nds.push_back(read_be<int64_t>(data));
+    });
+}
+
+#ifndef FIXED_POINT
+double read_float8(const char *src)
+{
+    uint64_t bits = read_be<uint64_t>(src);
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+#endif
+
+void pgsql_startCopy(middle_pgsql_t::table_desc *table)
+{
+    pgsql_exec(table->sql_conn, PGRES_COPY_IN, "%s", table->copy);
+    table->copyMode = 1;
+
+    if (table->copy_binary) {
+        std::string header;
+        append_copy_header(header);
+        pgsql_CopyData(table->name, table->sql_conn, header);
+    }
 }
 
 int pgsql_endCopy(middle_pgsql_t::table_desc *table)
@@ -140,6 +171,12 @@ int pgsql_endCopy(middle_pgsql_t::table_desc *table)
     // Terminate any pending COPY */
     if (table->copyMode) {
         PGconn *sql_conn = table->sql_conn;
+        if (table->copy_binary) {
+            std::string trailer;
+            append_copy_trailer(trailer);
+            pgsql_CopyData(table->name, sql_conn, trailer);
+        }
+
         int stop = PQputCopyEnd(sql_conn, nullptr);
         if (stop != 1) {
             fprintf(stderr, "COPY_END for %s failed: %s\n", table->copy, PQerrorMessage(sql_conn));
@@ -230,6 +267,34 @@ void middle_pgsql_t::buffer_store_tags(taglist_t const &tags, bool escape)
     copy_buffer += "}";
 }
 
+void middle_pgsql_t::buffer_store_binary_nodes(idlist_t const &nds)
+{
+    size_t pos = reserve_length(copy_buffer);
+    append_array_header(copy_buffer, INT8_OID, nds.size());
+    for (auto const id : nds) {
+        append_be<int32_t>(copy_buffer, sizeof(int64_t));
+        append_be<int64_t>(copy_buffer, id);
+    }
+    finish_field(copy_buffer, pos);
+}
+
+// NULL if there are no tags, like in the text format
+void middle_pgsql_t::buffer_store_binary_tags(taglist_t const &tags)
+{
+    if (tags.empty()) {
+        append_null(copy_buffer);
+        return;
+    }
+
+    size_t pos = reserve_length(copy_buffer);
+    append_array_header(copy_buffer, TEXT_OID, tags.size() * 2);
+    for (auto const &it : tags) {
+        append_text(copy_buffer, it.key.c_str(), it.key.size());
+        append_text(copy_buffer, it.value.c_str(), it.value.size());
+    }
+    finish_field(copy_buffer, pos);
+}
+
 void middle_pgsql_t::buffer_correct_params(char const **param, size_t size)
 {
     if (copy_buffer.c_str() != param[0]) {
@@ -305,19 +370,16 @@ size_t middle_pgsql_t::local_nodes_get_list(nodelist_t &out, const idlist_t nds)
     // create a list of ids in tmp2 to query the database  */
     sprintf(tmp2, "{");
     int countDB = 0;
-    for(idlist_t::const_iterator it = nds.begin(); it != nds.end(); ++it) {
-        // Check cache first */
-        osmNode loc;
-        if (cache->get(&loc, *it) == 0) {
-            out.push_back(loc);
+    // Check cache first, nodes not found there are left invalid */
+    cache->get_list(out, nds);
+    for (size_t i = 0; i < nds.size(); ++i) {
+        if (!std::isnan(out[i].lat)) {
             continue;
         }
 
         countDB++;
-        // Mark nodes as needing to be fetched from the DB */
-        out.push_back(osmNode());
 
-        snprintf(tmp, sizeof(tmp), "%" PRIdOSMID ",", *it);
+        snprintf(tmp, sizeof(tmp), "%" PRIdOSMID ",", nds[i]);
         strncat(tmp2, tmp, sizeof(char)*(nds.size()*16 - 2));
     }
     tmp2[strlen(tmp2) - 1] = '}'; // replace last , with } to complete list of ids*/
@@ -333,24 +395,24 @@ size_t middle_pgsql_t::local_nodes_get_list(nodelist_t &out, const idlist_t nds)
 
     char const *paramValues[1];
     paramValues[0] = tmp2;
-    PGresult *res = pgsql_execPrepared(sql_conn, "get_node_list", 1, paramValues, PGRES_TUPLES_OK);
+    PGresult *res = pgsql_execPrepared(sql_conn, "get_node_list", 1, paramValues, PGRES_TUPLES_OK, 1);
     int countPG = PQntuples(res);
 
     //store the pg results in a hashmap and telling it how many we expect
     std::unordered_map<osmid_t, osmNode> pg_nodes(countPG);
 
     for (int i = 0; i < countPG; i++) {
-        osmid_t id = strtoosmid(PQgetvalue(res, i, 0), nullptr, 10);
+        osmid_t id = read_be<int64_t>(PQgetvalue(res, i, 0));
         osmNode node;
 #ifdef FIXED_POINT
-        ramNode n((int) strtol(PQgetvalue(res, i, 2), nullptr, 10),
-                  (int) strtol(PQgetvalue(res, i, 1), nullptr, 10));
+        ramNode n(read_be<int32_t>(PQgetvalue(res, i, 2)),
+                  read_be<int32_t>(PQgetvalue(res, i, 1)));
 
         node.lat = n.lat();
         node.lon = n.lon();
 #else
-        node.lat = strtod(PQgetvalue(res, i, 1), nullptr);
-        node.lon = strtod(PQgetvalue(res, i, 2), nullptr);
+        node.lat = read_float8(PQgetvalue(res, i, 1));
+        node.lon = read_float8(PQgetvalue(res, i, 2));
 #endif
         pg_nodes.emplace(id, node);
     }
@@ -381,6 +443,15 @@ size_t middle_pgsql_t::local_nodes_get_list(nodelist_t &out, const idlist_t nds)
 
 
 void middle_pgsql_t::nodes_set(osmid_t id, double lat, double lon, const taglist_t &tags) {
+    // the ways bring their own node locations, only nodes with tags are
+    // kept in the nodes table
+    if (out_options->locations_on_ways) {
+        if (!tags.empty()) {
+            local_nodes_set(id, lat, lon, tags);
+        }
+        return;
+    }
+
     cache->set( id, lat, lon, tags );
 
     if (out_options->flat_node_cache_enabled) {
@@ -392,6 +463,10 @@ void middle_pgsql_t::nodes_set(osmid_t id, double lat, double lon, const taglist
 
 size_t middle_pgsql_t::nodes_get_list(nodelist_t &out, const idlist_t nds) const
 {
+    if (out_options->locations_on_ways) {
+        return unpack_locations(out, nds);
+    }
+
     return (out_options->flat_node_cache_enabled)
              ? persistent_cache->get_list(out, nds)
              : local_nodes_get_list(out, nds);
@@ -411,6 +486,10 @@ void middle_pgsql_t::local_nodes_delete(osmid_t osm_id)
 
 void middle_pgsql_t::nodes_delete(osmid_t osm_id)
 {
+    // the cache is kept over several change files with --watch-dir, and
+    // a modified node might not make it into the cache again
+    cache->remove(osm_id);
+
     if (out_options->flat_node_cache_enabled) {
         persistent_cache->set(osm_id, NAN, NAN);
     } else {
@@ -424,68 +503,86 @@ void middle_pgsql_t::node_changed(osmid_t osm_id)
         return;
     }
 
-    char const *paramValues[1];
-    char buffer[64];
-    // Make sure we're out of copy mode */
-    pgsql_endCopy( way_table );
-    pgsql_endCopy( rel_table );
+    // the ways and relations using the node are looked up together for
+    // all changed nodes in resolve_changes()
+    changed_nodes.push_back(osm_id);
+}
 
-    sprintf( buffer, "%" PRIdOSMID, osm_id );
-    paramValues[0] = buffer;
+void middle_pgsql_t::way_nodes_set(osmid_t way_id, const idlist_t &nds)
+{
+    // closed ways have their first node twice
+    idlist_t nodes(nds);
+    std::sort(nodes.begin(), nodes.end());
+    nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
 
-    //keep track of whatever ways and rels these nodes intersect
-    //TODO: dont need to stop the copy above since we are only reading?
-    PGresult* res = pgsql_execPrepared(way_table->sql_conn, "mark_ways_by_node", 1, paramValues, PGRES_TUPLES_OK );
-    for(int i = 0; i < PQntuples(res); ++i)
-    {
-        char *end;
-        osmid_t marked = strtoosmid(PQgetvalue(res, i, 0), &end, 10);
-        ways_pending_tracker->mark(marked);
+    if (nodes.empty()) {
+        return;
     }
-    PQclear(res);
 
-    //do the rels too
-    res = pgsql_execPrepared(rel_table->sql_conn, "mark_rels_by_node", 1, paramValues, PGRES_TUPLES_OK );
-    for(int i = 0; i < PQntuples(res); ++i)
-    {
-        char *end;
-        osmid_t marked = strtoosmid(PQgetvalue(res, i, 0), &end, 10);
-        rels_pending_tracker->mark(marked);
+    if (way_node_table->copyMode) {
+        // Two fields per row: node_id, way_id
+        copy_buffer.clear();
+        for (osmid_t node : nodes) {
+            append_be<int16_t>(copy_buffer, 2);
+            append_be<int32_t>(copy_buffer, sizeof(int64_t));
+            append_be<int64_t>(copy_buffer, node);
+            append_be<int32_t>(copy_buffer, sizeof(int64_t));
+            append_be<int64_t>(copy_buffer, way_id);
+        }
+        pgsql_CopyData(__FUNCTION__, way_node_table->sql_conn, copy_buffer);
+        return;
     }
-    PQclear(res);
+
+    char buffer[64];
+    sprintf(buffer, "%" PRIdOSMID, way_id);
+
+    copy_buffer.clear();
+    buffer_store_nodes(nodes);
+
+    char const *paramValues[2] = { buffer, copy_buffer.c_str() };
+    pgsql_execPrepared(way_node_table->sql_conn, "insert_way_nodes", 2, paramValues, PGRES_COMMAND_OK);
 }
 
 void middle_pgsql_t::ways_set(osmid_t way_id, const idlist_t &nds, const taglist_t &tags)
 {
-    copy_buffer.reserve(nds.size() * 10 + tags.size() * 24 + 64);
-    bool copy = way_table->copyMode;
-    char delim = copy ? '\t' : '\0';
+    if (way_node_table) {
+        way_nodes_set(way_id, nds);
+    }
+
+    copy_buffer.reserve(nds.size() * 12 + tags.size() * 24 + 64);
+
+    if (way_table->copyMode) {
+        // Three fields: id, nodes, tags
+        copy_buffer.clear();
+        append_be<int16_t>(copy_buffer, 3);
+        append_be<int32_t>(copy_buffer, sizeof(int64_t));
+        append_be<int64_t>(copy_buffer, way_id);
+        buffer_store_binary_nodes(nds);
+        buffer_store_binary_tags(tags);
+        pgsql_CopyData(__FUNCTION__, way_table->sql_conn, copy_buffer);
+        return;
+    }
+
     // Three params: id, nodes, tags */
     const char *paramValues[4] = { copy_buffer.c_str(), };
 
     copy_buffer = std::to_string(way_id);
-    copy_buffer += delim;
+    copy_buffer += '\0';
 
     paramValues[1] = paramValues[0] + copy_buffer.size();
     buffer_store_nodes(nds);
-    copy_buffer += delim;
+    copy_buffer += '\0';
 
     if (tags.size() == 0) {
         paramValues[2] = nullptr;
-        copy_buffer += "\\N";
     } else {
         paramValues[2] = paramValues[0] + copy_buffer.size();
-        buffer_store_tags(tags, copy);
+        buffer_store_tags(tags, false);
     }
 
-    if (copy) {
-        copy_buffer += '\n';
-        pgsql_CopyData(__FUNCTION__, way_table->sql_conn, copy_buffer);
-    } else {
-        buffer_correct_params(paramValues, 3);
-        pgsql_execPrepared(way_table->sql_conn, "insert_way", 3,
-                           (const char * const *)paramValues, PGRES_COMMAND_OK);
-    }
+    buffer_correct_params(paramValues, 3);
+    pgsql_execPrepared(way_table->sql_conn, "insert_way", 3,
+                       (const char * const *)paramValues, PGRES_COMMAND_OK);
 }
 
 bool middle_pgsql_t::ways_get(osmid_t id, taglist_t &tags, nodelist_t &nodes) const
@@ -500,18 +597,18 @@ bool middle_pgsql_t::ways_get(osmid_t id, taglist_t &tags, nodelist_t &nodes) co
     snprintf(tmp, sizeof(tmp), "%" PRIdOSMID, id);
     paramValues[0] = tmp;
 
-    PGresult *res = pgsql_execPrepared(sql_conn, "get_way", 1, paramValues, PGRES_TUPLES_OK);
+    PGresult *res = pgsql_execPrepared(sql_conn, "get_way", 1, paramValues, PGRES_TUPLES_OK, 1);
 
     if (PQntuples(res) != 1) {
         PQclear(res);
         return false;
     }
 
-    pgsql_parse_tags( PQgetvalue(res, 0, 1), tags );
+    pgsql_parse_binary_tags(res, 0, 1, tags);
 
-    size_t num_nodes = strtoul(PQgetvalue(res, 0, 2), nullptr, 10);
+    size_t num_nodes = PQgetisnull(res, 0, 2) ? 0 : read_be<int32_t>(PQgetvalue(res, 0, 2));
     idlist_t list;
-    pgsql_parse_nodes( PQgetvalue(res, 0, 0), list);
+    pgsql_parse_binary_nodes(res, 0, 0, list);
     if (num_nodes != list.size()) {
         fprintf(stderr, "parse_nodes problem for way %s: expected nodes %zu got %zu\n",
                 tmp, num_nodes, list.size());
@@ -528,59 +625,59 @@ size_t middle_pgsql_t::ways_get_list(const idlist_t &ids, idlist_t &way_ids,
     if (ids.empty())
         return 0;
 
-    char tmp[16];
-    std::unique_ptr<char[]> tmp2(new (std::nothrow) char[ids.size() * 16]);
+    char tmp[32];
     char const *paramValues[1];
 
-    if (tmp2 == nullptr) return 0; //failed to allocate memory, return */
-
-    // create a list of ids in tmp2 to query the database  */
-    sprintf(tmp2.get(), "{");
+    // create a list of ids to query the database, appending instead of
+    // strncat() keeps this linear for large batches
+    std::string idarray("{");
+    idarray.reserve(ids.size() * 12 + 2);
     for(idlist_t::const_iterator it = ids.begin(); it != ids.end(); ++it) {
         snprintf(tmp, sizeof(tmp), "%" PRIdOSMID ",", *it);
-        strncat(tmp2.get(), tmp, sizeof(char)*(ids.size()*16 - 2));
+        idarray += tmp;
     }
-    tmp2[strlen(tmp2.get()) - 1] = '}'; // replace last , with } to complete list of ids*/
+    idarray.back() = '}'; // replace last , with } to complete list of ids
 
     pgsql_endCopy(way_table);
 
     PGconn *sql_conn = way_table->sql_conn;
 
-    paramValues[0] = tmp2.get();
-    PGresult *res = pgsql_execPrepared(sql_conn, "get_way_list", 1, paramValues, PGRES_TUPLES_OK);
+    paramValues[0] = idarray.c_str();
+    PGresult *res = pgsql_execPrepared(sql_conn, "get_way_list", 1, paramValues, PGRES_TUPLES_OK, 1);
     int countPG = PQntuples(res);
 
-    idlist_t wayidspg;
+    // row of each way in the result, which comes back in a different order
+    std::unordered_map<osmid_t, int> wayidspg;
+    wayidspg.reserve(countPG);
 
     for (int i = 0; i < countPG; i++) {
-        wayidspg.push_back(strtoosmid(PQgetvalue(res, i, 0), nullptr, 10));
+        wayidspg.emplace(read_be<int64_t>(PQgetvalue(res, i, 0)), i);
     }
 
-
-    // Match the list of ways coming from postgres in a different order
-    //   back to the list of ways given by the caller */
+    // Match the list of ways coming from postgres back to the list of ways
+    // given by the caller
     for(idlist_t::const_iterator it = ids.begin(); it != ids.end(); ++it) {
-        for (int j = 0; j < countPG; j++) {
-            if (*it == wayidspg[j]) {
-                way_ids.push_back(*it);
-                tags.push_back(taglist_t());
-                pgsql_parse_tags(PQgetvalue(res, j, 2), tags.back());
-
-                size_t num_nodes = strtoul(PQgetvalue(res, j, 3), nullptr, 10);
-                idlist_t list;
-                pgsql_parse_nodes( PQgetvalue(res, j, 1), list);
-                if (num_nodes != list.size()) {
-                    fprintf(stderr, "parse_nodes problem for way %s: expected nodes %zu got %zu\n",
-                            tmp, num_nodes, list.size());
-                    util::exit_nicely();
-                }
-
-                nodes.push_back(nodelist_t());
-                nodes_get_list(nodes.back(), list);
-
-                break;
-            }
+        auto row = wayidspg.find(*it);
+        if (row == wayidspg.end()) {
+            continue;
         }
+        int j = row->second;
+
+        way_ids.push_back(*it);
+        tags.push_back(taglist_t());
+        pgsql_parse_binary_tags(res, j, 2, tags.back());
+
+        size_t num_nodes = PQgetisnull(res, j, 3) ? 0 : read_be<int32_t>(PQgetvalue(res, j, 3));
+        idlist_t list;
+        pgsql_parse_binary_nodes(res, j, 1, list);
+        if (num_nodes != list.size()) {
+            fprintf(stderr, "parse_nodes problem for way %" PRIdOSMID ": expected nodes %zu got %zu\n",
+                    *it, num_nodes, list.size());
+            util::exit_nicely();
+        }
+
+        nodes.push_back(nodelist_t());
+        nodes_get_list(nodes.back(), list);
     }
 
     assert(way_ids.size() <= ids.size());
@@ -600,11 +697,26 @@ void middle_pgsql_t::ways_delete(osmid_t osm_id)
 
     sprintf( buffer, "%" PRIdOSMID, osm_id );
     paramValues[0] = buffer;
+
+    if (way_node_table) {
+        // the nodes of the deleted way tell which rows of the way node
+        // table to remove, so that it needs no index on the way id
+        PGresult *res = pgsql_execPrepared(way_table->sql_conn, "delete_way_get_nodes", 1, paramValues, PGRES_TUPLES_OK);
+        if (PQntuples(res) == 1) {
+            pgsql_endCopy(way_node_table);
+            char const *nodeParams[2] = { buffer, PQgetvalue(res, 0, 0) };
+            pgsql_execPrepared(way_node_table->sql_conn, "delete_way_nodes", 2, nodeParams, PGRES_COMMAND_OK);
+        }
+        PQclear(res);
+        return;
+    }
+
     pgsql_execPrepared(way_table->sql_conn, "delete_way", 1, paramValues, PGRES_COMMAND_OK );
 }
 
 void middle_pgsql_t::iterate_ways(middle_t::pending_processor& pf)
 {
+    resolve_changes();
 
     // Make sure we're out of copy mode */
     pgsql_endCopy( way_table );
@@ -624,24 +736,7 @@ void middle_pgsql_t::iterate_ways(middle_t::pending_processor& pf)
 
 void middle_pgsql_t::way_changed(osmid_t osm_id)
 {
-    char const *paramValues[1];
-    char buffer[64];
-    // Make sure we're out of copy mode */
-    pgsql_endCopy( rel_table );
-
-    sprintf( buffer, "%" PRIdOSMID, osm_id );
-    paramValues[0] = buffer;
-
-    //keep track of whatever rels this way intersects
-    //TODO: dont need to stop the copy above since we are only reading?
-    PGresult* res = pgsql_execPrepared(rel_table->sql_conn, "mark_rels_by_way", 1, paramValues, PGRES_TUPLES_OK );
-    for(int i = 0; i < PQntuples(res); ++i)
-    {
-        char *end;
-        osmid_t marked = strtoosmid(PQgetvalue(res, i, 0), &end, 10);
-        rels_pending_tracker->mark(marked);
-    }
-    PQclear(res);
+    changed_ways.push_back(osm_id);
 }
 
 void middle_pgsql_t::relations_set(osmid_t id, const memberlist_t &members, const taglist_t &tags)
@@ -674,54 +769,62 @@ void middle_pgsql_t::relations_set(osmid_t id, const memberlist_t &members, cons
     all_parts.insert(all_parts.end(), way_parts.begin(), way_parts.end());
     all_parts.insert(all_parts.end(), rel_parts.begin(), rel_parts.end());
 
-    copy_buffer.reserve(all_parts.size() * 10 + member_list.size() * 24
+    copy_buffer.reserve(all_parts.size() * 12 + member_list.size() * 24
                         + tags.size() * 24 + 64);
 
+    if (rel_table->copyMode) {
+        // Six fields: id, way_off, rel_off, parts, members, tags
+        copy_buffer.clear();
+        append_be<int16_t>(copy_buffer, 6);
+        append_be<int32_t>(copy_buffer, sizeof(int64_t));
+        append_be<int64_t>(copy_buffer, id);
+        append_be<int32_t>(copy_buffer, sizeof(int16_t));
+        append_be<int16_t>(copy_buffer, node_parts.size());
+        append_be<int32_t>(copy_buffer, sizeof(int16_t));
+        append_be<int16_t>(copy_buffer, node_parts.size() + way_parts.size());
+        buffer_store_binary_nodes(all_parts);
+        buffer_store_binary_tags(member_list);
+        buffer_store_binary_tags(tags);
+        pgsql_CopyData(__FUNCTION__, rel_table->sql_conn, copy_buffer);
+        return;
+    }
+
     // Params: id, way_off, rel_off, parts, members, tags */
     const char *paramValues[6] = { copy_buffer.c_str(), };
-    bool copy = rel_table->copyMode;
-    char delim = copy ? '\t' : '\0';
 
     copy_buffer = std::to_string(id);
-    copy_buffer+= delim;
+    copy_buffer += '\0';
 
     paramValues[1] = paramValues[0] + copy_buffer.size();
     copy_buffer += std::to_string(node_parts.size());
-    copy_buffer+= delim;
+    copy_buffer += '\0';
 
     paramValues[2] = paramValues[0] + copy_buffer.size();
     copy_buffer += std::to_string(node_parts.size() + way_parts.size());
-    copy_buffer+= delim;
+    copy_buffer += '\0';
 
     paramValues[3] = paramValues[0] + copy_buffer.size();
     buffer_store_nodes(all_parts);
-    copy_buffer+= delim;
+    copy_buffer += '\0';
 
     if (member_list.size() == 0) {
         paramValues[4] = nullptr;
-        copy_buffer += "\\N";
     } else {
         paramValues[4] = paramValues[0] + copy_buffer.size();
-        buffer_store_tags(member_list, copy);
+        buffer_store_tags(member_list, false);
     }
-    copy_buffer+= delim;
+    copy_buffer += '\0';
 
     if (tags.size() == 0) {
         paramValues[5] = nullptr;
-        copy_buffer += "\\N";
     } else {
         paramValues[5] = paramValues[0] + copy_buffer.size();
-        buffer_store_tags(tags, copy);
+        buffer_store_tags(tags, false);
     }
 
-    if (copy) {
-        copy_buffer+= '\n';
-        pgsql_CopyData(__FUNCTION__, rel_table->sql_conn, copy_buffer);
-    } else {
-        buffer_correct_params(paramValues, 6);
-        pgsql_execPrepared(rel_table->sql_conn, "insert_rel", 6,
-                           (const char * const *)paramValues, PGRES_COMMAND_OK);
-    }
+    buffer_correct_params(paramValues, 6);
+    pgsql_execPrepared(rel_table->sql_conn, "insert_rel", 6,
+                       (const char * const *)paramValues, PGRES_COMMAND_OK);
 }
 
 bool middle_pgsql_t::relations_get(osmid_t id, memberlist_t &members, taglist_t &tags) const
@@ -737,7 +840,7 @@ bool middle_pgsql_t::relations_get(osmid_t id, memberlist_t &members, taglist_t
     snprintf(tmp, sizeof(tmp), "%" PRIdOSMID, id);
     paramValues[0] = tmp;
 
-    PGresult *res = pgsql_execPrepared(sql_conn, "get_rel", 1, paramValues, PGRES_TUPLES_OK);
+    PGresult *res = pgsql_execPrepared(sql_conn, "get_rel", 1, paramValues, PGRES_TUPLES_OK, 1);
     // Fields are: members, tags, member_count */
 
     if (PQntuples(res) != 1) {
@@ -745,10 +848,11 @@ bool middle_pgsql_t::relations_get(osmid_t id, memberlist_t &members, taglist_t
         return false;
     }
 
-    pgsql_parse_tags(PQgetvalue(res, 0, 1), tags);
-    pgsql_parse_tags(PQgetvalue(res, 0, 0), member_temp);
+    pgsql_parse_binary_tags(res, 0, 1, tags);
+    pgsql_parse_binary_tags(res, 0, 0, member_temp);
 
-    if (member_temp.size() != strtoul(PQgetvalue(res, 0, 2), nullptr, 10)) {
+    size_t member_count = PQgetisnull(res, 0, 2) ? 0 : read_be<int32_t>(PQgetvalue(res, 0, 2));
+    if (member_temp.size() != member_count) {
         fprintf(stderr, "Unexpected member_count reading relation %" PRIdOSMID "\n", id);
         util::exit_nicely();
     }
@@ -791,6 +895,8 @@ void middle_pgsql_t::relations_delete(osmid_t osm_id)
 
 void middle_pgsql_t::iterate_relations(pending_processor& pf)
 {
+    resolve_changes();
+
     // Make sure we're out of copy mode */
     pgsql_endCopy( rel_table );
 
@@ -809,25 +915,67 @@ void middle_pgsql_t::iterate_relations(pending_processor& pf)
 
 void middle_pgsql_t::relation_changed(osmid_t osm_id)
 {
+    changed_rels.push_back(osm_id);
+}
+
+void middle_pgsql_t::mark_pending_by(table_desc *table, const char *stmt,
+                                     idlist_t const &ids, id_tracker *tracker)
+{
+    // ids per query, keeps the array parameter at a sane size
+    const size_t batch_size = 10000;
+
+    std::string idarray;
     char const *paramValues[1];
-    char buffer[64];
-    // Make sure we're out of copy mode */
-    pgsql_endCopy( rel_table );
 
-    sprintf( buffer, "%" PRIdOSMID, osm_id );
-    paramValues[0] = buffer;
+    for (size_t start = 0; start < ids.size(); start += batch_size) {
+        const size_t end = std::min(start + batch_size, ids.size());
 
-    //keep track of whatever ways and rels these nodes intersect
-    //TODO: dont need to stop the copy above since we are only reading?
-    //TODO: can we just mark the id without querying? the where clause seems intersect reltable.parts with the id
-    PGresult* res = pgsql_execPrepared(rel_table->sql_conn, "mark_rels", 1, paramValues, PGRES_TUPLES_OK );
-    for(int i = 0; i < PQntuples(res); ++i)
-    {
-        char *end;
-        osmid_t marked = strtoosmid(PQgetvalue(res, i, 0), &end, 10);
-        rels_pending_tracker->mark(marked);
+        idarray = "{";
+        for (size_t i = start; i < end; ++i) {
+            idarray += std::to_string(ids[i]);
+            idarray += ',';
+        }
+        idarray.back() = '}';
+
+        paramValues[0] = idarray.c_str();
+        PGresult *res = pgsql_execPrepared(table->sql_conn, stmt, 1, paramValues, PGRES_TUPLES_OK);
+        for (int i = 0; i < PQntuples(res); ++i) {
+            char *end;
+            osmid_t marked = strtoosmid(PQgetvalue(res, i, 0), &end, 10);
+            tracker->mark(marked);
+        }
+        PQclear(res);
     }
-    PQclear(res);
+}
+
+void middle_pgsql_t::resolve_changes()
+{
+    if (changed_nodes.empty() && changed_ways.empty() && changed_rels.empty()) {
+        return;
+    }
+
+    // Make sure we're out of copy mode */
+    pgsql_endCopy(way_table);
+    pgsql_endCopy(rel_table);
+    if (way_node_table) {
+        pgsql_endCopy(way_node_table);
+    }
+
+    for (idlist_t *ids : { &changed_nodes, &changed_ways, &changed_rels }) {
+        std::sort(ids->begin(), ids->end());
+        ids->erase(std::unique(ids->begin(), ids->end()), ids->end());
+    }
+
+    // keep track of whatever ways and rels the changed objects are part of
+    mark_pending_by(way_node_table ? way_node_table : way_table, "mark_ways_by_nodes",
+                    changed_nodes, ways_pending_tracker.get());
+    mark_pending_by(rel_table, "mark_rels_by_nodes", changed_nodes, rels_pending_tracker.get());
+    mark_pending_by(rel_table, "mark_rels_by_ways", changed_ways, rels_pending_tracker.get());
+    mark_pending_by(rel_table, "mark_rels_by_rels", changed_rels, rels_pending_tracker.get());
+
+    idlist_t().swap(changed_nodes);
+    idlist_t().swap(changed_ways);
+    idlist_t().swap(changed_rels);
 }
 
 idlist_t middle_pgsql_t::relations_using_way(osmid_t way_id) const
@@ -964,6 +1112,28 @@ static void set_prefix_and_tbls(const struct options_t *options, const char **st
     *string = strdup(buffer);
 }
 
+/* Checks on a connection of its own whether a table with the name, which
+ * still contains the placeholders, exists. */
+static bool table_exists(const struct options_t *options, const char *name)
+{
+    set_prefix_and_tbls(options, &name);
+    std::string sql = std::string("SELECT 1 FROM ") + name + " LIMIT 0";
+    free(const_cast<char *>(name));
+
+    PGconn *sql_conn = PQconnectdb(options->database_options.conninfo().c_str());
+    if (PQstatus(sql_conn) != CONNECTION_OK) {
+        fprintf(stderr, "Connection to database failed: %s\n", PQerrorMessage(sql_conn));
+        util::exit_nicely();
+    }
+
+    PGresult *res = PQexec(sql_conn, sql.c_str());
+    bool exists = PQresultStatus(res) == PGRES_TUPLES_OK;
+    PQclear(res);
+    PQfinish(sql_conn);
+
+    return exists;
+}
+
 void middle_pgsql_t::connect(table_desc& table) {
     PGconn *sql_conn;
 
@@ -996,6 +1166,9 @@ void middle_pgsql_t::start(const options_t *out_options_)
 
     ways_pending_tracker.reset(new id_tracker());
     rels_pending_tracker.reset(new id_tracker());
+    changed_nodes.clear();
+    changed_ways.clear();
+    changed_rels.clear();
 
     // Gazetter doesn't use mark-pending processing and consequently
     // needs no way-node index.
@@ -1008,12 +1181,44 @@ void middle_pgsql_t::start(const options_t *out_options_)
         mark_pending = false;
     }
 
+    // Updates have to find the ways of changed nodes the same way as the
+    // import did, so they use the table if and only if the import made it.
+    bool use_way_node_table = mark_pending && out_options->way_node_table;
+    if (mark_pending && out_options->append && way_node_table) {
+        bool exists = table_exists(out_options, way_node_table->name);
+        if (exists && !use_way_node_table) {
+            fprintf(stderr, "The database has a way node table, using it for the update.\n");
+        } else if (!exists && use_way_node_table) {
+            fprintf(stderr, "Warning: the database has no way node table, --way-node-table is ignored.\n");
+        }
+        use_way_node_table = exists;
+    }
+
+    // With a separate table for finding the ways of a node, the ways table
+    // needs no GIN index. Without, the table isn't set up at all, but one
+    // left over from an earlier import is still dropped with the ways table.
+    std::string unused_way_node_table;
+    if (use_way_node_table) {
+        way_table->array_indexes = nullptr;
+    } else if (way_node_table) {
+        const char *name = way_node_table->name;
+        set_prefix_and_tbls(out_options, &name);
+        unused_way_node_table = name;
+        free(const_cast<char *>(name));
+
+        tables.pop_back();
+        num_tables = tables.size();
+        way_node_table = nullptr;
+    }
+
     append = out_options->append;
     // reset this on every start to avoid options from last run
     // staying set for the second.
     build_indexes = !append && !out_options->droptemp;
 
-    cache.reset(new node_ram_cache( out_options->alloc_chunkwise | ALLOC_LOSSY, out_options->cache, out_options->scale));
+    cache.reset(new node_ram_cache( out_options->alloc_chunkwise | ALLOC_LOSSY,
+                                    out_options->locations_on_ways ? 0 : out_options->cache,
+                                    out_options->scale));
     if (out_options->flat_node_cache_enabled) persistent_cache.reset(new node_persistent_cache(out_options, out_options->append, false, cache));
 
     fprintf(stderr, "Mid: pgsql, scale=%d cache=%d\n", out_options->scale, out_options->cache);
@@ -1042,6 +1247,10 @@ void middle_pgsql_t::start(const options_t *out_options_)
         pgsql_exec(sql_conn, PGRES_COMMAND_OK, "SET client_min_messages = WARNING");
         if (dropcreate) {
             pgsql_exec(sql_conn, PGRES_COMMAND_OK, "DROP TABLE IF EXISTS %s", table.name);
+            if (&table == way_table && !unused_way_node_table.empty()) {
+                pgsql_exec(sql_conn, PGRES_COMMAND_OK, "DROP TABLE IF EXISTS %s",
+                           unused_way_node_table.c_str());
+            }
         }
 
         if (table.start) {
@@ -1066,13 +1275,16 @@ void middle_pgsql_t::start(const options_t *out_options_)
         }
 
         if (table.copy) {
-            pgsql_exec(sql_conn, PGRES_COPY_IN, "%s", table.copy);
-            table.copyMode = 1;
+            pgsql_startCopy(&table);
         }
     }
 }
 
 void middle_pgsql_t::commit(void) {
+    // find the objects depending on the changed ones while still in the
+    // transaction, so that pending_count() is right afterwards
+    resolve_changes();
+
     for (auto& table: tables) {
         PGconn *sql_conn = table.sql_conn;
         pgsql_endCopy(&table);
@@ -1082,55 +1294,103 @@ void middle_pgsql_t::commit(void) {
         }
     }
     // Make sure the flat nodes are committed to disk or there will be
-    // surprises later.
-    if (out_options->flat_node_cache_enabled) persistent_cache.reset();
+    // surprises later. On updates the cache is only flushed, so that it
+    // stays warm for the next change file.
+    if (out_options->flat_node_cache_enabled) {
+        if (append && persistent_cache) {
+            persistent_cache->flush();
+        } else {
+            persistent_cache.reset();
+        }
+        shared_persistent_cache.reset();
+    }
 }
 
-void middle_pgsql_t::pgsql_stop_one(table_desc *table)
+void middle_pgsql_t::changes_done()
 {
-    time_t start, end;
+    for (auto& table: tables) {
+        if (table.start && !table.transactionMode) {
+            pgsql_exec(table.sql_conn, PGRES_COMMAND_OK, "%s", table.start);
+            table.transactionMode = 1;
+        }
+        if (table.copy && !table.copyMode) {
+            pgsql_startCopy(&table);
+        }
+    }
+}
 
-    PGconn *sql_conn = table->sql_conn;
+void middle_pgsql_t::flush_nodes()
+{
+    if (out_options->flat_node_cache_enabled) {
+        persistent_cache->set_read_mode();
+    }
+
+    // Commit the tables, so that other connections can see them. The node
+    // table stays out of COPY mode, so that new nodes are visible as soon
+    // as they are inserted.
+    for (auto& table: tables) {
+        pgsql_endCopy(&table);
+        if (table.stop && table.transactionMode) {
+            pgsql_exec(table.sql_conn, PGRES_COMMAND_OK, "%s", table.stop);
+            table.transactionMode = 0;
+        }
+        if (&table != node_table && table.copy) {
+            pgsql_startCopy(&table);
+        }
+    }
+}
 
-    fprintf(stderr, "Stopping table: %s\n", table->name);
+void middle_pgsql_t::pgsql_stop_one(table_desc *table, index_scheduler_t &scheduler)
+{
     pgsql_endCopy(table);
-    time(&start);
+
+    index_scheduler_t::job_t job(table->name, pgsql_table_size(table->sql_conn, table->name));
+
     if (out_options->droptemp)
     {
-        pgsql_exec(sql_conn, PGRES_COMMAND_OK, "DROP TABLE %s", table->name);
+        job.add_step(std::string("Dropping ") + table->name, [table]() {
+            pgsql_exec(table->sql_conn, PGRES_COMMAND_OK, "DROP TABLE %s", table->name);
+        });
     }
     else if (build_indexes && table->array_indexes)
     {
-        fprintf(stderr, "Building index on table: %s\n", table->name);
-        pgsql_exec(sql_conn, PGRES_COMMAND_OK, "%s", table->array_indexes);
+        job.add_step(std::string("Building index on ") + table->name, [table]() {
+            pgsql_exec(table->sql_conn, PGRES_COMMAND_OK, "%s", table->array_indexes);
+        });
     }
 
-    PQfinish(sql_conn);
-    table->sql_conn = nullptr;
-    time(&end);
-    fprintf(stderr, "Stopped table: %s in %is\n", table->name, (int)(end - start));
+    job.add_step(std::string("Stopping ") + table->name, [table]() {
+        PQfinish(table->sql_conn);
+        table->sql_conn = nullptr;
+    });
+
+    scheduler.add(std::move(job));
 }
 
 
 void middle_pgsql_t::stop(void)
 {
-    cache.reset();
-    if (out_options->flat_node_cache_enabled) persistent_cache.reset();
-
-    std::vector<std::future<void>> futures;
-    futures.reserve(num_tables);
+    index_scheduler_t scheduler(num_tables);
+    schedule_stop(scheduler);
+    scheduler.run();
+}
 
-    for (int i = 0; i < num_tables; ++i) {
-        futures.push_back(std::async(&middle_pgsql_t::pgsql_stop_one, this, &tables[i]));
+void middle_pgsql_t::schedule_stop(index_scheduler_t &scheduler)
+{
+    cache.reset();
+    if (out_options->flat_node_cache_enabled) {
+        persistent_cache.reset();
+        shared_persistent_cache.reset();
     }
 
-    for (auto &f : futures) {
-        f.get();
+    for (int i = 0; i < num_tables; ++i) {
+        pgsql_stop_one(&tables[i], scheduler);
     }
 }
 
 middle_pgsql_t::middle_pgsql_t()
     : tables(), num_tables(0), node_table(nullptr), way_table(nullptr), rel_table(nullptr),
+      way_node_table(nullptr),
       append(false), mark_pending(true), cache(), persistent_cache(), build_indexes(true)
 {
     /*table = t_node,*/
@@ -1163,15 +1423,17 @@ middle_pgsql_t::middle_pgsql_t()
          /*prepare*/ "PREPARE insert_way (" POSTGRES_OSMID_TYPE ", " POSTGRES_OSMID_TYPE "[], text[]) AS INSERT INTO %p_ways VALUES ($1,$2,$3);\n"
                "PREPARE get_way (" POSTGRES_OSMID_TYPE ") AS SELECT nodes, tags, array_upper(nodes,1) FROM %p_ways WHERE id = $1;\n"
                "PREPARE get_way_list (" POSTGRES_OSMID_TYPE "[]) AS SELECT id, nodes, tags, array_upper(nodes,1) FROM %p_ways WHERE id = ANY($1::" POSTGRES_OSMID_TYPE "[]);\n"
-               "PREPARE delete_way(" POSTGRES_OSMID_TYPE ") AS DELETE FROM %p_ways WHERE id = $1;\n",
+               "PREPARE delete_way(" POSTGRES_OSMID_TYPE ") AS DELETE FROM %p_ways WHERE id = $1;\n"
+               "PREPARE delete_way_get_nodes(" POSTGRES_OSMID_TYPE ") AS DELETE FROM %p_ways WHERE id = $1 RETURNING nodes;\n",
 /*prepare_intarray*/
-               "PREPARE mark_ways_by_node(" POSTGRES_OSMID_TYPE ") AS select id from %p_ways WHERE nodes && ARRAY[$1];\n"
+               "PREPARE mark_ways_by_nodes(" POSTGRES_OSMID_TYPE "[]) AS select id from %p_ways WHERE nodes && $1;\n"
                "PREPARE mark_ways_by_rel(" POSTGRES_OSMID_TYPE ") AS select id from %p_ways WHERE id IN (SELECT unnest(parts[way_off+1:rel_off]) FROM %p_rels WHERE id = $1);\n",
 
-            /*copy*/ "COPY %p_ways FROM STDIN;\n",
+            /*copy*/ "COPY %p_ways FROM STDIN (FORMAT binary);\n",
          /*analyze*/ "ANALYZE %p_ways;\n",
             /*stop*/  "COMMIT;\n",
-   /*array_indexes*/ "CREATE INDEX %p_ways_nodes ON %p_ways USING gin (nodes) WITH (FASTUPDATE=OFF) {TABLESPACE %i};\n"
+   /*array_indexes*/ "CREATE INDEX %p_ways_nodes ON %p_ways USING gin (nodes) WITH (FASTUPDATE=OFF) {TABLESPACE %i};\n",
+     /*copy_binary*/ true
                          ));
     tables.push_back(table_desc(
         /*table = t_rel,*/
@@ -1184,23 +1446,43 @@ middle_pgsql_t::middle_pgsql_t()
                "PREPARE delete_rel(" POSTGRES_OSMID_TYPE ") AS DELETE FROM %p_rels WHERE id = $1;\n",
 /*prepare_intarray*/
                 "PREPARE rels_using_way(" POSTGRES_OSMID_TYPE ") AS SELECT id FROM %p_rels WHERE parts && ARRAY[$1] AND parts[way_off+1:rel_off] && ARRAY[$1];\n"
-                "PREPARE mark_rels_by_node(" POSTGRES_OSMID_TYPE ") AS select id from %p_ways WHERE nodes && ARRAY[$1];\n"
-                "PREPARE mark_rels_by_way(" POSTGRES_OSMID_TYPE ") AS select id from %p_rels WHERE parts && ARRAY[$1] AND parts[way_off+1:rel_off] && ARRAY[$1];\n"
-                "PREPARE mark_rels(" POSTGRES_OSMID_TYPE ") AS select id from %p_rels WHERE parts && ARRAY[$1] AND parts[rel_off+1:array_length(parts,1)] && ARRAY[$1];\n",
+                "PREPARE mark_rels_by_nodes(" POSTGRES_OSMID_TYPE "[]) AS select id from %p_rels WHERE parts && $1 AND parts[1:way_off] && $1;\n"
+                "PREPARE mark_rels_by_ways(" POSTGRES_OSMID_TYPE "[]) AS select id from %p_rels WHERE parts && $1 AND parts[way_off+1:rel_off] && $1;\n"
+                "PREPARE mark_rels_by_rels(" POSTGRES_OSMID_TYPE "[]) AS select id from %p_rels WHERE parts && $1 AND parts[rel_off+1:array_length(parts,1)] && $1;\n",
 
-            /*copy*/ "COPY %p_rels FROM STDIN;\n",
+            /*copy*/ "COPY %p_rels FROM STDIN (FORMAT binary);\n",
          /*analyze*/ "ANALYZE %p_rels;\n",
             /*stop*/  "COMMIT;\n",
-   /*array_indexes*/ "CREATE INDEX %p_rels_parts ON %p_rels USING gin (parts) WITH (FASTUPDATE=OFF) {TABLESPACE %i};\n"
+   /*array_indexes*/ "CREATE INDEX %p_rels_parts ON %p_rels USING gin (parts) WITH (FASTUPDATE=OFF) {TABLESPACE %i};\n",
+     /*copy_binary*/ true
+                         ));
+
+    tables.push_back(table_desc(
+        /*table = t_way_node,*/
+            /*name*/ "%p_way_nodes",
+           /*start*/ "BEGIN;\n",
+          /*create*/ "CREATE %m TABLE %p_way_nodes (node_id " POSTGRES_OSMID_TYPE " not null, way_id " POSTGRES_OSMID_TYPE " not null) {TABLESPACE %t};\n",
+    /*create_index*/ nullptr,
+         /*prepare*/ "PREPARE insert_way_nodes(" POSTGRES_OSMID_TYPE ", " POSTGRES_OSMID_TYPE "[]) AS INSERT INTO %p_way_nodes SELECT unnest($2::" POSTGRES_OSMID_TYPE "[]), $1;\n"
+               "PREPARE delete_way_nodes(" POSTGRES_OSMID_TYPE ", " POSTGRES_OSMID_TYPE "[]) AS DELETE FROM %p_way_nodes WHERE node_id = ANY($2) AND way_id = $1;\n",
+/*prepare_intarray*/
+               "PREPARE mark_ways_by_nodes(" POSTGRES_OSMID_TYPE "[]) AS select distinct way_id from %p_way_nodes WHERE node_id = ANY($1);\n",
+            /*copy*/ "COPY %p_way_nodes FROM STDIN (FORMAT binary);\n",
+         /*analyze*/ "ANALYZE %p_way_nodes;\n",
+            /*stop*/  "COMMIT;\n",
+   /*array_indexes*/ "CREATE INDEX %p_way_nodes_node ON %p_way_nodes (node_id) {TABLESPACE %i};\n",
+     /*copy_binary*/ true
                          ));
 
     // set up the rest of the variables from the tables.
     num_tables = tables.size();
-    assert(num_tables == 3);
+    assert(num_tables == 4);
 
     node_table = &tables[0];
     way_table = &tables[1];
     rel_table = &tables[2];
+    // only kept by start() if the option for it is set
+    way_node_table = &tables[3];
 }
 
 middle_pgsql_t::~middle_pgsql_t() {
@@ -1221,13 +1503,22 @@ std::shared_ptr<const middle_query_t> middle_pgsql_t::get_instance() const {
     //NOTE: this is thread safe for use in pending async processing only because
     //during that process they are only read from
     mid->cache = cache;
-    // The persistent cache on the other hand is not thread-safe for reading,
-    // so we create one per instance.
-    if (out_options->flat_node_cache_enabled)
-        mid->persistent_cache.reset(new node_persistent_cache(out_options, 1, true, cache));
+    // A read-only persistent cache can be used from several threads, so
+    // all instances share one and with it its block cache or mapping.
+    if (out_options->flat_node_cache_enabled) {
+        std::lock_guard<std::mutex> lock(shared_persistent_cache_mutex);
+        if (!shared_persistent_cache) {
+            shared_persistent_cache.reset(new node_persistent_cache(out_options, 1, true, cache));
+        }
+        mid->persistent_cache = shared_persistent_cache;
+    }
 
     // We use a connection per table to enable the use of COPY */
+    // The way node table is only needed for writing.
     for(int i=0; i<num_tables; i++) {
+        if (&tables[i] == way_node_table) {
+            continue;
+        }
         mid->connect(mid->tables[i]);
         PGconn* sql_conn = mid->tables[i].sql_conn;
 
@@ -14,6 +14,7 @@
 #include "node-persistent-cache.hpp"
 #include "id-tracker.hpp"
 #include <memory>
+#include <mutex>
 #include <vector>
 
 struct middle_pgsql_t : public slim_middle_t {
@@ -22,9 +23,12 @@ struct middle_pgsql_t : public slim_middle_t {
 
     void start(const options_t *out_options_);
     void stop(void);
+    void schedule_stop(index_scheduler_t &scheduler);
     void analyze(void);
     void end(void);
     void commit(void);
+    void flush_nodes();
+    void changes_done();
 
     void nodes_set(osmid_t id, double lat, double lon, const taglist_t &tags);
     size_t nodes_get_list(nodelist_t &out, const idlist_t nds) const;
@@ -61,7 +65,8 @@ struct middle_pgsql_t : public slim_middle_t {
                    const char *copy_ = NULL,
                    const char *analyze_ = NULL,
                    const char *stop_ = NULL,
-                   const char *array_indexes_ = NULL);
+                   const char *array_indexes_ = NULL,
+                   bool copy_binary_ = false);
 
         const char *name;
         const char *start;
@@ -73,6 +78,7 @@ struct middle_pgsql_t : public slim_middle_t {
         const char *analyze;
         const char *stop;
         const char *array_indexes;
+        bool copy_binary; /* True if copy uses the binary format */
 
         int copyMode;    /* True if we are in copy mode */
         int transactionMode;    /* True if we are in an extended transaction */
@@ -81,7 +87,7 @@ struct middle_pgsql_t : public slim_middle_t {
 
     virtual std::shared_ptr<const middle_query_t> get_instance() const;
 private:
-    void pgsql_stop_one(table_desc *table);
+    void pgsql_stop_one(table_desc *table, index_scheduler_t &scheduler);
 
     /**
      * Sets up sql_conn for the table
@@ -90,23 +96,43 @@ private:
     void local_nodes_set(osmid_t id, double lat, double lon, const taglist_t &tags);
     size_t local_nodes_get_list(nodelist_t &out, const idlist_t nds) const;
     void local_nodes_delete(osmid_t osm_id);
+    void way_nodes_set(osmid_t way_id, const idlist_t &nds);
+
+    /**
+     * Marks the ways and relations which use the objects collected by
+     * the *_changed() functions as pending. The lookups are done with
+     * one query per type for a whole batch of ids.
+     */
+    void resolve_changes();
+    void mark_pending_by(table_desc *table, const char *stmt,
+                         idlist_t const &ids, id_tracker *tracker);
 
     std::vector<table_desc> tables;
     int num_tables;
     table_desc *node_table, *way_table, *rel_table;
+    /// node to way index replacing the GIN index on the ways, if enabled
+    table_desc *way_node_table;
 
     bool append;
     bool mark_pending;
 
     std::shared_ptr<node_ram_cache> cache;
     std::shared_ptr<node_persistent_cache> persistent_cache;
+    // read-only cache shared by all instances from get_instance()
+    mutable std::shared_ptr<node_persistent_cache> shared_persistent_cache;
+    mutable std::mutex shared_persistent_cache_mutex;
 
     std::shared_ptr<id_tracker> ways_pending_tracker, rels_pending_tracker;
+    idlist_t changed_nodes, changed_ways, changed_rels;
 
     void buffer_store_nodes(idlist_t const &nodes);
     void buffer_store_string(std::string const &in, bool escape);
     void buffer_store_tags(taglist_t const &tags, bool escape);
 
+    /* fields of a binary copy row */
+    void buffer_store_binary_nodes(idlist_t const &nodes);
+    void buffer_store_binary_tags(taglist_t const &tags);
+
     void buffer_correct_params(char const **param, size_t size);
 
     bool build_indexes;
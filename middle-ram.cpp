@@ -10,6 +10,7 @@
 #include <stdexcept>
 
 #include <cassert>
+#include <cmath>
 #include <cstdio>
 
 #include "id-tracker.hpp"
@@ -29,29 +30,92 @@
  * hard code maximum IDs. We now support an ID  range of -2^31 to +2^31.
  * The negative IDs often occur in non-uploaded JOSM data or other data import scripts.
  *
+ * The arrays only hold the position of the way or relation in the arena,
+ * where it is stored in a compact encoding and only decoded when asked for.
  */
 
 
 void middle_ram_t::nodes_set(osmid_t id, double lat, double lon, const taglist_t &tags) {
+    // the ways bring their own node locations
+    if (out_options->locations_on_ways) {
+        return;
+    }
+
     cache->set(id, lat, lon, tags);
 }
 
+void middle_ram_t::encode_tags(const taglist_t &tags)
+{
+    varint::write(buffer, tags.size());
+    for (const auto &tag : tags) {
+        varint::write(buffer, strings.add(tag.key));
+        varint::write(buffer, strings.add(tag.value));
+    }
+}
+
+void middle_ram_t::decode_tags(const char *&data, taglist_t &tags) const
+{
+    const size_t count = varint::read(data);
+    tags.clear();
+    tags.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        const uint32_t key = uint32_t(varint::read(data));
+        const uint32_t value = uint32_t(varint::read(data));
+        tags.push_back(tag_t(strings.get(key), strings.get(value)));
+    }
+}
+
+/* A way is stored as its tags followed by the number of nodes and the
+ * differences between consecutive node ids. The differences wrap around,
+ * because with --locations-on-ways the ids are packed locations which can
+ * be far apart. */
 void middle_ram_t::ways_set(osmid_t id, const idlist_t &nds, const taglist_t &tags)
 {
-    ways.set(id, new ramWay(tags, nds));
+    buffer.clear();
+    encode_tags(tags);
+
+    varint::write(buffer, nds.size());
+    osmid_t last = 0;
+    for (osmid_t nd : nds) {
+        varint::write_signed(buffer, int64_t(uint64_t(nd) - uint64_t(last)));
+        last = nd;
+    }
+
+    ways.set(id, arena.add(buffer));
 }
 
+/* A relation is stored as its tags followed by the number of members and
+ * the type, the difference to the previous member id and the role of each
+ * member. */
 void middle_ram_t::relations_set(osmid_t id, const memberlist_t &members, const taglist_t &tags)
 {
-    rels.set(id, new ramRel(tags, members));
+    buffer.clear();
+    encode_tags(tags);
+
+    varint::write(buffer, members.size());
+    osmid_t last = 0;
+    for (const auto &m : members) {
+        varint::write(buffer, m.type);
+        varint::write_signed(buffer, m.id - last);
+        varint::write(buffer, strings.add(m.role));
+        last = m.id;
+    }
+
+    rels.set(id, arena.add(buffer));
 }
 
 size_t middle_ram_t::nodes_get_list(nodelist_t &out, const idlist_t nds) const
 {
-    for (idlist_t::const_iterator it = nds.begin(); it != nds.end(); ++it) {
-        osmNode n;
-        if (!cache->get(&n, *it))
+    if (out_options->locations_on_ways) {
+        return unpack_locations(out, nds);
+    }
+
+    nodelist_t found;
+    cache->get_list(found, nds);
+    for (const auto &n : found) {
+        if (!std::isnan(n.lat)) {
             out.push_back(n);
+        }
     }
 
     return int(out.size());
@@ -94,20 +158,35 @@ void middle_ram_t::release_ways()
     ways.clear();
 }
 
+void middle_ram_t::release_arena()
+{
+    arena.clear();
+    strings.clear();
+    std::string().swap(buffer);
+}
+
 bool middle_ram_t::ways_get(osmid_t id, taglist_t &tags, nodelist_t &nodes) const
 {
     if (simulate_ways_deleted) {
         return false;
     }
 
-    auto const *ele = ways.get(id);
+    auto const ref = ways.get(id);
 
-    if (!ele) {
+    if (!ref.valid()) {
         return false;
     }
 
-    tags = ele->tags;
-    nodes_get_list(nodes, ele->ndids);
+    const char *data = arena.get(ref);
+    decode_tags(data, tags);
+
+    idlist_t ndids(varint::read(data));
+    osmid_t last = 0;
+    for (auto &nd : ndids) {
+        nd = osmid_t(uint64_t(last) + uint64_t(varint::read_signed(data)));
+        last = nd;
+    }
+    nodes_get_list(nodes, ndids);
 
     return true;
 }
@@ -145,14 +224,24 @@ size_t middle_ram_t::ways_get_list(const idlist_t &ids, idlist_t &way_ids,
 
 bool middle_ram_t::relations_get(osmid_t id, memberlist_t &members, taglist_t &tags) const
 {
-    auto const *ele = rels.get(id);
+    auto const ref = rels.get(id);
 
-    if (!ele) {
+    if (!ref.valid()) {
         return false;
     }
 
-    tags = ele->tags;
-    members = ele->members;
+    const char *data = arena.get(ref);
+    decode_tags(data, tags);
+
+    const size_t count = varint::read(data);
+    members.clear();
+    members.reserve(count);
+    osmid_t last = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const OsmType type = OsmType(varint::read(data));
+        last += varint::read_signed(data);
+        members.push_back(member(type, last, strings.get(uint32_t(varint::read(data)))));
+    }
 
     return true;
 }
@@ -173,7 +262,9 @@ void middle_ram_t::start(const options_t *out_options_)
     /* latlong has a range of +-180, mercator +-20000
        The fixed poing scaling needs adjusting accordingly to
        be stored accurately in an int */
-    cache.reset(new node_ram_cache(out_options->alloc_chunkwise, out_options->cache, out_options->scale));
+    cache.reset(new node_ram_cache(out_options->alloc_chunkwise,
+                                   out_options->locations_on_ways ? 0 : out_options->cache,
+                                   out_options->scale));
 
     fprintf( stderr, "Mid: Ram, scale=%d\n", out_options->scale );
 }
@@ -182,15 +273,20 @@ void middle_ram_t::stop(void)
 {
     cache.reset(nullptr);
 
+    fprintf(stderr, "Mid: Ram, ways and relations used %zuMB, %zu distinct strings\n",
+            (arena.allocated() + strings.allocated()) >> 20, strings.size());
+
     release_ways();
     release_relations();
+    release_arena();
 }
 
 void middle_ram_t::commit(void) {
 }
 
 middle_ram_t::middle_ram_t():
-    ways(), rels(), cache(), simulate_ways_deleted(false)
+    arena(), strings(), buffer(), ways(), rels(), cache(),
+    simulate_ways_deleted(false)
 {
 }
 
@@ -12,6 +12,7 @@
 #include <memory>
 
 #include "middle.hpp"
+#include "ram-arena.hpp"
 #include <vector>
 #include <array>
 
@@ -21,11 +22,11 @@ struct options_t;
 template <typename T, size_t N>
 class cache_block_t
 {
-    std::array<std::unique_ptr<T>, N> arr;
+    std::array<T, N> arr;
 public:
-    void set(size_t idx, T *ele) { arr[idx].reset(ele); }
+    void set(size_t idx, T const &ele) { arr[idx] = ele; }
 
-    T const *get(size_t idx) const { return arr[idx].get(); }
+    T const &get(size_t idx) const { return arr[idx]; }
 };
 
 template <typename T, size_t BLOCK_SHIFT>
@@ -50,7 +51,7 @@ class elem_cache_t
 public:
     elem_cache_t() : arr(num_blocks()) {}
 
-    void set(osmid_t id, T *ele)
+    void set(osmid_t id, T const &ele)
     {
         const size_t block = id2block(id);
 
@@ -61,12 +62,12 @@ public:
         arr[block]->set(id2offset(id), ele);
     }
 
-    T const *get(osmid_t id) const
+    T get(osmid_t id) const
     {
         const size_t block = id2block(id);
 
         if (!arr[block]) {
-            return 0;
+            return T();
         }
 
         return arr[block]->get(id2offset(id));
@@ -75,7 +76,7 @@ public:
     void clear()
     {
         for (auto &ele : arr) {
-            ele.release();
+            ele.reset();
         }
     }
 };
@@ -120,23 +121,20 @@ private:
 
     void release_ways();
     void release_relations();
+    void release_arena();
 
-    struct ramWay {
-        taglist_t tags;
-        idlist_t ndids;
+    void encode_tags(const taglist_t &tags);
+    void decode_tags(const char *&data, taglist_t &tags) const;
 
-        ramWay(const taglist_t &t, const idlist_t &n) : tags(t), ndids(n) {}
-    };
+    /* Ways and relations are varint encoded into the arena, see
+     * ways_set() and relations_set() for the layout. Tag keys, tag values
+     * and member roles are stored once in the string table. */
+    ram_arena_t arena;
+    string_table_t strings;
+    std::string buffer;
 
-    struct ramRel {
-        taglist_t tags;
-        memberlist_t members;
-
-        ramRel(const taglist_t &t, const memberlist_t &m) : tags(t), members(m) {}
-    };
-
-    elem_cache_t<ramWay, 10> ways;
-    elem_cache_t<ramRel, 10> rels;
+    elem_cache_t<ram_arena_t::ref_t, 10> ways;
+    elem_cache_t<ram_arena_t::ref_t, 10> rels;
 
     std::unique_ptr<node_ram_cache> cache;
 
@@ -1,6 +1,7 @@
 #include "middle.hpp"
 #include "middle-pgsql.hpp"
 #include "middle-ram.hpp"
+#include "index-scheduler.hpp"
 
 #include <memory>
 
@@ -12,3 +13,10 @@ std::shared_ptr<middle_t> middle_t::create_middle(const bool slim)
          return std::make_shared<middle_ram_t>();
 }
 
+void middle_t::schedule_stop(index_scheduler_t &scheduler)
+{
+    index_scheduler_t::job_t job("middle", 0);
+    job.add_step("Stopping middle", [this]() { stop(); });
+    scheduler.add(std::move(job));
+}
+
@@ -13,6 +13,7 @@
 #include <memory>
 
 struct options_t;
+class index_scheduler_t;
 
 /**
  * object which stores OSM node/ways/relations from the input file
@@ -59,10 +60,29 @@ struct middle_t : public middle_query_t {
 
     virtual void start(const options_t *out_options_) = 0;
     virtual void stop(void) = 0;
+    /**
+     * Queue the work of stop() in the scheduler, so that it can run in
+     * parallel with the outputs. By default stop() is queued as a whole.
+     */
+    virtual void schedule_stop(index_scheduler_t &scheduler);
     virtual void analyze(void) = 0;
     virtual void end(void) = 0;
     virtual void commit(void) = 0;
 
+    /**
+     * Make all nodes stored so far visible to instances created with
+     * get_instance() while the middle keeps accepting ways and relations.
+     * Used when the input is processed by more than one thread.
+     */
+    virtual void flush_nodes() {}
+
+    /**
+     * Get ready for the next change file after commit() and the processing
+     * of the pending objects, keeping the connections and caches. Used when
+     * several change files are applied in one run (see --watch-dir).
+     */
+    virtual void changes_done() {}
+
     virtual void nodes_set(osmid_t id, double lat, double lon, const taglist_t &tags) = 0;
     virtual void ways_set(osmid_t id, const idlist_t &nds, const taglist_t &tags) = 0;
     virtual void relations_set(osmid_t id, const memberlist_t &members, const taglist_t &tags) = 0;
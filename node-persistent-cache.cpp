@@ -3,6 +3,7 @@
 #include "config.h"
 
 #include <algorithm>
+#include <cstring>
 #include <stdexcept>
 
 #include <cerrno>
@@ -17,6 +18,10 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#ifdef HAVE_MMAP
+ #include <sys/mman.h>
+#endif
+
 #include "node-persistent-cache.hpp"
 #include "options.hpp"
 #include "osmtypes.hpp"
@@ -35,10 +40,12 @@
 #else
  #ifdef __APPLE__
  #define lseek64 lseek
+ #define pread64 pread
  #else
   #ifndef HAVE_LSEEK64
    #if SIZEOF_OFF_T == 8
     #define lseek64 lseek
+    #define pread64 pread
    #else
     #error Flat nodes cache requires a 64 bit capable seek
    #endif
@@ -188,9 +195,13 @@ void node_persistent_cache::nodes_prefetch_async(osmid_t id)
 #ifdef HAVE_POSIX_FADVISE
     osmid_t block_offset = id >> READ_NODE_BLOCK_SHIFT;
 
-    const int block_id = find_block(block_offset);
+    // for the shared cache this is only a hint, so the slot is not locked
+    const bool cached = read_only
+        ? shared_slots[block_offset % shared_slot_count].block_offset.load(
+              std::memory_order_relaxed) == block_offset
+        : find_block(block_offset) >= 0;
 
-    if (block_id < 0) {
+    if (!cached) {
         // The needed block isn't in cache already, so initiate loading
         if (cacheHeader.max_initialised_id < id) {
             fprintf(stderr, "Warning: reading node outside node cache. (%lu vs. %lu)\n",
@@ -386,7 +397,13 @@ void node_persistent_cache::set_append(osmid_t id, double lat, double lon)
 
 void node_persistent_cache::set(osmid_t id, double lat, double lon)
 {
-    if (append_mode) {
+    if (mmap_base) {
+        if (std::isnan(lat) && std::isnan(lon)) {
+            mmap_set(id, ramNode());
+        } else {
+            mmap_set(id, ramNode(lon, lat));
+        }
+    } else if (append_mode) {
         set_append(id, lat, lon);
     } else {
         set_create(id, lat, lon);
@@ -395,6 +412,13 @@ void node_persistent_cache::set(osmid_t id, double lat, double lon)
 
 int node_persistent_cache::get(osmNode *out, osmid_t id)
 {
+    if (mmap_base) {
+        return mmap_get(out, id);
+    }
+    if (read_only) {
+        return shared_get(out, id);
+    }
+
     set_read_mode();
 
     osmid_t block_offset = id >> READ_NODE_BLOCK_SHIFT;
@@ -421,15 +445,17 @@ size_t node_persistent_cache::get_list(nodelist_t &out, const idlist_t nds)
 {
     set_read_mode();
 
-    out.assign(nds.size(), osmNode());
+    /* Check cache first */
+    ram_cache->get_list(out, nds);
 
     bool need_fetch = false;
     for (size_t i = 0; i < nds.size(); ++i) {
-        /* Check cache first */
-        if (ram_cache->get(&out[i], nds[i]) != 0) {
+        if (std::isnan(out[i].lat)) {
             /* In order to have a higher OS level I/O queue depth
                issue posix_fadvise(WILLNEED) requests for all I/O */
-            nodes_prefetch_async(nds[i]);
+            if (!mmap_base) {
+                nodes_prefetch_async(nds[i]);
+            }
             need_fetch = true;
         }
     }
@@ -458,6 +484,17 @@ void node_persistent_cache::set_read_mode()
     if (read_mode)
         return;
 
+#ifdef HAVE_MMAP
+    if (mmap_base) {
+        *mapped_header() = cacheHeader;
+        if (madvise(mmap_base, mmap_size, MADV_RANDOM) != 0) {
+            fprintf(stderr, "Info: madvise on node cache failed. This might reduce performance\n");
+        }
+        read_mode = true;
+        return;
+    }
+#endif
+
     if (writeNodeBlock.dirty()) {
         assert(!append_mode);
         nodes_set_create_writeout_block();
@@ -483,10 +520,316 @@ void node_persistent_cache::set_read_mode()
     read_mode = true;
 }
 
+void node_persistent_cache::flush()
+{
+    assert(append_mode && !read_only);
+
+#ifdef HAVE_MMAP
+    if (mmap_base) {
+        *mapped_header() = cacheHeader;
+        return;
+    }
+#endif
+
+    writeout_dirty_nodes();
+
+    if (lseek64(node_cache_fd, 0, SEEK_SET) < 0) {
+        fprintf(stderr, "Failed to seek to correct position in node cache: %s\n",
+                strerror(errno));
+        util::exit_nicely();
+    };
+    if (write(node_cache_fd, &cacheHeader, sizeof(persistentCacheHeader))
+            != sizeof(persistentCacheHeader)) {
+        fprintf(stderr, "Failed to update persistent cache header: %s\n",
+                strerror(errno));
+        util::exit_nicely();
+    }
+
+    // nodes may be changed again after lookups
+    read_mode = false;
+}
+
+/**
+ * Look up a node in the cache shared by all threads. Used for read-only
+ * instances only, which never change the file.
+ */
+int node_persistent_cache::shared_get(osmNode *out, osmid_t id)
+{
+    if (id < 0 || id > cacheHeader.max_initialised_id) {
+        return 1;
+    }
+
+    const osmid_t block_offset = id >> READ_NODE_BLOCK_SHIFT;
+    const size_t slot_id = block_offset % shared_slot_count;
+    shared_slot &slot = shared_slots[slot_id];
+    std::atomic<uint64_t> const *words = &shared_blocks[
+        (slot_id * READ_NODE_BLOCK_SIZE + (id & READ_NODE_BLOCK_MASK)) * node_words];
+
+    ramNode node;
+    bool found = false;
+
+    const uint64_t version = slot.version.load(std::memory_order_acquire);
+    if (!(version & 1) &&
+        slot.block_offset.load(std::memory_order_relaxed) == block_offset) {
+        uint64_t buf[node_words];
+        for (size_t i = 0; i < node_words; ++i) {
+            buf[i] = words[i].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        // if a writer got in between, the copy may be torn
+        if (slot.version.load(std::memory_order_relaxed) == version) {
+            memcpy(&node, buf, sizeof(ramNode));
+            found = true;
+        }
+    }
+
+    if (!found) {
+        ramNode block[READ_NODE_BLOCK_SIZE];
+        shared_load_block(block_offset, slot_id, block);
+        node = block[id & READ_NODE_BLOCK_MASK];
+    }
+
+    if (!node.is_valid())
+        return 1;
+
+    out->lat = node.lat();
+    out->lon = node.lon();
+
+    return 0;
+}
+
+/**
+ * Read a block from the file and put it into its slot of the shared cache,
+ * unless another thread is just filling that slot.
+ */
+void node_persistent_cache::shared_load_block(osmid_t block_offset, size_t slot_id,
+                                              ramNode *block)
+{
+    const size_t block_size = READ_NODE_BLOCK_SIZE * sizeof(ramNode);
+    const osmid_t pos = (block_offset << READ_NODE_BLOCK_SHIFT) * sizeof(ramNode)
+                            + sizeof(persistentCacheHeader);
+#ifdef _WIN32
+    std::lock_guard<std::mutex> lock(shared_read_mutex);
+    if (lseek64(node_cache_fd, pos, SEEK_SET) < 0) {
+        fprintf(stderr, "Failed to seek to correct position in node cache: %s\n",
+                strerror(errno));
+        util::exit_nicely();
+    }
+    if (read(node_cache_fd, block, block_size) != ssize_t(block_size))
+#else
+    if (pread64(node_cache_fd, block, block_size, pos) != ssize_t(block_size))
+#endif
+    {
+        fprintf(stderr, "Failed to read from node cache: %s\n",
+                strerror(errno));
+        util::exit_nicely();
+    }
+
+    shared_slot &slot = shared_slots[slot_id];
+    uint64_t version = slot.version.load(std::memory_order_relaxed);
+    if ((version & 1) ||
+        !slot.version.compare_exchange_strong(version, version + 1,
+                                              std::memory_order_acquire)) {
+        return;
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot.block_offset.store(block_offset, std::memory_order_relaxed);
+    std::atomic<uint64_t> *words = &shared_blocks[slot_id * READ_NODE_BLOCK_SIZE * node_words];
+    for (size_t i = 0; i < READ_NODE_BLOCK_SIZE * node_words; ++i) {
+        uint64_t word;
+        memcpy(&word, reinterpret_cast<char const *>(block) + i * sizeof(uint64_t),
+               sizeof(uint64_t));
+        words[i].store(word, std::memory_order_relaxed);
+    }
+
+    slot.version.store(version + 2, std::memory_order_release);
+}
+
+#ifdef HAVE_MMAP
+void node_persistent_cache::map_file()
+{
+    struct stat st;
+    if (fstat(node_cache_fd, &st) != 0) {
+        fprintf(stderr, "Failed to get size of node cache file: %s\n",
+                strerror(errno));
+        util::exit_nicely();
+    }
+    file_size = st.st_size;
+
+    /* Reserve address space for all node ids to come, so that the mapping
+     * never moves and can be shared between threads. The file is grown
+     * before any page behind its end is touched. */
+    mmap_size = std::max(file_size, sizeof(void *) >= 8 ? (size_t(1) << 40)
+                                                        : (size_t(1) << 30));
+
+    int flags = MAP_SHARED;
+#ifdef MAP_NORESERVE
+    flags |= MAP_NORESERVE;
+#endif
+    void *base = mmap(nullptr, mmap_size,
+                      read_only ? PROT_READ : PROT_READ | PROT_WRITE,
+                      flags, node_cache_fd, 0);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "Failed to map node cache file: %s\n", strerror(errno));
+        util::exit_nicely();
+    }
+    mmap_base = static_cast<char *>(base);
+
+    /* the import writes the file front to back, everything else jumps around */
+    if (madvise(mmap_base, mmap_size,
+                (append_mode || read_mode) ? MADV_RANDOM : MADV_SEQUENTIAL) != 0) {
+        fprintf(stderr, "Info: madvise on node cache failed. This might reduce performance\n");
+    }
+}
+
+void node_persistent_cache::unmap_file()
+{
+    if (!read_only) {
+        *mapped_header() = cacheHeader;
+        if (msync(mmap_base, file_size, MS_SYNC) != 0) {
+            fprintf(stderr, "Failed to write out node cache: %s\n",
+                    strerror(errno));
+            util::exit_nicely();
+        }
+        fprintf(stderr,"Maximum node in persistent node cache: %" PRIdOSMID "\n", cacheHeader.max_initialised_id);
+    }
+
+    if (munmap(mmap_base, mmap_size) != 0) {
+        fprintf(stderr, "Failed to unmap node cache file: %s\n", strerror(errno));
+    }
+    mmap_base = nullptr;
+}
+
+/**
+ * Make sure the node cache is initialised up to the block containing id.
+ * This is the memory mapped equivalent of expand_cache().
+ */
+void node_persistent_cache::mmap_expand(osmid_t id)
+{
+    const osmid_t new_max = ((id >> READ_NODE_BLOCK_SHIFT) + 1)
+                                << READ_NODE_BLOCK_SHIFT;
+    const size_t needed = sizeof(persistentCacheHeader) + new_max * sizeof(ramNode);
+
+    if (needed > file_size) {
+        const size_t new_size = std::max(needed,
+                file_size + MMAP_NODE_GROW_SIZE * sizeof(ramNode));
+        if (new_size > mmap_size) {
+            fprintf(stderr, "Node id %" PRIdOSMID " is too large for the memory mapped node cache\n",
+                    id);
+            util::exit_nicely();
+        }
+        if (ftruncate(node_cache_fd, new_size) != 0) {
+            fprintf(stderr, "Failed to expand persistent node cache: %s\n",
+                    strerror(errno));
+            util::exit_nicely();
+        }
+        file_size = new_size;
+    }
+
+    const osmid_t first = cacheHeader.max_initialised_id > 0
+                              ? cacheHeader.max_initialised_id + 1 : 0;
+    std::fill(mapped_nodes() + first, mapped_nodes() + new_max, ramNode());
+
+    cacheHeader.max_initialised_id = new_max - 1;
+    *mapped_header() = cacheHeader;
+}
+
+/**
+ * Start writing out the block of the import which was just finished. See
+ * nodes_set_create_writeout_block() for why this is done. Blocks which are
+ * written out are dropped from the mapping as they are not read again
+ * during import.
+ */
+void node_persistent_cache::mmap_writeout_block(int32_t block_offset)
+{
+#ifdef HAVE_SYNC_FILE_RANGE
+    const size_t block_size = WRITE_NODE_BLOCK_SIZE * sizeof(ramNode);
+    const size_t offset = (size_t) block_offset * block_size
+                              + sizeof(persistentCacheHeader);
+
+    if (sync_file_range(node_cache_fd, offset, block_size,
+                        SYNC_FILE_RANGE_WRITE) < 0) {
+        fprintf(stderr, "Info: Sync_file_range writeout has an issue. This shouldn't be anything to worry about.: %s\n",
+                strerror(errno));
+    }
+
+    if (block_offset > 16) {
+        const size_t old_offset = offset - 16 * block_size;
+        if (sync_file_range(node_cache_fd, old_offset, block_size,
+                            SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER) < 0) {
+            fprintf(stderr, "Info: Sync_file_range block has an issue. This shouldn't be anything to worry about.: %s\n",
+                    strerror(errno));
+        }
+
+        // madvise() only works on whole pages
+        const size_t page_size = sysconf(_SC_PAGESIZE);
+        const size_t start = (old_offset + page_size - 1) & ~(page_size - 1);
+        const size_t end = (old_offset + block_size) & ~(page_size - 1);
+        if (madvise(mmap_base + start, end - start, MADV_DONTNEED) != 0) {
+            fprintf(stderr, "Info: madvise failed. This shouldn't be anything to worry about.: %s\n",
+                    strerror(errno));
+        }
+    }
+#endif
+}
+
+void node_persistent_cache::mmap_set(osmid_t id, const ramNode &coord)
+{
+    if (id < 0) {
+        fprintf(stderr, "Negative node id %" PRIdOSMID " can not be stored in the node cache\n",
+                id);
+        util::exit_nicely();
+    }
+
+    if (id > cacheHeader.max_initialised_id || cacheHeader.max_initialised_id == 0) {
+        mmap_expand(id);
+    }
+
+    if (!append_mode) {
+        const int32_t block_offset = id >> WRITE_NODE_BLOCK_SHIFT;
+        if (block_offset != mmap_write_block) {
+            mmap_writeout_block(mmap_write_block);
+            mmap_write_block = block_offset;
+        }
+    }
+
+    mapped_nodes()[id] = coord;
+}
+
+int node_persistent_cache::mmap_get(osmNode *out, osmid_t id) const
+{
+    // read from the mapping, as another instance may still be writing
+    const osmid_t max_id = mapped_header()->max_initialised_id;
+    if (id < 0 || id > max_id || max_id == 0) {
+        return 1;
+    }
+
+    ramNode const &node = mapped_nodes()[id];
+    if (!node.is_valid()) {
+        return 1;
+    }
+
+    out->lat = node.lat();
+    out->lon = node.lon();
+
+    return 0;
+}
+#else
+void node_persistent_cache::map_file() {}
+void node_persistent_cache::unmap_file() {}
+void node_persistent_cache::mmap_expand(osmid_t) {}
+void node_persistent_cache::mmap_writeout_block(int32_t) {}
+void node_persistent_cache::mmap_set(osmid_t, const ramNode &) {}
+int node_persistent_cache::mmap_get(osmNode *, osmid_t) const { return 1; }
+#endif
+
 node_persistent_cache::node_persistent_cache(const options_t *options, bool append,
                                              bool ro, std::shared_ptr<node_ram_cache> ptr)
     : node_cache_fd(0), node_cache_fname(nullptr), append_mode(append), cacheHeader(),
-      writeNodeBlock(), readNodeBlockCache(nullptr), read_mode(ro), ram_cache(ptr)
+      writeNodeBlock(), readNodeBlockCache(nullptr), read_mode(ro), read_only(ro),
+      mmap_base(nullptr), mmap_size(0), file_size(0), mmap_write_block(0),
+      shared_slot_count(0), ram_cache(ptr)
 {
     if (options->flat_node_file) {
         node_cache_fname = options->flat_node_file->c_str();
@@ -494,6 +837,12 @@ node_persistent_cache::node_persistent_cache(const options_t *options, bool appe
         throw std::runtime_error("Unable to set up persistent cache: the name "
                                  "of the flat node file was not set.");
     }
+#ifndef HAVE_MMAP
+    if (options->flat_node_mmap) {
+        throw std::runtime_error("Memory mapping the flat node file is not "
+                                 "supported on this platform.");
+    }
+#endif
     fprintf(stderr, "Mid: loading persistent node cache from %s\n",
             node_cache_fname);
 
@@ -556,10 +905,12 @@ node_persistent_cache::node_persistent_cache(const options_t *options, bool appe
             fprintf(stderr, "Allocated space for persistent node cache file\n");
             #endif
 
-            writeNodeBlock.nodes = new ramNode[WRITE_NODE_BLOCK_SIZE];
-            if (!writeNodeBlock.nodes) {
-                fprintf(stderr, "Out of memory: Failed to allocate node writeout buffer\n");
-                util::exit_nicely();
+            if (!options->flat_node_mmap) {
+                writeNodeBlock.nodes = new ramNode[WRITE_NODE_BLOCK_SIZE];
+                if (!writeNodeBlock.nodes) {
+                    fprintf(stderr, "Out of memory: Failed to allocate node writeout buffer\n");
+                    util::exit_nicely();
+                }
             }
             cacheHeader.format_version = PERSISTENT_CACHE_FORMAT_VERSION;
             cacheHeader.id_size = sizeof(osmid_t);
@@ -606,6 +957,27 @@ node_persistent_cache::node_persistent_cache(const options_t *options, bool appe
 
     fprintf(stderr,"Maximum node in persistent node cache: %" PRIdOSMID "\n", cacheHeader.max_initialised_id);
 
+    // the mapping replaces the block cache
+    if (options->flat_node_mmap) {
+        map_file();
+        return;
+    }
+
+    // read-only instances are shared by the threads, so they get a cache
+    // as large as all the per-thread caches together
+    if (read_only) {
+        shared_slot_count = READ_NODE_CACHE_SIZE * std::max(options->num_procs, 1);
+        shared_slots.reset(new shared_slot[shared_slot_count]);
+        for (size_t i = 0; i < shared_slot_count; ++i) {
+            shared_slots[i].version.store(0, std::memory_order_relaxed);
+            shared_slots[i].block_offset.store(-1, std::memory_order_relaxed);
+        }
+        // filled lazily, a slot is never read before its block was stored
+        shared_blocks.reset(new std::atomic<uint64_t>[shared_slot_count
+                                * READ_NODE_BLOCK_SIZE * node_words]);
+        return;
+    }
+
     readNodeBlockCache = new ramNodeBlock[READ_NODE_CACHE_SIZE];
     if (!readNodeBlockCache) {
         fprintf(stderr, "Out of memory: Failed to allocate node read cache\n");
@@ -615,27 +987,31 @@ node_persistent_cache::node_persistent_cache(const options_t *options, bool appe
 
 node_persistent_cache::~node_persistent_cache()
 {
-    if (writeNodeBlock.dirty())
-        nodes_set_create_writeout_block();
+    if (mmap_base) {
+        unmap_file();
+    } else if (!read_only) {
+        if (writeNodeBlock.dirty())
+            nodes_set_create_writeout_block();
 
-    writeout_dirty_nodes();
+        writeout_dirty_nodes();
 
-    if (writeNodeBlock.nodes)
-        delete[] writeNodeBlock.nodes;
+        if (writeNodeBlock.nodes)
+            delete[] writeNodeBlock.nodes;
 
-    if (lseek64(node_cache_fd, 0, SEEK_SET) < 0) {
-        fprintf(stderr, "Failed to seek to correct position in node cache: %s\n",
-                strerror(errno));
-        util::exit_nicely();
-    };
-    if (write(node_cache_fd, &cacheHeader, sizeof(struct persistentCacheHeader))
-            != sizeof(struct persistentCacheHeader))
-    {
-        fprintf(stderr, "Failed to update persistent cache header: %s\n",
-                strerror(errno));
-        util::exit_nicely();
+        if (lseek64(node_cache_fd, 0, SEEK_SET) < 0) {
+            fprintf(stderr, "Failed to seek to correct position in node cache: %s\n",
+                    strerror(errno));
+            util::exit_nicely();
+        };
+        if (write(node_cache_fd, &cacheHeader, sizeof(struct persistentCacheHeader))
+                != sizeof(struct persistentCacheHeader))
+        {
+            fprintf(stderr, "Failed to update persistent cache header: %s\n",
+                    strerror(errno));
+            util::exit_nicely();
+        }
+        fprintf(stderr,"Maximum node in persistent node cache: %" PRIdOSMID "\n", cacheHeader.max_initialised_id);
     }
-    fprintf(stderr,"Maximum node in persistent node cache: %" PRIdOSMID "\n", cacheHeader.max_initialised_id);
 
     fsync(node_cache_fd);
 
@@ -3,7 +3,10 @@
 
 #include "osmtypes.hpp"
 #include "node-ram-cache.hpp"
+#include <atomic>
+#include <cstdint>
 #include <memory>
+#include <mutex>
 
 #include <vector>
 
@@ -20,6 +23,9 @@
 
 #define PERSISTENT_CACHE_FORMAT_VERSION 1
 
+/* the file is grown in steps of this many nodes when memory mapped */
+#define MMAP_NODE_GROW_SIZE (WRITE_NODE_BLOCK_SIZE * 16)
+
 struct persistentCacheHeader {
 	int format_version;
 	int id_size;
@@ -49,6 +55,13 @@ inline bool operator<(osmid_t a, cache_index_entry const &b)
     return a < b.key;
 }
 
+/**
+ * Persistent node location cache in a flat file.
+ *
+ * An instance opened read-only (ro) may be used by several threads at the
+ * same time. It caches blocks in slots that are shared between all threads
+ * and are read without locking.
+ */
 struct node_persistent_cache : public boost::noncopyable
 {
     node_persistent_cache(const struct options_t *options, bool append,
@@ -59,7 +72,54 @@ struct node_persistent_cache : public boost::noncopyable
     int get(osmNode *out, osmid_t id);
     size_t get_list(nodelist_t &out, const idlist_t nds);
 
+    /// Write out any buffered nodes and switch the cache to reading.
+    void set_read_mode();
+
+    /**
+     * Write out all changed nodes of an instance in append mode, so that
+     * read-only instances opened afterwards see them. The cache stays
+     * loaded and can be written to again.
+     */
+    void flush();
+
 private:
+    /* access through a memory mapping of the whole file, see --flat-nodes-mmap */
+    void map_file();
+    void unmap_file();
+    void mmap_expand(osmid_t id);
+    void mmap_writeout_block(int32_t block_offset);
+    void mmap_set(osmid_t id, const ramNode &coord);
+    int mmap_get(osmNode *out, osmid_t id) const;
+
+    persistentCacheHeader *mapped_header() const
+    {
+        return reinterpret_cast<persistentCacheHeader *>(mmap_base);
+    }
+
+    ramNode *mapped_nodes() const
+    {
+        return reinterpret_cast<ramNode *>(mmap_base + sizeof(persistentCacheHeader));
+    }
+
+    /* thread-safe block cache of read-only instances */
+    int shared_get(osmNode *out, osmid_t id);
+    void shared_load_block(osmid_t block_offset, size_t slot_id, ramNode *block);
+
+    /**
+     * A slot of the shared cache works like a seqlock: the version is odd
+     * while a thread replaces the block in the slot. Readers check that it
+     * was even and unchanged while they copied their node out of the slot.
+     */
+    struct shared_slot
+    {
+        std::atomic<uint64_t> version;
+        std::atomic<osmid_t> block_offset;
+    };
+
+    // a node is copied in and out of the shared cache in 64 bit words
+    static const size_t node_words = sizeof(ramNode) / sizeof(uint64_t);
+    static_assert(sizeof(ramNode) % sizeof(uint64_t) == 0,
+                  "ramNode must be made of whole 64 bit words");
 
     void set_append(osmid_t id, double lat, double lon);
     void set_create(osmid_t id, double lat, double lon);
@@ -74,7 +134,6 @@ private:
 
     void remove_from_cache_idx(osmid_t block_offset);
     void add_to_cache_idx(cache_index_entry const &entry);
-    void set_read_mode();
 
     int node_cache_fd;
     const char * node_cache_fname;
@@ -88,6 +147,19 @@ private:
     cache_index readNodeBlockCacheIdx;
 
     bool read_mode;
+    bool read_only;
+
+    char *mmap_base;
+    size_t mmap_size; // reserved address space, the file may be smaller
+    size_t file_size;
+    int32_t mmap_write_block; // block currently filled during import
+
+    size_t shared_slot_count;
+    std::unique_ptr<shared_slot[]> shared_slots;
+    std::unique_ptr<std::atomic<uint64_t>[]> shared_blocks;
+#ifdef _WIN32
+    std::mutex shared_read_mutex; // no pread(), so seek and read are locked
+#endif
 
     std::shared_ptr<node_ram_cache> ram_cache;
 };
@@ -5,6 +5,9 @@
 
 #include "config.h"
 
+#include <algorithm>
+#include <atomic>
+#include <memory>
 #include <new>
 #include <stdexcept>
 
@@ -52,6 +55,37 @@
  *  Lookup node: O(1)
  *  Add new block: O(log usedBlocks)
  *  Reuse old block: O(log maxBlocks)
+ *
+ * The compressed strategy uses the same blocks, but stores only the nodes
+ * in use: their number, then for each node the gap to the id of the node
+ * before and the difference of both coordinates to those of the node
+ * before, all as varints. Nodes with neighbouring ids are usually close
+ * to each other, so this takes 3-6 bytes per node instead of 8 and ids
+ * not in use take no space at all. The block currently being filled is
+ * kept uncompressed and compressed once a node from another block comes
+ * in, so nodes have to be sorted like for the dense strategy. When the
+ * cache is full, further blocks are dropped.
+ *
+ * Blocks can't be changed in the arena. A block which is written again, or
+ * dropped because one of its nodes changed, leaves its old copy behind as
+ * garbage, which doesn't count against the cache size. Once there is more
+ * garbage than blocks in use, the blocks in use are copied into a new arena.
+ *
+ * Lookups decode a whole block into a small cache of decoded blocks of
+ * each thread, so that the following lookups of nodes close by are as
+ * fast as with the dense strategy.
+ *
+ * The sparse array is searched through a static B-tree: sparseIndex[0]
+ * has the id of every SPARSE_FANOUT-th node in sparseBlock, sparseIndex[1]
+ * every SPARSE_FANOUT-th id of sparseIndex[0] and so on, up to a top level
+ * with at most SPARSE_FANOUT ids. A lookup reads SPARSE_FANOUT consecutive
+ * ids on each level instead of jumping all over the sparse array like a
+ * binary search does. As nodes come sorted by id, the levels are simply
+ * appended to while nodes are added.
+ *
+ * get_list() looks up a batch of ids at once, a level at a time, and
+ * prefetches the memory needed on the next level for all of them before
+ * reading it, so that the cache misses overlap.
  */
 
 
@@ -62,6 +96,20 @@
 
 #define SAFETY_MARGIN 1024*PER_BLOCK*sizeof(ramNode)
 
+#define DECODE_CACHE_SIZE 8
+
+/* garbage in the compressed arena before it is compacted at the latest */
+#define MIN_COMPACT_GARBAGE (16 * 1024 * 1024)
+
+#define SPARSE_FANOUT 16
+#define LOOKUP_BATCH 32
+
+#if defined(__GNUC__)
+#define PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define PREFETCH(addr)
+#endif
+
 #ifdef FIXED_POINT
 int ramNode::scale;
 #endif
@@ -82,6 +130,22 @@ static osmid_t block2id(int32_t block, int offset)
     return (((osmid_t) block - NUM_BLOCKS/2) << BLOCK_SHIFT) + (osmid_t) offset;
 }
 
+namespace {
+
+struct decoded_block_t {
+    decoded_block_t() : cacheId(0), data() {}
+
+    uint64_t cacheId;
+    ram_arena_t::ref_t data;
+    ramNode nodes[PER_BLOCK];
+};
+
+thread_local std::unique_ptr<decoded_block_t[]> decode_cache;
+
+std::atomic<uint64_t> next_cache_id(1);
+
+}
+
 #define Swap(a,b) { ramNodeBlock * __tmp = a; a = b; b = __tmp; }
 
 void node_ram_cache::percolate_up( int pos )
@@ -126,6 +190,15 @@ void node_ram_cache::set_sparse(osmid_t id, const ramNode &coord) {
             util::exit_nicely();
         }
     }
+    // the last node again, there must not be two entries for one id
+    if (sizeSparseTuples > 0 && sparseBlock[sizeSparseTuples - 1].id == id) {
+        if (!sparseBlock[sizeSparseTuples - 1].coord.is_valid()) {
+            storedNodes++;
+        }
+        sparseBlock[sizeSparseTuples - 1].coord = coord;
+        return;
+    }
+
     maxSparseId = id;
     sparseBlock[sizeSparseTuples].id = id;
     sparseBlock[sizeSparseTuples].coord = coord;
@@ -133,6 +206,29 @@ void node_ram_cache::set_sparse(osmid_t id, const ramNode &coord) {
     sizeSparseTuples++;
     cacheUsed += sizeof(ramNodeID);
     storedNodes++;
+
+    add_sparse_index(id);
+}
+
+void node_ram_cache::add_sparse_index(osmid_t id) {
+    // position of the new id in the level below
+    int64_t pos = sizeSparseTuples - 1;
+
+    for (size_t level = 0; pos % SPARSE_FANOUT == 0; ++level) {
+        if (level == sparseIndex.size()) {
+            if (level == 0) {
+                sparseIndex.emplace_back();
+            } else if (pos == 0) {
+                // the level below is the top level and still small enough
+                break;
+            } else {
+                // the level below just got too large for the top level
+                sparseIndex.emplace_back(1, sparseIndex[level - 1][0]);
+            }
+        }
+        sparseIndex[level].push_back(id);
+        pos = sparseIndex[level].size() - 1;
+    }
 }
 
 void node_ram_cache::set_dense(osmid_t id, const ramNode &coord) {
@@ -259,29 +355,112 @@ void node_ram_cache::set_dense(osmid_t id, const ramNode &coord) {
 }
 
 
-int node_ram_cache::get_sparse(osmNode *out, osmid_t id) {
-    int64_t pivotPos = sizeSparseTuples >> 1;
-    int64_t minPos = 0;
-    int64_t maxPos = sizeSparseTuples;
-
-    while (minPos <= maxPos) {
-        if ( sparseBlock[pivotPos].id == id ) {
-            out->lat = sparseBlock[pivotPos].coord.lat();
-            out->lon = sparseBlock[pivotPos].coord.lon();
-            return 0;
+/* Returns the position of the last of the (at most SPARSE_FANOUT) ids
+ * between begin and end which is not larger than id, -1 if there is none. */
+static int64_t find_in_level(const osmid_t *ids, int64_t begin, int64_t end, osmid_t id)
+{
+    if (ids[begin] > id) {
+        return -1;
+    }
+    while (begin + 1 < end && ids[begin + 1] <= id) {
+        ++begin;
+    }
+    return begin;
+}
+
+int64_t node_ram_cache::find_sparse(osmid_t id) const {
+    if (sparseIndex.empty()) {
+        return -1;
+    }
+
+    int64_t begin = 0;
+    int64_t end = sparseIndex.back().size();
+    for (size_t level = sparseIndex.size(); level-- > 0;) {
+        const int64_t pos = find_in_level(sparseIndex[level].data(), begin, end, id);
+        if (pos < 0) {
+            return -1;
         }
-        if ( (pivotPos == minPos) || (pivotPos == maxPos)) return 1;
+        begin = pos * SPARSE_FANOUT;
+        end = std::min(begin + SPARSE_FANOUT,
+                       level > 0 ? (int64_t) sparseIndex[level - 1].size() : sizeSparseTuples);
+    }
 
-        if ( sparseBlock[pivotPos].id > id ) {
-            maxPos = pivotPos;
-            pivotPos = minPos + ((maxPos - minPos) >> 1);
-        } else {
-            minPos = pivotPos;
-            pivotPos = minPos + ((maxPos - minPos) >> 1);
+    for (int64_t i = begin; i < end; ++i) {
+        if (sparseBlock[i].id == id) {
+            return i;
         }
     }
 
-    return 1;
+    return -1;
+}
+
+int node_ram_cache::get_sparse(osmNode *out, osmid_t id) {
+    const int64_t pos = find_sparse(id);
+    if (pos < 0 || !sparseBlock[pos].coord.is_valid()) {
+        return 1;
+    }
+
+    out->lat = sparseBlock[pos].coord.lat();
+    out->lon = sparseBlock[pos].coord.lon();
+    return 0;
+}
+
+void node_ram_cache::get_sparse_batch(osmNode *out, const osmid_t *ids, bool *found, size_t count) {
+    if (sparseIndex.empty()) {
+        return;
+    }
+
+    // the range of the level searched next for each id, empty if done
+    int64_t begin[LOOKUP_BATCH];
+    int64_t end[LOOKUP_BATCH];
+    for (size_t i = 0; i < count; ++i) {
+        begin[i] = 0;
+        end[i] = found[i] ? 0 : sparseIndex.back().size();
+    }
+
+    for (size_t level = sparseIndex.size(); level-- > 0;) {
+        const osmid_t *level_ids = sparseIndex[level].data();
+        const int64_t next_size = level > 0 ? (int64_t) sparseIndex[level - 1].size()
+                                            : sizeSparseTuples;
+
+        for (size_t i = 0; i < count; ++i) {
+            if (begin[i] == end[i]) {
+                continue;
+            }
+            const int64_t pos = find_in_level(level_ids, begin[i], end[i], ids[i]);
+            if (pos < 0) {
+                begin[i] = end[i] = 0;
+                continue;
+            }
+            begin[i] = pos * SPARSE_FANOUT;
+            end[i] = std::min(begin[i] + SPARSE_FANOUT, next_size);
+
+            // the ids on the next level span two cache lines, the sparse
+            // nodes four
+            if (level > 0) {
+                PREFETCH(&sparseIndex[level - 1][begin[i]]);
+                PREFETCH(&sparseIndex[level - 1][end[i] - 1]);
+            } else {
+                for (int64_t p = begin[i]; p < end[i]; p += 4) {
+                    PREFETCH(&sparseBlock[p]);
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        for (int64_t p = begin[i]; p < end[i]; ++p) {
+            if (sparseBlock[p].id == ids[i]) {
+                if (!sparseBlock[p].coord.is_valid()) {
+                    break;
+                }
+                out[i].lat = sparseBlock[p].coord.lat();
+                out[i].lon = sparseBlock[p].coord.lon();
+                found[i] = true;
+                break;
+            }
+        }
+    }
 }
 
 int node_ram_cache::get_dense(osmNode *out, osmid_t id) {
@@ -300,11 +479,199 @@ int node_ram_cache::get_dense(osmNode *out, osmid_t id) {
     return 0;
 }
 
+void node_ram_cache::compress_block() {
+#ifdef FIXED_POINT
+    // all nodes of the block have been removed
+    if (stagingCount == 0) {
+        stagingBlock = -1;
+        return;
+    }
+
+    std::string buffer;
+    buffer.reserve(stagingCount * 6 + 4);
+    varint::write(buffer, stagingCount);
+
+    int lastOffset = -1;
+    int64_t lastLon = 0;
+    int64_t lastLat = 0;
+    for (int i = 0; i < PER_BLOCK; ++i) {
+        if (!stagingNodes[i].is_valid()) {
+            continue;
+        }
+        varint::write(buffer, i - lastOffset - 1);
+        varint::write_signed(buffer, stagingNodes[i].int_lon() - lastLon);
+        varint::write_signed(buffer, stagingNodes[i].int_lat() - lastLat);
+        lastOffset = i;
+        lastLon = stagingNodes[i].int_lon();
+        lastLat = stagingNodes[i].int_lat();
+        stagingNodes[i] = ramNode();
+    }
+
+    if (cacheUsed + (int64_t) buffer.size() > cacheSize) {
+        if ((allocStrategy & ALLOC_LOSSY) == 0) {
+            fprintf(stderr, "\nNode cache size is too small to fit all nodes. Please increase cache size\n");
+            util::exit_nicely();
+        }
+        storedNodes -= stagingCount;
+    } else {
+        compressedBlocks[stagingBlock] = compressedData.add(buffer);
+        cacheUsed += buffer.size();
+        usedBlocks++;
+    }
+
+    if (compressedGarbage > MIN_COMPACT_GARBAGE && compressedGarbage > cacheUsed) {
+        compact_blocks();
+    }
+#endif
+    stagingBlock = -1;
+    stagingCount = 0;
+}
+
+/* Size of a compressed block in the arena. */
+size_t node_ram_cache::block_size(ram_arena_t::ref_t ref) const {
+    const char *start = compressedData.get(ref);
+    const char *data = start;
+    const uint64_t count = varint::read(data);
+    for (uint64_t i = 0; i < count; ++i) {
+        varint::read(data);
+        varint::read(data);
+        varint::read(data);
+    }
+    return data - start;
+}
+
+/* Forget the compressed copy of a block, its space becomes garbage. */
+void node_ram_cache::release_block(int32_t block) {
+    const size_t size = block_size(compressedBlocks[block]);
+    cacheUsed -= size;
+    compressedGarbage += size;
+    compressedBlocks[block] = ram_arena_t::ref_t();
+    usedBlocks--;
+}
+
+/* Copy the blocks in use into a new arena, leaving out the garbage. */
+void node_ram_cache::compact_blocks() {
+    ram_arena_t compacted;
+    for (auto &ref : compressedBlocks) {
+        if (ref.valid()) {
+            ref = compacted.add(compressedData.get(ref), block_size(ref));
+        }
+    }
+    compressedData = std::move(compacted);
+    compressedGarbage = 0;
+
+    // blocks are known by their position in the decode cache, which has
+    // just changed
+    cacheId = next_cache_id++;
+}
+
+int node_ram_cache::decode_block(ram_arena_t::ref_t ref, ramNode *nodes) const {
+    int count = 0;
+#ifdef FIXED_POINT
+    const char *data = compressedData.get(ref);
+    count = (int) varint::read(data);
+    int pos = -1;
+    int64_t lon = 0;
+    int64_t lat = 0;
+    for (int i = 0; i < count; ++i) {
+        pos += varint::read(data) + 1;
+        lon += varint::read_signed(data);
+        lat += varint::read_signed(data);
+        nodes[pos] = ramNode((int) lon, (int) lat);
+    }
+#endif
+    return count;
+}
+
+void node_ram_cache::set_compressed(osmid_t id, const ramNode &coord) {
+    int32_t const block  = id2block(id);
+    int const offset = id2offset(id);
+
+    if (cacheSize == 0) {
+      return;
+    }
+
+    if (block != stagingBlock) {
+        if (stagingBlock >= 0) {
+            compress_block();
+        }
+
+        stagingBlock = block;
+
+        if (compressedBlocks[block].valid()) {
+            if ((allocStrategy & ALLOC_LOSSY) == 0) {
+                /* the block can't be changed in the arena, so it is decoded
+                 * and written again when it is full. */
+                if (!warn_node_order) {
+                    fprintf( stderr, "WARNING: Found Out of order node %" PRIdOSMID " (%d,%d) - this will impact the cache efficiency\n", id, block, offset );
+                    warn_node_order++;
+                }
+                stagingCount = decode_block(compressedBlocks[block], stagingNodes.data());
+            } else {
+                /* the block can't be changed, so forget about it to not
+                 * return an outdated location for this node */
+                const char *data = compressedData.get(compressedBlocks[block]);
+                storedNodes -= varint::read(data);
+            }
+            release_block(block);
+        }
+    }
+
+    if (!stagingNodes[offset].is_valid()) {
+        stagingCount++;
+        storedNodes++;
+    }
+    stagingNodes[offset] = coord;
+}
+
+int node_ram_cache::get_compressed(osmNode *out, osmid_t id) {
+    int32_t const block  = id2block(id);
+    int const offset = id2offset(id);
+
+    const ramNode *node;
+    if (block == stagingBlock) {
+        node = &stagingNodes[offset];
+    } else {
+        auto const ref = compressedBlocks[block];
+        if (!ref.valid()) {
+            return 1;
+        }
+
+        if (!decode_cache) {
+            decode_cache.reset(new decoded_block_t[DECODE_CACHE_SIZE]);
+        }
+        decoded_block_t &decoded = decode_cache[block % DECODE_CACHE_SIZE];
+
+        // blocks never change in the arena, so its position identifies them
+        if (decoded.cacheId != cacheId || decoded.data.slab != ref.slab
+            || decoded.data.offset != ref.offset) {
+#ifdef FIXED_POINT
+            std::fill(decoded.nodes, decoded.nodes + PER_BLOCK, ramNode());
+            decode_block(ref, decoded.nodes);
+#endif
+            decoded.cacheId = cacheId;
+            decoded.data = ref;
+        }
+
+        node = &decoded.nodes[offset];
+    }
+
+    if (!node->is_valid())
+        return 1;
+
+    out->lat = node->lat();
+    out->lon = node->lon();
+
+    return 0;
+}
+
 
 node_ram_cache::node_ram_cache( int strategy, int cacheSizeMB, int fixpointscale )
     : allocStrategy(ALLOC_DENSE), blocks(nullptr), usedBlocks(0),
       maxBlocks(0), blockCache(nullptr), queue(nullptr), sparseBlock(nullptr),
-      maxSparseTuples(0), sizeSparseTuples(0), maxSparseId(0), cacheUsed(0),
+      maxSparseTuples(0), sizeSparseTuples(0), maxSparseId(0), sparseIndex(),
+      compressedData(), compressedBlocks(), compressedGarbage(0), stagingNodes(), stagingBlock(-1),
+      stagingCount(0), cacheId(next_cache_id++), cacheUsed(0),
       cacheSize(0), storedNodes(0), totalNodes(0), nodesCacheHits(0),
       nodesCacheLookups(0), warn_node_order(0) {
 #ifdef FIXED_POINT
@@ -320,6 +687,15 @@ node_ram_cache::node_ram_cache( int strategy, int cacheSizeMB, int fixpointscale
 
     allocStrategy = strategy;
 
+    if ((allocStrategy & ALLOC_COMPRESSED) > 0 ) {
+#ifndef FIXED_POINT
+        throw std::runtime_error("The compressed cache strategy needs a build with FIXED_POINT.");
+#endif
+        fprintf(stderr, "Allocating memory for compressed node cache\n");
+        compressedBlocks.resize(NUM_BLOCKS);
+        stagingNodes.resize(PER_BLOCK);
+    }
+
     if ((allocStrategy & ALLOC_DENSE) > 0 ) {
         fprintf(stderr, "Allocating memory for dense node cache\n");
         blocks = (ramNodeBlock *)calloc(NUM_BLOCKS,sizeof(ramNodeBlock));
@@ -407,7 +783,9 @@ void node_ram_cache::set(osmid_t id, double lat, double lon, const taglist_t &)
      * ram_nodes_set_dense. If a block is non dense, it will automatically
      * get pushed to the sparse cache if a block is sparse and ALLOC_SPARSE is set
      */
-    if ( (allocStrategy & ALLOC_DENSE) > 0 ) {
+    if ( (allocStrategy & ALLOC_COMPRESSED) > 0 ) {
+        set_compressed(id, ramNode(lon, lat));
+    } else if ( (allocStrategy & ALLOC_DENSE) > 0 ) {
         set_dense(id, ramNode(lon, lat));
     } else if ( (allocStrategy & ALLOC_SPARSE) > 0 ) {
         set_sparse(id, ramNode(lon, lat));
@@ -417,9 +795,57 @@ void node_ram_cache::set(osmid_t id, double lat, double lon, const taglist_t &)
     }
 }
 
+void node_ram_cache::remove(osmid_t id) {
+    int32_t const block  = id2block(id);
+    int const offset = id2offset(id);
+
+    if ((allocStrategy & ALLOC_COMPRESSED) > 0 && cacheSize > 0) {
+        if (block != stagingBlock) {
+            if (!compressedBlocks[block].valid()) {
+                return;
+            }
+            /* the block can't be changed in the arena, so it becomes the
+             * staging block again and is written anew without the node */
+            if (stagingBlock >= 0) {
+                compress_block();
+            }
+            stagingBlock = block;
+            stagingCount = decode_block(compressedBlocks[block], stagingNodes.data());
+            release_block(block);
+        }
+        if (stagingNodes[offset].is_valid()) {
+            stagingNodes[offset] = ramNode();
+            stagingCount--;
+            storedNodes--;
+        }
+    }
+    if ((allocStrategy & ALLOC_DENSE) > 0) {
+        /* the block keeps its place in the queue, which only decides which
+         * block is dropped first */
+        if (blocks[block].nodes && blocks[block].nodes[offset].is_valid()) {
+            blocks[block].nodes[offset] = ramNode();
+            blocks[block].dec_used();
+            storedNodes--;
+        }
+    }
+    if ((allocStrategy & ALLOC_SPARSE) > 0) {
+        const int64_t pos = find_sparse(id);
+        if (pos >= 0 && sparseBlock[pos].coord.is_valid()) {
+            sparseBlock[pos].coord = ramNode();
+            storedNodes--;
+        }
+    }
+}
+
 int node_ram_cache::get(osmNode *out, osmid_t id) {
     nodesCacheLookups++;
 
+    if ((allocStrategy & ALLOC_COMPRESSED) > 0) {
+        if (get_compressed(out, id) == 0) {
+            nodesCacheHits++;
+            return 0;
+        }
+    }
     if ((allocStrategy & ALLOC_DENSE) > 0) {
         if (get_dense(out, id) == 0) {
             nodesCacheHits++;
@@ -435,3 +861,62 @@ int node_ram_cache::get(osmNode *out, osmid_t id) {
 
     return 1;
 }
+
+size_t node_ram_cache::get_batch(osmNode *out, const osmid_t *ids, size_t count) {
+    bool found[LOOKUP_BATCH] = {false};
+
+    if ((allocStrategy & ALLOC_COMPRESSED) > 0) {
+        for (size_t i = 0; i < count; ++i) {
+            found[i] = get_compressed(&out[i], ids[i]) == 0;
+        }
+    }
+    if ((allocStrategy & ALLOC_DENSE) > 0) {
+        for (size_t i = 0; i < count; ++i) {
+            const ramNodeBlock &block = blocks[id2block(ids[i])];
+            if (block.nodes) {
+                PREFETCH(&block.nodes[id2offset(ids[i])]);
+            }
+        }
+        for (size_t i = 0; i < count; ++i) {
+            found[i] = found[i] || get_dense(&out[i], ids[i]) == 0;
+        }
+    }
+    if ((allocStrategy & ALLOC_SPARSE) > 0) {
+        get_sparse_batch(out, ids, found, count);
+    }
+
+    size_t hits = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (found[i]) {
+            ++hits;
+        }
+    }
+    return hits;
+}
+
+size_t node_ram_cache::get_list(nodelist_t &out, const idlist_t &ids) {
+    out.assign(ids.size(), osmNode());
+
+    size_t hits = 0;
+    for (size_t start = 0; start < ids.size(); start += LOOKUP_BATCH) {
+        const size_t count = std::min((size_t) LOOKUP_BATCH, ids.size() - start);
+        hits += get_batch(&out[start], &ids[start], count);
+    }
+
+    nodesCacheLookups += ids.size();
+    nodesCacheHits += hits;
+
+    return hits;
+}
+
+size_t unpack_locations(nodelist_t &out, const idlist_t &packed)
+{
+#ifdef FIXED_POINT
+    out.reserve(out.size() + packed.size());
+    for (auto value : packed) {
+        const ramNode n = ramNode::unpack(value);
+        out.emplace_back(n.lon(), n.lat());
+    }
+#endif
+    return out.size();
+}
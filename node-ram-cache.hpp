@@ -2,7 +2,8 @@
  *
  * There are two different storage strategies, either optimised
  * for dense storage of node ids, or for sparse storage as well as
- * a strategy to combine both in an optimal way.
+ * a strategy to combine both in an optimal way. A third strategy
+ * stores dense blocks delta encoded.
 */
 
 #ifndef NODE_RAM_CACHE_H
@@ -13,15 +14,18 @@
 #include <climits>
 #include <cstddef>
 #include <cstdint>
+#include <vector>
 
 #include <boost/noncopyable.hpp>
 
 #include "osmtypes.hpp"
+#include "ram-arena.hpp"
 
 #define ALLOC_SPARSE 1
 #define ALLOC_DENSE 2
 #define ALLOC_DENSE_CHUNK 4
 #define ALLOC_LOSSY 8
+#define ALLOC_COMPRESSED 16
 
 /**
  * A set of coordinates, for caching in RAM or on disk.
@@ -59,6 +63,21 @@ public:
     /// Return internal representation of latitude (for external storage).
     int int_lat() const { return _lat; }
 
+    /**
+     * Both coordinates in one 64 bit value. Used with --locations-on-ways,
+     * where the way node lists hold the locations instead of the node ids.
+     */
+    int64_t packed() const
+    {
+        return int64_t((uint64_t(uint32_t(_lon)) << 32) | uint32_t(_lat));
+    }
+    /// Node from a value created by packed().
+    static ramNode unpack(int64_t packed)
+    {
+        return ramNode(int(int32_t(uint64_t(packed) >> 32)),
+                       int(int32_t(uint64_t(packed) & 0xffffffff)));
+    }
+
 private:
     int _lon;
     int _lat;
@@ -104,6 +123,12 @@ private:
     int32_t _used; // 0-bit indicates dirty
 };
 
+/**
+ * Append the locations from a way node list which was read with
+ * --locations-on-ways (see ramNode::packed()) to out.
+ */
+size_t unpack_locations(nodelist_t &out, const idlist_t &packed);
+
 struct node_ram_cache : public boost::noncopyable
 {
     node_ram_cache(int strategy, int cacheSizeMB, int fixpointscale);
@@ -112,6 +137,26 @@ struct node_ram_cache : public boost::noncopyable
     void set(osmid_t id, double lat, double lon, const taglist_t &tags);
     int get(osmNode *out, osmid_t id);
 
+    /**
+     * Forget the location of a node, so that it isn't returned any more
+     * after the node has been changed or deleted.
+     */
+    void remove(osmid_t id);
+
+    /**
+     * Look up the locations of all ids. Afterwards out has one entry for
+     * each id, nodes not in the cache are left invalid (NAN).
+     *
+     * This is faster than calling get() for each id, because the memory
+     * needed is prefetched for a number of ids at once.
+     *
+     * \return number of nodes found
+     */
+    size_t get_list(nodelist_t &out, const idlist_t &ids);
+
+    /// Memory counted against the cache size.
+    int64_t used_memory() const { return cacheUsed; }
+
 private:
     void percolate_up( int pos );
     ramNode *next_chunk();
@@ -119,6 +164,17 @@ private:
     void set_dense(osmid_t id, const ramNode& coord);
     int get_sparse(osmNode *out, osmid_t id);
     int get_dense(osmNode *out, osmid_t id);
+    void add_sparse_index(osmid_t id);
+    int64_t find_sparse(osmid_t id) const;
+    void get_sparse_batch(osmNode *out, const osmid_t *ids, bool *found, size_t count);
+    size_t get_batch(osmNode *out, const osmid_t *ids, size_t count);
+    void set_compressed(osmid_t id, const ramNode &coord);
+    void compress_block();
+    size_t block_size(ram_arena_t::ref_t ref) const;
+    void release_block(int32_t block);
+    void compact_blocks();
+    int decode_block(ram_arena_t::ref_t ref, ramNode *nodes) const;
+    int get_compressed(osmNode *out, osmid_t id);
 
     int allocStrategy;
 
@@ -135,6 +191,20 @@ private:
     int64_t maxSparseTuples;
     int64_t sizeSparseTuples;
     osmid_t maxSparseId;
+    /* levels of the search tree over the ids in sparseBlock, see
+     * add_sparse_index() */
+    std::vector<std::vector<osmid_t>> sparseIndex;
+
+    /* compressed blocks, the block currently filled is kept uncompressed */
+    ram_arena_t compressedData;
+    std::vector<ram_arena_t::ref_t> compressedBlocks;
+    /* bytes of blocks in the arena which are not in use any more */
+    int64_t compressedGarbage;
+    std::vector<ramNode> stagingNodes;
+    int32_t stagingBlock;
+    int stagingCount;
+    /* identifies this cache in the per-thread cache of decoded blocks */
+    uint64_t cacheId;
 
     int64_t cacheUsed, cacheSize;
     osmid_t storedNodes, totalNodes;
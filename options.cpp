@@ -58,11 +58,20 @@ namespace
         {"disable-parallel-indexing", 0, 0, 'I'},
         {"cache-strategy", 1, 0, 204},
         {"number-processes", 1, 0, 205},
+        {"parse-processes", 1, 0, 215},
         {"drop", 0, 0, 206},
         {"unlogged", 0, 0, 207},
         {"flat-nodes",1,0,209},
+        {"flat-nodes-mmap",0,0,216},
+        {"client-sort",1,0,217},
+        {"index-processes",1,0,218},
+        {"locations-on-ways",0,0,219},
+        {"way-node-table",0,0,221},
+        {"watch-dir",1,0,222},
+        {"watch-interval",1,0,223},
         {"exclude-invalid-polygon",0,0,210},
         {"tag-transform-script",1,0,212},
+        {"tag-transform-cache",1,0,220},
         {"reproject-area",0,0,213},
         {0, 0, 0, 0}
     };
@@ -139,7 +148,15 @@ namespace
                         (no updates are possible).\n\
           --number-processes        Specifies the number of parallel processes \n\
                         used for certain operations (default is 1).\n\
+          --parse-processes Number of threads used to process objects while\n\
+                        the input is read (default is 1). Only on import.\n\
        -I|--disable-parallel-indexing   Disable indexing all tables concurrently.\n\
+          --index-processes Number of tables clustered and indexed at the\n\
+                        same time (default is all tables at once).\n\
+          --client-sort DIR Sort the output tables by geometry in osm2pgsql,\n\
+                        using temporary files in DIR, instead of rewriting\n\
+                        them in the database. Uses up to 1GB of RAM for\n\
+                        all tables together. Only on import.\n\
           --unlogged    Use unlogged tables (lost on crash but faster). \n\
                         Requires PostgreSQL 9.1.\n\
           --cache-strategy  Specifies the method used to cache nodes in ram.\n\
@@ -152,6 +169,12 @@ namespace
                             strategies for optimal storage efficiency. This may\n\
                             us twice as much virtual memory, but no more physical \n\
                             memory.\n");
+    #ifdef FIXED_POINT
+        printf("\
+                        compressed: like dense, but stores the nodes delta\n\
+                            encoded, which needs less memory for large\n\
+                            imports at the cost of some speed.\n");
+    #endif
     #ifdef __amd64__
         printf("\
                         The default is \"optimized\"\n");
@@ -165,6 +188,21 @@ namespace
                         information in slim mode instead of in PostgreSQL.\n\
                         This file is a single > 16Gb large file. Only recommended\n\
                         for full planet imports. Default is disabled.\n\
+          --flat-nodes-mmap  Access the flat node file through a memory\n\
+                        mapping instead of an own block cache. Best with\n\
+                        enough RAM to keep most of the file in the page cache.\n\
+          --locations-on-ways  The input has the node locations on the ways\n\
+                        (see osmium add-locations-to-ways). No node cache\n\
+                        is used. Only on import, with --drop in slim mode.\n\
+          --way-node-table  Find the ways of changed nodes through a separate\n\
+                        node to way table instead of a GIN index on the ways.\n\
+                        Updates use the table if the import made it.\n\
+          --watch-dir   Keep running and apply the change files showing up in\n\
+                        this directory one after the other (with --append).\n\
+                        The expired tiles of each file are written to\n\
+                        the expire output file name plus its path.\n\
+          --watch-interval  Seconds between looking for new change files\n\
+                        (default: 60, 0 to exit when there are none left).\n\
     \n\
     Expiry options:\n\
        -e|--expire-tiles [min_zoom-]max_zoom    Create a tile expiry list.\n\
@@ -193,7 +231,10 @@ namespace
           --tag-transform-script  Specify a lua script to handle tag filtering and normalisation\n\
                         The script contains callback functions for nodes, ways and relations, which each\n\
                         take a set of tags and returns a transformed, filtered set of tags which are then\n\
-                        written to the database.\n");
+                        written to the database.\n\
+          --tag-transform-cache  Use up to this many MB for keeping the results of\n\
+                        the tag transform script for ways which are processed\n\
+                        again later (default: 1024, 0 to disable).\n");
     #endif
         printf("\
        -x|--extra-attributes\n\
@@ -267,13 +308,13 @@ options_t::options_t():
     cache(800), tblsmain_index(boost::none), tblsslim_index(boost::none), tblsmain_data(boost::none), tblsslim_data(boost::none), style(OSM2PGSQL_DATADIR "/default.style"),
     expire_tiles_zoom(-1), expire_tiles_zoom_min(-1), expire_tiles_max_bbox(20000.0), expire_tiles_filename("dirty_tiles"),
     hstore_mode(HSTORE_NONE), enable_hstore_index(false),
-    enable_multi(false), hstore_columns(), keep_coastlines(false), parallel_indexing(true),
+    enable_multi(false), hstore_columns(), keep_coastlines(false), parallel_indexing(true), index_procs(0),
     #ifdef __amd64__
     alloc_chunkwise(ALLOC_SPARSE | ALLOC_DENSE),
     #else
     alloc_chunkwise(ALLOC_SPARSE),
     #endif
-    droptemp(false),  unlogged(false), hstore_match_only(false), flat_node_cache_enabled(false), excludepoly(false), reproject_area(false), flat_node_file(boost::none),
+    parse_procs(1), droptemp(false),  unlogged(false), hstore_match_only(false), flat_node_cache_enabled(false), flat_node_mmap(false), excludepoly(false), reproject_area(false), flat_node_file(boost::none), client_sort_dir(boost::none), locations_on_ways(false), way_node_table(false), watch_dir(boost::none), watch_interval(60), tag_transform_cache(1024),
     tag_transform_script(boost::none), tag_transform_node_func(boost::none), tag_transform_way_func(boost::none),
     tag_transform_rel_func(boost::none), tag_transform_rel_mem_func(boost::none),
     create(false), long_usage_bool(false), pass_prompt(false),  output_backend("pgsql"), input_reader("auto"), bbox(boost::none),
@@ -429,6 +470,10 @@ options_t::options_t(int argc, char *argv[]): options_t()
                 alloc_chunkwise = ALLOC_SPARSE;
             else if (strcmp(optarg, "optimized") == 0)
                 alloc_chunkwise = ALLOC_DENSE | ALLOC_SPARSE;
+#ifdef FIXED_POINT
+            else if (strcmp(optarg, "compressed") == 0)
+                alloc_chunkwise = ALLOC_COMPRESSED;
+#endif
             else {
                 throw std::runtime_error((boost::format("Unrecognized cache strategy %1%.\n") % optarg).str());
             }
@@ -436,6 +481,9 @@ options_t::options_t(int argc, char *argv[]): options_t()
         case 205:
             num_procs = atoi(optarg);
             break;
+        case 215:
+            parse_procs = atoi(optarg);
+            break;
         case 206:
             droptemp = true;
             break;
@@ -446,6 +494,27 @@ options_t::options_t(int argc, char *argv[]): options_t()
             flat_node_cache_enabled = true;
             flat_node_file = optarg;
             break;
+        case 216:
+            flat_node_mmap = true;
+            break;
+        case 217:
+            client_sort_dir = optarg;
+            break;
+        case 218:
+            index_procs = atoi(optarg);
+            break;
+        case 219:
+            locations_on_ways = true;
+            break;
+        case 221:
+            way_node_table = true;
+            break;
+        case 222:
+            watch_dir = optarg;
+            break;
+        case 223:
+            watch_interval = atoi(optarg);
+            break;
         case 210:
             excludepoly = true;
             break;
@@ -455,6 +524,9 @@ options_t::options_t(int argc, char *argv[]): options_t()
         case 212:
             tag_transform_script = optarg;
             break;
+        case 220:
+            tag_transform_cache = atoi(optarg);
+            break;
         case 213:
             reproject_area = true;
             break;
@@ -474,8 +546,8 @@ options_t::options_t(int argc, char *argv[]): options_t()
         return;
     }
 
-    //we require some input files!
-    if (argc == optind) {
+    //we require some input files, unless they come from a directory
+    if (argc == optind && !watch_dir) {
         short_usage(argv[0]);
     }
 
@@ -545,6 +617,82 @@ void options_t::check_options()
         fprintf(stderr, "WARNING: Must use at least 1 process.\n\n");
     }
 
+    if (parse_procs < 1) {
+        parse_procs = 1;
+        fprintf(stderr, "WARNING: Must use at least 1 parse process.\n\n");
+    }
+
+    if (parse_procs > 1 && append) {
+        fprintf(stderr, "Warning: --parse-processes only makes sense on import; ignored.\n");
+        parse_procs = 1;
+    }
+
+    if (parse_procs > 1 && output_backend == "gazetteer") {
+        fprintf(stderr, "Warning: --parse-processes is not supported by the gazetteer output; ignored.\n");
+        parse_procs = 1;
+    }
+
+    if (!parallel_indexing) {
+        if (index_procs > 1) {
+            fprintf(stderr, "Warning: --index-processes only makes sense without --disable-parallel-indexing; ignored.\n");
+        }
+        index_procs = 1;
+    } else if (index_procs < 0) {
+        index_procs = 0;
+    }
+
+    if (locations_on_ways) {
+#ifndef FIXED_POINT
+        throw std::runtime_error("--locations-on-ways needs a build with FIXED_POINT.\n");
+#endif
+        if (append) {
+            throw std::runtime_error("--locations-on-ways can not be used with --append.\n");
+        }
+        // the database could not be updated later without the node locations
+        if (slim && !droptemp) {
+            throw std::runtime_error("--locations-on-ways needs --drop in slim mode.\n");
+        }
+        if (flat_node_cache_enabled) {
+            fprintf(stderr, "Warning: --flat-nodes is not needed with --locations-on-ways; ignored.\n");
+            flat_node_cache_enabled = false;
+        }
+    }
+
+    if (watch_dir && !append) {
+        throw std::runtime_error("--watch-dir can only be used with --append.\n");
+    }
+
+    if (watch_interval < 0) {
+        watch_interval = 0;
+    }
+
+    if (way_node_table && (!slim || droptemp)) {
+        fprintf(stderr, "Warning: --way-node-table only makes sense in slim mode without --drop; ignored.\n");
+        way_node_table = false;
+    }
+
+    if (flat_node_mmap && !flat_node_cache_enabled) {
+        fprintf(stderr, "Warning: --flat-nodes-mmap only makes sense with --flat-nodes; ignored.\n");
+        flat_node_mmap = false;
+    }
+
+    // there is only address space to map about 134 million node ids
+    if (flat_node_mmap && sizeof(void *) < 8) {
+        fprintf(stderr, "Warning: --flat-nodes-mmap needs a 64bit system, the flat node file is read and written without it.\n");
+        flat_node_mmap = false;
+    }
+
+    if (client_sort_dir && append) {
+        fprintf(stderr, "Warning: --client-sort only makes sense on import; ignored.\n");
+        client_sort_dir = boost::none;
+    }
+
+    // rows in the sorter can't be looked up for expiry
+    if (client_sort_dir && expire_tiles_zoom >= 0) {
+        fprintf(stderr, "Warning: --client-sort can not be used with --expire-tiles; ignored.\n");
+        client_sort_dir = boost::none;
+    }
+
     if (sizeof(int*) == 4 && !slim) {
         fprintf(stderr, "\n!! You are running this on 32bit system, so at most\n");
         fprintf(stderr, "!! 3GB of RAM can be used. If you encounter unexpected\n");
@@ -69,15 +69,24 @@ public:
     std::vector<std::string> hstore_columns; ///< list of columns that should be written into their own hstore column
     bool keep_coastlines;
     bool parallel_indexing;
+    int index_procs; ///< number of tables clustered and indexed at the same time, 0 for all
     int alloc_chunkwise;
     int num_procs;
+    int parse_procs; ///< number of threads processing objects while reading the input
     bool droptemp; ///< drop slim mode temp tables after act
     bool unlogged; ///< use unlogged tables where possible
     bool hstore_match_only; ///< only copy rows that match an explicitly listed key
     bool flat_node_cache_enabled;
+    bool flat_node_mmap; ///< access the flat node file through mmap
     bool excludepoly;
     bool reproject_area;
     boost::optional<std::string> flat_node_file;
+    boost::optional<std::string> client_sort_dir; ///< directory for sorting the output tables on the client
+    bool locations_on_ways; ///< take the node locations of ways from the input instead of the node cache
+    bool way_node_table; ///< keep a node to way table instead of a GIN index on the ways
+    boost::optional<std::string> watch_dir; ///< directory with change files to apply in a loop
+    int watch_interval; ///< seconds between looking for new change files, 0 to stop when done
+    int tag_transform_cache; ///< MB for keeping the Lua tag transform results of pending ways
     /**
      * these options allow you to control the name of the
      * Lua functions which get called in the tag transform
@@ -24,25 +24,63 @@
 */
 
 #include "config.h"
+#include "change-dir.hpp"
 #include "osmtypes.hpp"
 #include "reprojection.hpp"
 #include "options.hpp"
 #include "parse-osmium.hpp"
+#include "parse-pipeline.hpp"
 #include "middle.hpp"
 #include "output.hpp"
 #include "osmdata.hpp"
 #include "util.hpp"
 
 #include <time.h>
+#include <algorithm>
+#include <chrono>
+#include <csignal>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <vector>
+#include <cerrno>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 
 #include <libpq-fe.h>
 #include <boost/format.hpp>
 
+namespace {
+
+volatile std::sig_atomic_t stop_watching = 0;
+
+// change files from --watch-dir merged at most into one update
+const size_t max_merged_change_files = 60;
+
+// with --watch-dir, finish the current change file before exiting
+void handle_stop_signal(int)
+{
+    stop_watching = 1;
+}
+
+// all outputs add to the temporary file, which is only moved into place
+// when the expire list is complete
+void finish_expire_list(const std::string &tmp, const std::string &filename)
+{
+    // without any expired tiles there is still an (empty) list
+    FILE *file = fopen(tmp.c_str(), "a");
+    if (file) {
+        fclose(file);
+    }
+    if (std::rename(tmp.c_str(), filename.c_str()) != 0) {
+        throw std::runtime_error((boost::format("Moving expire list to %1% failed: %2%\n")
+                                  % filename % strerror(errno)).str());
+    }
+}
+
+} // anonymous namespace
+
 int main(int argc, char *argv[])
 {
     fprintf(stderr, "osm2pgsql version %s (%zu bit id space)\n\n", VERSION, 8 * sizeof(osmid_t));
@@ -76,20 +114,116 @@ int main(int argc, char *argv[])
          * set as pending, to be handled in the next stage.
          */
         parse_stats_t stats;
-        //read in the input files one by one
-        for (auto const filename : options.input_files) {
+        auto read_file = [&](const std::string &filename) {
             //read the actual input
             fprintf(stderr, "\nReading in file: %s\n", filename.c_str());
             time_t start = time(nullptr);
 
+            if (options.parse_procs > 1) {
+                parse_pipeline_t parser(options, middle, outputs);
+                parser.stream_file(filename, options.input_reader);
+
+                stats.update(parser.stats());
+            } else {
+                parse_osmium_t parser(options.extra_attributes,
+                                      options.bbox, options.projection.get(),
+                                      options.append, &osmdata,
+                                      options.locations_on_ways);
+                parser.stream_file(filename, options.input_reader);
+
+                stats.update(parser.stats());
+            }
+
+            fprintf(stderr, "  parse time: %ds\n", (int)(time(nullptr) - start));
+        };
+
+        // Several change files are merged first, so that objects changed in
+        // more than one of them are only applied once.
+        auto read_files = [&](const std::vector<std::string> &filenames) {
+            bool merge = options.append && filenames.size() > 1;
+            for (auto const &filename : filenames) {
+                merge = merge && parse_osmium_t::is_change_file(filename, options.input_reader);
+            }
+
+            if (!merge) {
+                //read in the input files one by one
+                for (auto const &filename : filenames) {
+                    read_file(filename);
+                }
+                return;
+            }
+
+            fprintf(stderr, "\nReading in %zu change files\n", filenames.size());
+            time_t start = time(nullptr);
+
             parse_osmium_t parser(options.extra_attributes,
                                   options.bbox, options.projection.get(),
-                                  options.append, &osmdata);
-            parser.stream_file(filename, options.input_reader);
+                                  options.append, &osmdata,
+                                  options.locations_on_ways);
+            parser.stream_changes(filenames, options.input_reader);
 
             stats.update(parser.stats());
 
             fprintf(stderr, "  parse time: %ds\n", (int)(time(nullptr) - start));
+        };
+
+        read_files(options.input_files);
+
+        /* Long running updates
+         * Each change file in the directory is applied and its pending objects
+         * processed, then the next one follows with the same connections and
+         * caches, until the process is stopped.
+         */
+        if (options.watch_dir) {
+            if (!options.input_files.empty()) {
+                osmdata.changes_done(options.expire_tiles_filename);
+            }
+
+            change_dir_t changes(*options.watch_dir);
+            fprintf(stderr, "\nWatching %s for change files, last applied: %s\n",
+                    options.watch_dir->c_str(),
+                    changes.last_applied().empty() ? "none" : changes.last_applied().c_str());
+
+            std::signal(SIGINT, handle_stop_signal);
+            std::signal(SIGTERM, handle_stop_signal);
+
+            while (!stop_watching) {
+                // when behind, several change files are applied together
+                const std::vector<std::string> names = changes.new_files();
+                for (size_t i = 0; i < names.size() && !stop_watching;
+                     i += max_merged_change_files) {
+                    const size_t end = std::min(names.size(), i + max_merged_change_files);
+                    std::vector<std::string> batch;
+                    for (size_t j = i; j < end; ++j) {
+                        batch.push_back(changes.path(names[j]));
+                    }
+                    read_files(batch);
+
+                    // one expire list per applied batch, named after its last file
+                    if (options.expire_tiles_zoom_min >= 0) {
+                        const std::string expire_list =
+                            change_dir_t::expire_list(options.expire_tiles_filename, names[end - 1]);
+                        const std::string tmp = expire_list + ".tmp";
+                        std::remove(tmp.c_str()); // left over from a crash
+                        osmdata.changes_done(tmp);
+                        finish_expire_list(tmp, expire_list);
+                    } else {
+                        osmdata.changes_done(options.expire_tiles_filename);
+                    }
+                    changes.applied(names[end - 1]);
+                }
+
+                if (options.watch_interval == 0) {
+                    break;
+                }
+                for (int i = 0; i < options.watch_interval && !stop_watching; ++i) {
+                    std::this_thread::sleep_for(std::chrono::seconds(1));
+                }
+            }
+
+            // the final stage may take hours, it can be interrupted again
+            std::signal(SIGINT, SIG_DFL);
+            std::signal(SIGTERM, SIG_DFL);
         }
 
         //show stats
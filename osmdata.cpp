@@ -1,4 +1,7 @@
+#include <algorithm>
+#include <atomic>
 #include <cstdio>
+#include <deque>
 #include <functional>
 #include <future>
 #include <mutex>
@@ -6,6 +9,7 @@
 #include <utility>
 #include <vector>
 
+#include "index-scheduler.hpp"
 #include "middle.hpp"
 #include "node-ram-cache.hpp"
 #include "osmdata.hpp"
@@ -161,42 +165,164 @@ void osmdata_t::start() {
 
 namespace {
 
-//TODO: have the main thread using the main middle to query the middle for batches of ways (configurable number)
-//and stuffing those into the work queue, so we have a single producer multi consumer threaded queue
-//since the fetching from middle should be faster than the processing in each backend.
+/// Maximum number of jobs handed to a thread at once. Pending ways of a
+/// chunk are fetched from the middle with a single query.
+const size_t max_chunk_size = 1000;
+
+/**
+ * Distributes the pending jobs over the worker threads.
+ *
+ * The jobs are cut into chunks which are dealt out round-robin to one
+ * deque per thread. A thread takes chunks from the front of its own deque
+ * and, once that is empty, steals from the back of the others. Each deque
+ * has its own lock, which is only contended while stealing.
+ */
+class job_scheduler_t
+{
+public:
+    // range [first, second) of indexes into the job list
+    typedef std::pair<size_t, size_t> chunk_t;
+
+    explicit job_scheduler_t(size_t thread_count)
+    : deques(thread_count)
+    {}
+
+    /// Take over all jobs from the queue and deal them out to the threads.
+    void reset(pending_queue_t &queue)
+    {
+        jobs.clear();
+        jobs.reserve(queue.size());
+        while (!queue.empty()) {
+            jobs.push_back(queue.top());
+            queue.pop();
+        }
+
+        // small enough for the threads to even out at the end, large enough
+        // to make taking a chunk cheap compared to processing it
+        size_t chunk_size = jobs.size() / (deques.size() * 16);
+        chunk_size = std::max<size_t>(1, std::min(chunk_size, max_chunk_size));
+
+        size_t thread = 0;
+        for (size_t i = 0; i < jobs.size(); i += chunk_size) {
+            deques[thread].chunks.emplace_back(i, std::min(i + chunk_size, jobs.size()));
+            thread = (thread + 1) % deques.size();
+        }
+    }
+
+    /// Get the next chunk for the given thread, false if all work is done.
+    bool next(size_t thread, chunk_t &chunk)
+    {
+        if (deques[thread].pop_front(chunk)) {
+            return true;
+        }
+        for (size_t i = 1; i < deques.size(); ++i) {
+            if (deques[(thread + i) % deques.size()].pop_back(chunk)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    pending_job_t const &job(size_t idx) const
+    {
+        return jobs[idx];
+    }
+
+    /// Throw away all jobs not yet started, so that the threads finish.
+    void clear()
+    {
+        for (auto &d : deques) {
+            std::lock_guard<std::mutex> lock(d.mutex);
+            d.chunks.clear();
+        }
+    }
+
+private:
+    struct worker_deque_t
+    {
+        bool pop_front(chunk_t &chunk)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (chunks.empty()) {
+                return false;
+            }
+            chunk = chunks.front();
+            chunks.pop_front();
+            return true;
+        }
+
+        bool pop_back(chunk_t &chunk)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (chunks.empty()) {
+                return false;
+            }
+            chunk = chunks.back();
+            chunks.pop_back();
+            return true;
+        }
+
+        std::mutex mutex;
+        std::deque<chunk_t> chunks;
+    };
+
+    std::vector<pending_job_t> jobs;
+    std::vector<worker_deque_t> deques;
+};
 
 struct pending_threaded_processor : public middle_t::pending_processor {
     typedef std::vector<std::shared_ptr<output_t>> output_vec_t;
     typedef std::pair<std::shared_ptr<const middle_query_t>, output_vec_t> clone_t;
 
-    static void do_jobs(output_vec_t const& outputs, pending_queue_t& queue, size_t& ids_done, std::mutex& mutex, int append, bool ways) {
+    static void do_jobs(clone_t const& clone, job_scheduler_t& scheduler, size_t thread,
+                        std::atomic<size_t>& ids_done, int append, bool ways) {
 #ifdef _MSC_VER
 	// Avoid problems when GEOS WKT-related methods switch the locale
         _configthreadlocale(_ENABLE_PER_THREAD_LOCALE);
 #endif
-        while (true) {
-            //get the job off the queue synchronously
-            pending_job_t job;
-            mutex.lock();
-            if(queue.empty()) {
-                mutex.unlock();
-                break;
-            }
-            else {
-                job = queue.top();
-                queue.pop();
+        output_vec_t const &outputs = clone.second;
+        job_scheduler_t::chunk_t chunk;
+        while (scheduler.next(thread, chunk)) {
+            if (ways) {
+                do_way_chunk(*clone.first, outputs, scheduler, chunk, append);
+            } else {
+                for (size_t i = chunk.first; i < chunk.second; ++i) {
+                    pending_job_t const &job = scheduler.job(i);
+                    outputs.at(job.output_id)->pending_relation(job.osm_id, append);
+                }
             }
-            mutex.unlock();
 
-            //process it
-            if(ways)
-                outputs.at(job.output_id)->pending_way(job.osm_id, append);
-            else
-                outputs.at(job.output_id)->pending_relation(job.osm_id, append);
+            ids_done.fetch_add(chunk.second - chunk.first, std::memory_order_relaxed);
+        }
+    }
 
-            mutex.lock();
-            ++ids_done;
-            mutex.unlock();
+    // Fetch all ways of the chunk in one go and hand them to the outputs.
+    static void do_way_chunk(middle_query_t const& mid, output_vec_t const& outputs,
+                             job_scheduler_t const& scheduler,
+                             job_scheduler_t::chunk_t const& chunk, int append) {
+        // the same way may be pending in several outputs
+        idlist_t ids;
+        ids.reserve(chunk.second - chunk.first);
+        for (size_t i = chunk.first; i < chunk.second; ++i) {
+            ids.push_back(scheduler.job(i).osm_id);
+        }
+        std::sort(ids.begin(), ids.end());
+        ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+        idlist_t way_ids;
+        multitaglist_t tags;
+        multinodelist_t nodes;
+        mid.ways_get_list(ids, way_ids, tags, nodes);
+
+        // way_ids keeps the order of ids, so the ways can be found by bisection
+        for (size_t i = chunk.first; i < chunk.second; ++i) {
+            pending_job_t const &job = scheduler.job(i);
+            auto it = std::lower_bound(way_ids.begin(), way_ids.end(), job.osm_id);
+            if (it != way_ids.end() && *it == job.osm_id) {
+                size_t idx = it - way_ids.begin();
+                outputs.at(job.output_id)->pending_way_fetched(job.osm_id, tags[idx],
+                                                               nodes[idx], append);
+            }
         }
     }
 
@@ -205,7 +331,7 @@ struct pending_threaded_processor : public middle_t::pending_processor {
         //note that we cant hint to the stack how large it should be ahead of time
         //we could use a different datastructure like a deque or vector but then
         //the outputs the enqueue jobs would need the version check for the push(_back) method
-        : outs(outs), ids_queued(0), append(append), queue(), ids_done(0) {
+        : outs(outs), ids_queued(0), append(append), queue(), scheduler(thread_count), ids_done(0) {
 
         //clone all the things we need
         clones.reserve(thread_count);
@@ -244,12 +370,13 @@ struct pending_threaded_processor : public middle_t::pending_processor {
 
 
         //make the threads and start them
+        scheduler.reset(queue);
         std::vector<std::future<void>> workers;
         for (size_t i = 0; i < clones.size(); ++i) {
             workers.push_back(std::async(std::launch::async,
-                                         do_jobs, std::cref(clones[i].second),
-                                         std::ref(queue), std::ref(ids_done),
-                                         std::ref(mutex), append, true));
+                                         do_jobs, std::cref(clones[i]),
+                                         std::ref(scheduler), i, std::ref(ids_done),
+                                         append, true));
         }
 
         //TODO: print out partial progress
@@ -258,12 +385,8 @@ struct pending_threaded_processor : public middle_t::pending_processor {
             try {
                 w.get();
             } catch (...) {
-                // drain the queue, so that the other workers finish
-                mutex.lock();
-                while (!queue.empty()) {
-                    queue.pop();
-                }
-                mutex.unlock();
+                // drop the remaining jobs, so that the other workers finish
+                scheduler.clear();
                 throw;
             }
         }
@@ -306,24 +429,21 @@ struct pending_threaded_processor : public middle_t::pending_processor {
         time_t start = time(nullptr);
 
         //make the threads and start them
+        scheduler.reset(queue);
         std::vector<std::future<void>> workers;
         for (size_t i = 0; i < clones.size(); ++i) {
             workers.push_back(std::async(std::launch::async,
-                                         do_jobs, std::cref(clones[i].second),
-                                         std::ref(queue), std::ref(ids_done),
-                                         std::ref(mutex), append, false));
+                                         do_jobs, std::cref(clones[i]),
+                                         std::ref(scheduler), i, std::ref(ids_done),
+                                         append, false));
         }
 
         for (auto& w: workers) {
             try {
                 w.get();
             } catch (...) {
-                // drain the queue, so the other worker finish immediately
-                mutex.lock();
-                while (!queue.empty()) {
-                    queue.pop();
-                }
-                mutex.unlock();
+                // drop the remaining jobs, so the other worker finish immediately
+                scheduler.clear();
                 throw;
             }
         }
@@ -357,24 +477,48 @@ private:
     size_t ids_queued;
     //appending to output that is already there (diff processing)
     bool append;
-    //job queue
+    //job queue filled by the outputs
     pending_queue_t queue;
+    //hands out the jobs to the threads
+    job_scheduler_t scheduler;
 
     //how many ids within the job have been processed
-    size_t ids_done;
-    //so the threads can manage some of the shared state
-    std::mutex mutex;
+    std::atomic<size_t> ids_done;
 };
 
 } // anonymous namespace
 
 void osmdata_t::stop() {
+    process_pending();
+
+    // Clustering, index creation, and cleanup.
+    // All the intensive parts of this are long-running PostgreSQL commands,
+    // they are run for all tables of the outputs and the middle together
+    // with a limited number at the same time.
+    index_scheduler_t scheduler(outs[0]->get_options()->index_procs);
+    for (auto& out: outs) {
+        out->schedule_stop(scheduler);
+    }
+    mid->schedule_stop(scheduler);
+    scheduler.run();
+}
+
+void osmdata_t::changes_done(const std::string &expire_filename) {
+    process_pending();
+
+    mid->changes_done();
+    for (auto& out: outs) {
+        out->changes_done(expire_filename);
+    }
+}
+
+void osmdata_t::process_pending() {
     /* Commit the transactions, so that multiple processes can
      * access the data simultanious to process the rest in parallel
      * as well as see the newly created tables.
      */
-    size_t pending_count = mid->pending_count();
     mid->commit();
+    size_t pending_count = mid->pending_count();
     for (auto& out: outs) {
         //TODO: each of the outs can be in parallel
         out->commit();
@@ -398,20 +542,4 @@ void osmdata_t::stop() {
         //TODO: Can we skip this on import?
         mid->iterate_relations( ptp );
     }
-
-    // Clustering, index creation, and cleanup.
-    // All the intensive parts of this are long-running PostgreSQL commands
-
-    std::vector<std::future<void>> futures;
-
-    // XXX we might get too many parallel processes here
-    //     use osmium worker pool instead
-    for (auto& out: outs) {
-        futures.push_back(std::async(&output_t::stop, out.get()));
-    }
-    futures.push_back(std::async(&middle_t::stop, mid.get()));
-
-    for (auto& f: futures) {
-      f.get();
-    }
 }
@@ -5,6 +5,7 @@
 // to get the print format specifiers in the inttypes.h header.
 #include "config.h"
 
+#include <string>
 #include <vector>
 #include <memory>
 
@@ -21,6 +22,13 @@ public:
 
     void start();
     void stop();
+    /**
+     * Finish one of several change files applied in one run: process the
+     * pending objects and commit like stop(), but keep the middle and the
+     * outputs going for the next change file. The outputs add their expire
+     * lists to expire_filename.
+     */
+    void changes_done(const std::string &expire_filename);
 
     int node_add(osmid_t id, double lat, double lon, const taglist_t &tags);
     int way_add(osmid_t id, const idlist_t &nodes, const taglist_t &tags);
@@ -35,6 +43,8 @@ public:
     int relation_delete(osmid_t id);
 
 private:
+    void process_pending();
+
     std::shared_ptr<middle_t> mid;
     std::vector<std::shared_ptr<output_t> > outs;
 };
@@ -9,6 +9,7 @@
 #include "output-gazetteer.hpp"
 #include "options.hpp"
 #include "util.hpp"
+#include "wkb-writer.hpp"
 
 #include <algorithm>
 #include <iostream>
@@ -662,6 +663,15 @@ void output_gazetteer_t::stop()
    return;
 }
 
+void output_gazetteer_t::changes_done(const std::string &)
+{
+   stop_copy();
+
+   /* Commit the changes and start over */
+   pgsql_exec(Connection, PGRES_COMMAND_OK, "COMMIT");
+   pgsql_exec(Connection, PGRES_COMMAND_OK, "BEGIN");
+}
+
 int output_gazetteer_t::process_node(osmid_t id, double lat, double lon,
                                      const taglist_t &tags)
 {
@@ -672,8 +682,7 @@ int output_gazetteer_t::process_node(osmid_t id, double lat, double lon,
 
     /* Are we interested in this item? */
     if (places.has_data()) {
-        std::string wkt = (point_fmt % lon % lat).str();
-        places.copy_out('N', id, wkt, buffer);
+        places.copy_out('N', id, wkb::point(lon, lat), buffer);
         flush_place_buffer();
     }
 
@@ -136,8 +136,7 @@ public:
       ConnectionDelete(NULL),
       ConnectionError(NULL),
       copy_active(false),
-      single_fmt("%1%"),
-      point_fmt("POINT(%.15g %.15g)")
+      single_fmt("%1%")
     {
         buffer.reserve(PLACE_BUFFER_SIZE);
     }
@@ -149,8 +148,7 @@ public:
       ConnectionError(NULL),
       copy_active(false),
       reproj(other.reproj),
-      single_fmt(other.single_fmt),
-      point_fmt(other.point_fmt)
+      single_fmt(other.single_fmt)
     {
         buffer.reserve(PLACE_BUFFER_SIZE);
         builder.set_exclude_broken_polygon(m_options.excludepoly);
@@ -169,6 +167,7 @@ public:
     int start();
     void stop();
     void commit() {}
+    void changes_done(const std::string &expire_filename);
 
     void enqueue_ways(pending_queue_t &job_queue, osmid_t id, size_t output_id, size_t& added) {}
     int pending_way(osmid_t id, int exists) { return 0; }
@@ -271,7 +270,6 @@ private:
     // string formatters
     // Need to be part of the class, so we have one per thread.
     boost::format single_fmt;
-    boost::format point_fmt;
 };
 
 extern output_gazetteer_t out_gazetteer;
@@ -7,10 +7,67 @@
 #include "id-tracker.hpp"
 #include "geometry-builder.hpp"
 #include "expire-tiles.hpp"
+#include "way-filter-cache.hpp"
 
 #include <boost/algorithm/string/predicate.hpp>
+#include <map>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+struct multi_group_t
+{
+    multi_group_t() : transform_slots(0), way_outputs(0) {}
+
+    // number of distinct transform functions used by several outputs
+    int transform_slots;
+    // number of outputs interested in ways
+    size_t way_outputs;
+};
+
+namespace {
+
+struct transform_result_t
+{
+    transform_result_t() : valid(false), filter(1), polygon(0), roads(0) {}
+
+    bool valid;
+    unsigned filter;
+    int polygon;
+    int roads;
+    taglist_t tags;
+};
+
+/* The object the outputs of a group are working on at the moment. */
+struct shared_object_t
+{
+    shared_object_t() : type(OSMTYPE_NODE), id(0), have_nodes(false) {}
+
+    void start(OsmType type_, osmid_t id_, const multi_group_t &group)
+    {
+        type = type_;
+        id = id_;
+        have_nodes = false;
+        results.assign(group.transform_slots, transform_result_t());
+    }
+
+    OsmType type;
+    osmid_t id;
+    bool have_nodes;
+    nodelist_t nodes;
+    std::vector<transform_result_t> results;
+};
+
+shared_object_t &shared_object(const multi_group_t *group)
+{
+    // an output and its clones are each only used on one thread, so every
+    // thread needs its own object
+    thread_local std::unordered_map<const multi_group_t *, shared_object_t> objects;
+    return objects[group];
+}
+
+} // anonymous namespace
+
 output_multi_t::output_multi_t(const std::string &name,
                                std::shared_ptr<geometry_processor> processor_,
                                const struct export_list &export_list_,
@@ -29,8 +86,19 @@ output_multi_t::output_multi_t(const std::string &name,
                           m_options.tblsmain_data, m_options.tblsmain_index)),
       ways_done_tracker(new id_tracker()),
       m_expire(m_options.expire_tiles_zoom, m_options.expire_tiles_max_bbox,
-               m_options.projection)
-{}
+               m_options.projection),
+      m_group_index(0), m_node_slot(-1), m_way_slot(-1)
+{
+    if (m_options.client_sort_dir) {
+        m_table->enable_client_sort(*m_options.client_sort_dir, m_options.projection);
+    }
+    // only ways which might be part of a relation are processed again
+    if (m_options.tag_transform_script && m_options.tag_transform_cache > 0 &&
+        m_processor->interests(geometry_processor::interest_relation)) {
+        m_way_filter_cache.reset(new way_filter_cache_t(
+            size_t(m_options.tag_transform_cache) * 1024 * 1024));
+    }
+}
 
 output_multi_t::output_multi_t(const output_multi_t& other):
     output_t(other.m_mid, other.m_options), m_tagtransform(new tagtransform(&m_options)), m_export_list(new export_list(*other.m_export_list)),
@@ -38,8 +106,11 @@ output_multi_t::output_multi_t(const output_multi_t& other):
     //NOTE: we need to know which ways were used by relations so each thread
     //must have a copy of the original marked done ways, its read only so its ok
     ways_done_tracker(other.ways_done_tracker),
+    m_way_filter_cache(other.m_way_filter_cache),
     m_expire(m_options.expire_tiles_zoom, m_options.expire_tiles_max_bbox,
-             m_options.projection)
+             m_options.projection),
+    m_group(other.m_group), m_group_index(other.m_group_index),
+    m_node_slot(other.m_node_slot), m_way_slot(other.m_way_slot)
 {}
 
 
@@ -77,20 +148,23 @@ void output_multi_t::enqueue_ways(pending_queue_t &job_queue, osmid_t id, size_t
         added++;
     }
 
-    //grab the first one or bail if its not valid
-    osmid_t popped = ways_pending_tracker.pop_mark();
-    if(!id_tracker::is_valid(popped))
-        return;
-
     //get all the ones up to the id that was passed in
-    while (popped < id) {
-        if (!ways_done_tracker->is_marked(popped)) {
-            job_queue.push(pending_job_t(popped, output_id));
-            added++;
+    idlist_t popped_ids;
+    while (ways_pending_tracker.pop_marks_before(id, popped_ids, PENDING_BATCH) > 0) {
+        for (osmid_t popped : popped_ids) {
+            if (!ways_done_tracker->is_marked(popped)) {
+                job_queue.push(pending_job_t(popped, output_id));
+                added++;
+            }
         }
-        popped = ways_pending_tracker.pop_mark();
+        popped_ids.clear();
     }
 
+    //grab the next one or bail if its not valid
+    osmid_t popped = ways_pending_tracker.pop_mark();
+    if(!id_tracker::is_valid(popped))
+        return;
+
     //make sure to get this one as well and move to the next
     if (popped > id) {
         if (!ways_done_tracker->is_marked(popped) && id_tracker::is_valid(popped)) {
@@ -114,6 +188,12 @@ int output_multi_t::pending_way(osmid_t id, int exists) {
     return ret;
 }
 
+int output_multi_t::pending_way_fetched(osmid_t id, const taglist_t &tags,
+                                        const nodelist_t &nodes, int exists)
+{
+    return reprocess_way(id, nodes, tags, exists);
+}
+
 void output_multi_t::enqueue_relations(pending_queue_t &job_queue, osmid_t id, size_t output_id, size_t& added) {
     osmid_t const prev = rels_pending_tracker.last_returned();
     if (id_tracker::is_valid(prev) && prev >= id) {
@@ -130,18 +210,21 @@ void output_multi_t::enqueue_relations(pending_queue_t &job_queue, osmid_t id, s
         added++;
     }
 
-    //grab the first one or bail if its not valid
+    //get all the ones up to the id that was passed in
+    idlist_t popped_ids;
+    while (rels_pending_tracker.pop_marks_before(id, popped_ids, PENDING_BATCH) > 0) {
+        for (osmid_t popped : popped_ids) {
+            job_queue.push(pending_job_t(popped, output_id));
+        }
+        added += popped_ids.size();
+        popped_ids.clear();
+    }
+
+    //grab the next one or bail if its not valid
     osmid_t popped = rels_pending_tracker.pop_mark();
     if(!id_tracker::is_valid(popped))
         return;
 
-    //get all the ones up to the id that was passed in
-    while (popped < id) {
-        job_queue.push(pending_job_t(popped, output_id));
-        added++;
-        popped = rels_pending_tracker.pop_mark();
-    }
-
     //make sure to get this one as well and move to the next
     if (popped > id) {
         if(id_tracker::is_valid(popped)) {
@@ -166,7 +249,14 @@ int output_multi_t::pending_relation(osmid_t id, int exists) {
 
 void output_multi_t::stop()
 {
-    m_table->stop();
+    index_scheduler_t scheduler(1);
+    schedule_stop(scheduler);
+    scheduler.run();
+}
+
+void output_multi_t::schedule_stop(index_scheduler_t &scheduler)
+{
+    m_table->schedule_stop(scheduler);
     if (m_options.expire_tiles_zoom_min >= 0) {
         m_expire.output_and_destroy(m_options.expire_tiles_filename.c_str(),
                                     m_options.expire_tiles_zoom_min);
@@ -177,7 +267,16 @@ void output_multi_t::commit() {
     m_table->commit();
 }
 
+void output_multi_t::changes_done(const std::string &expire_filename) {
+    if (m_options.expire_tiles_zoom_min >= 0) {
+        m_expire.output_and_destroy(expire_filename.c_str(),
+                                    m_options.expire_tiles_zoom_min);
+    }
+    m_table->begin();
+}
+
 int output_multi_t::node_add(osmid_t id, double lat, double lon, const taglist_t &tags) {
+    start_object(OSMTYPE_NODE, id);
     if (m_processor->interests(geometry_processor::interest_node)) {
         return process_node(id, lat, lon, tags);
     }
@@ -185,6 +284,7 @@ int output_multi_t::node_add(osmid_t id, double lat, double lon, const taglist_t
 }
 
 int output_multi_t::way_add(osmid_t id, const idlist_t &nodes, const taglist_t &tags) {
+    start_object(OSMTYPE_WAY, id);
     if (m_processor->interests(geometry_processor::interest_way) && nodes.size() > 1) {
         return process_way(id, nodes, tags);
     }
@@ -200,6 +300,7 @@ int output_multi_t::relation_add(osmid_t id, const memberlist_t &members, const
 }
 
 int output_multi_t::node_modify(osmid_t id, double lat, double lon, const taglist_t &tags) {
+    start_object(OSMTYPE_NODE, id);
     if (m_processor->interests(geometry_processor::interest_node)) {
         // TODO - need to know it's a node?
         delete_from_output(id);
@@ -214,9 +315,13 @@ int output_multi_t::node_modify(osmid_t id, double lat, double lon, const taglis
 }
 
 int output_multi_t::way_modify(osmid_t id, const idlist_t &nodes, const taglist_t &tags) {
+    start_object(OSMTYPE_WAY, id);
     if (m_processor->interests(geometry_processor::interest_way)) {
         // TODO - need to know it's a way?
         delete_from_output(id);
+        if (m_way_filter_cache) {
+            m_way_filter_cache->remove(id);
+        }
 
         // TODO: need to mark any relations using it - depends on what
         // type of output this is... delegate to the geometry processor??
@@ -254,6 +359,9 @@ int output_multi_t::way_delete(osmid_t id) {
         // TODO - need to know it's a way?
         delete_from_output(id);
     }
+    if (m_way_filter_cache) {
+        m_way_filter_cache->remove(id);
+    }
     return 0;
 }
 
@@ -268,7 +376,7 @@ int output_multi_t::relation_delete(osmid_t id) {
 int output_multi_t::process_node(osmid_t id, double lat, double lon, const taglist_t &tags) {
     //check if we are keeping this node
     taglist_t outtags;
-    unsigned int filter = m_tagtransform->filter_node_tags(tags, *m_export_list.get(), outtags, true);
+    unsigned int filter = filter_tags(OSMTYPE_NODE, id, tags, nullptr, nullptr, outtags);
     if (!filter) {
         //grab its geom
         auto geom = m_processor->process_node(lat, lon);
@@ -282,6 +390,12 @@ int output_multi_t::process_node(osmid_t id, double lat, double lon, const tagli
 
 int output_multi_t::reprocess_way(osmid_t id, const nodelist_t &nodes, const taglist_t &tags, bool exists)
 {
+    //the way might have been run through the tag transform already when it was added
+    int polygon = 0, roads = 0;
+    taglist_t outtags;
+    const bool cached = m_way_filter_cache &&
+                        m_way_filter_cache->take(id, outtags, &polygon, &roads);
+
     //if the way could exist already we have to make the relation pending and reprocess it later
     //but only if we actually care about relations
     if(m_processor->interests(geometry_processor::interest_relation) && exists) {
@@ -293,10 +407,9 @@ int output_multi_t::reprocess_way(osmid_t id, const nodelist_t &nodes, const tag
     }
 
     //check if we are keeping this way
-    int polygon = 0, roads = 0;
-    taglist_t outtags;
-    unsigned int filter = m_tagtransform->filter_way_tags(tags, &polygon, &roads,
-                                                          *m_export_list.get(), outtags, true);
+    unsigned int filter = cached ? 0 :
+        m_tagtransform->filter_way_tags(tags, &polygon, &roads,
+                                        *m_export_list.get(), outtags, true);
     if (!filter) {
         //grab its geom
         auto geom = m_processor->process_way(nodes);
@@ -311,11 +424,10 @@ int output_multi_t::process_way(osmid_t id, const idlist_t &nodes, const taglist
     //check if we are keeping this way
     int polygon = 0, roads = 0;
     taglist_t outtags;
-    unsigned filter = m_tagtransform->filter_way_tags(tags, &polygon, &roads,
-                                                      *m_export_list.get(), outtags, true);
+    unsigned filter = filter_tags(OSMTYPE_WAY, id, tags, &polygon, &roads, outtags);
     if (!filter) {
         //get the geom from the middle
-        if(m_way_helper.set(nodes, m_mid) < 1)
+        if (set_way_nodes(id, nodes) < 1)
             return 0;
         //grab its geom
         auto geom = m_processor->process_way(m_way_helper.node_cache);
@@ -325,6 +437,9 @@ int output_multi_t::process_way(osmid_t id, const idlist_t &nodes, const taglist
             //this way pending just in case it shows up in one
             if (m_processor->interests(geometry_processor::interest_relation)) {
                 ways_pending_tracker.mark(id);
+                if (m_way_filter_cache) {
+                    m_way_filter_cache->add(id, outtags, polygon, roads);
+                }
             } else {
                 // We wouldn't be interested in this as a relation, so no need to mark it pending.
                 // TODO: Does this imply anything for non-multipolygon relations?
@@ -409,6 +524,147 @@ int output_multi_t::process_relation(osmid_t id, const memberlist_t &members,
     return 0;
 }
 
+void output_multi_t::start_object(OsmType type, osmid_t id)
+{
+    if (m_group && m_group_index == 0) {
+        shared_object(m_group.get()).start(type, id, *m_group);
+    }
+}
+
+unsigned output_multi_t::filter_tags(OsmType type, osmid_t id, const taglist_t &tags,
+                                     int *polygon, int *roads, taglist_t &out_tags)
+{
+    const int slot = (type == OSMTYPE_NODE) ? m_node_slot : m_way_slot;
+    if (slot < 0) {
+        if (type == OSMTYPE_NODE) {
+            return m_tagtransform->filter_node_tags(tags, *m_export_list.get(), out_tags, true);
+        }
+        return m_tagtransform->filter_way_tags(tags, polygon, roads, *m_export_list.get(),
+                                               out_tags, true);
+    }
+
+    shared_object_t &obj = shared_object(m_group.get());
+    if (obj.type != type || obj.id != id) {
+        obj.start(type, id, *m_group);
+    }
+
+    transform_result_t &result = obj.results[slot];
+    if (!result.valid) {
+        if (type == OSMTYPE_NODE) {
+            result.filter = m_tagtransform->filter_node_tags(tags, *m_export_list.get(),
+                                                             result.tags, true);
+        } else {
+            result.filter = m_tagtransform->filter_way_tags(tags, &result.polygon, &result.roads,
+                                                            *m_export_list.get(), result.tags, true);
+        }
+        result.valid = true;
+    }
+
+    out_tags = result.tags;
+    if (polygon) {
+        *polygon = result.polygon;
+    }
+    if (roads) {
+        *roads = result.roads;
+    }
+    return result.filter;
+}
+
+size_t output_multi_t::set_way_nodes(osmid_t id, const idlist_t &nodes)
+{
+    if (!m_group || m_group->way_outputs < 2) {
+        return m_way_helper.set(nodes, m_mid);
+    }
+
+    shared_object_t &obj = shared_object(m_group.get());
+    if (obj.type != OSMTYPE_WAY || obj.id != id) {
+        obj.start(OSMTYPE_WAY, id, *m_group);
+    }
+
+    if (obj.have_nodes) {
+        m_way_helper.node_cache = obj.nodes;
+    } else {
+        m_way_helper.set(nodes, m_mid);
+        obj.nodes = m_way_helper.node_cache;
+        obj.have_nodes = true;
+    }
+    return m_way_helper.node_cache.size();
+}
+
+void output_multi_t::share_work(const std::vector<std::shared_ptr<output_multi_t> > &outputs)
+{
+    if (outputs.size() < 2) {
+        return;
+    }
+
+    auto group = std::make_shared<multi_group_t>();
+
+    // Lua functions give the same result for all tables, as long as
+    // it is the same function of the same script
+    typedef std::pair<std::string, std::string> func_t;
+    std::map<func_t, int> node_uses, way_uses;
+    for (const auto &out : outputs) {
+        const boost::optional<std::string> &script = out->m_options.tag_transform_script;
+        const std::string *node_func = out->m_tagtransform->lua_function(OSMTYPE_NODE);
+        const std::string *way_func = out->m_tagtransform->lua_function(OSMTYPE_WAY);
+        if (node_func && out->m_processor->interests(geometry_processor::interest_node)) {
+            ++node_uses[func_t(*script, *node_func)];
+        }
+        if (way_func && out->m_processor->interests(geometry_processor::interest_way)) {
+            ++way_uses[func_t(*script, *way_func)];
+        }
+    }
+
+    // all tables together use the memory given for the cache
+    const way_filter_cache_t *first_cache = nullptr;
+    for (const auto &out : outputs) {
+        if (!out->m_way_filter_cache) {
+            continue;
+        }
+        if (first_cache) {
+            out->m_way_filter_cache->share_memory(*first_cache);
+        } else {
+            first_cache = out->m_way_filter_cache.get();
+        }
+    }
+
+    std::map<func_t, int> node_slots, way_slots;
+    for (const auto &use : node_uses) {
+        if (use.second > 1) {
+            node_slots[use.first] = group->transform_slots++;
+        }
+    }
+    for (const auto &use : way_uses) {
+        if (use.second > 1) {
+            way_slots[use.first] = group->transform_slots++;
+        }
+    }
+
+    for (size_t i = 0; i < outputs.size(); ++i) {
+        output_multi_t &out = *outputs[i];
+        out.m_group = group;
+        out.m_group_index = i;
+
+        const std::string *node_func = out.m_tagtransform->lua_function(OSMTYPE_NODE);
+        if (node_func) {
+            auto it = node_slots.find(func_t(*out.m_options.tag_transform_script, *node_func));
+            if (it != node_slots.end()) {
+                out.m_node_slot = it->second;
+            }
+        }
+        const std::string *way_func = out.m_tagtransform->lua_function(OSMTYPE_WAY);
+        if (way_func) {
+            auto it = way_slots.find(func_t(*out.m_options.tag_transform_script, *way_func));
+            if (it != way_slots.end()) {
+                out.m_way_slot = it->second;
+            }
+        }
+        if (out.m_processor->interests(geometry_processor::interest_way)) {
+            ++group->way_outputs;
+        }
+    }
+}
+
 void output_multi_t::copy_node_to_table(osmid_t id, const std::string &geom, taglist_t &tags) {
     m_table->write_row(id, tags, geom);
 }
@@ -448,6 +704,18 @@ void output_multi_t::delete_from_output(osmid_t id) {
         m_table->delete_row(id);
 }
 
+void output_multi_t::merge_pending_ways(output_t *other)
+{
+    auto *omulti = dynamic_cast<output_multi_t *>(other);
+
+    if (omulti) {
+        osmid_t id;
+        while (id_tracker::is_valid((id = omulti->ways_pending_tracker.pop_mark()))) {
+            ways_pending_tracker.mark(id);
+        }
+    }
+}
+
 void output_multi_t::merge_pending_relations(output_t *other)
 {
     auto *omulti = dynamic_cast<output_multi_t *>(other);
@@ -16,9 +16,12 @@
 #include <cstddef>
 #include <string>
 #include <memory>
+#include <vector>
 
 class table_t;
 class tagtransform;
+class way_filter_cache_t;
+struct multi_group_t;
 struct export_list;
 struct middle_query_t;
 struct options_t;
@@ -36,10 +39,14 @@ public:
 
     int start();
     void stop();
+    void schedule_stop(index_scheduler_t &scheduler);
     void commit();
+    void changes_done(const std::string &expire_filename);
 
     void enqueue_ways(pending_queue_t &job_queue, osmid_t id, size_t output_id, size_t& added);
     int pending_way(osmid_t id, int exists);
+    int pending_way_fetched(osmid_t id, const taglist_t &tags,
+                            const nodelist_t &nodes, int exists);
 
     void enqueue_relations(pending_queue_t &job_queue, osmid_t id, size_t output_id, size_t& added);
     int pending_relation(osmid_t id, int exists);
@@ -58,9 +65,19 @@ public:
 
     size_t pending_count() const;
 
+    void merge_pending_ways(output_t *other);
     void merge_pending_relations(output_t *other);
     void merge_expire_trees(output_t *other);
 
+    /**
+     * Let the outputs of one multi config share the work on an object
+     * which doesn't depend on the table: the node locations of a way are
+     * only looked up once and a Lua function used by several tables only
+     * runs once. The outputs must be handed every object in this order.
+     * Their caches of tag transform results also share one memory budget.
+     */
+    static void share_work(const std::vector<std::shared_ptr<output_multi_t> > &outputs);
+
 protected:
 
     void delete_from_output(osmid_t id);
@@ -70,6 +87,10 @@ protected:
     int process_relation(osmid_t id, const memberlist_t &members, const taglist_t &tags, bool exists, bool pending=false);
     void copy_node_to_table(osmid_t id, const std::string &geom, taglist_t &tags);
     void copy_to_table(const osmid_t id, const geometry_builder::pg_geom_t &geom, taglist_t &tags, int polygon);
+    void start_object(OsmType type, osmid_t id);
+    unsigned filter_tags(OsmType type, osmid_t id, const taglist_t &tags,
+                         int *polygon, int *roads, taglist_t &out_tags);
+    size_t set_way_nodes(osmid_t id, const idlist_t &nodes);
 
     std::unique_ptr<tagtransform> m_tagtransform;
     std::unique_ptr<export_list> m_export_list;
@@ -78,9 +99,15 @@ protected:
     std::unique_ptr<table_t> m_table;
     id_tracker ways_pending_tracker, rels_pending_tracker;
     std::shared_ptr<id_tracker> ways_done_tracker;
+    std::shared_ptr<way_filter_cache_t> m_way_filter_cache;
     expire_tiles m_expire;
     way_helper m_way_helper;
     relation_helper m_relation_helper;
+
+    std::shared_ptr<multi_group_t> m_group;
+    size_t m_group_index;
+    // where the result of the node and way transform is shared, -1 if not
+    int m_node_slot, m_way_slot;
 };
 
 #endif
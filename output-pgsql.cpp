@@ -6,7 +6,6 @@
  * emit the final geometry-enabled output formats
 */
 
-#include <future>
 #include <iostream>
 #include <limits>
 #include <memory>
@@ -178,8 +177,12 @@ int output_pgsql_t::pgsql_out_relation(osmid_t id, const taglist_t &rel_tags,
         for (size_t i=0; i < xid.size(); i++) {
             if (members_superseeded[i]) {
                 pgsql_delete_way_from_output(xid[i]);
-                if(!pending)
+                if(!pending) {
                     ways_done_tracker->mark(xid[i]);
+                    if (m_way_filter_cache) {
+                        m_way_filter_cache->remove(xid[i]);
+                    }
+                }
             }
         }
     }
@@ -219,20 +222,23 @@ void output_pgsql_t::enqueue_ways(pending_queue_t &job_queue, osmid_t id, size_t
         added++;
     }
 
-    //grab the first one or bail if its not valid
-    osmid_t popped = ways_pending_tracker.pop_mark();
-    if(!id_tracker::is_valid(popped))
-        return;
-
     //get all the ones up to the id that was passed in
-    while (popped < id) {
-        if (!ways_done_tracker->is_marked(popped)) {
-            job_queue.push(pending_job_t(popped, output_id));
-            added++;
+    idlist_t popped_ids;
+    while (ways_pending_tracker.pop_marks_before(id, popped_ids, PENDING_BATCH) > 0) {
+        for (osmid_t popped : popped_ids) {
+            if (!ways_done_tracker->is_marked(popped)) {
+                job_queue.push(pending_job_t(popped, output_id));
+                added++;
+            }
         }
-        popped = ways_pending_tracker.pop_mark();
+        popped_ids.clear();
     }
 
+    //grab the next one or bail if its not valid
+    osmid_t popped = ways_pending_tracker.pop_mark();
+    if(!id_tracker::is_valid(popped))
+        return;
+
     //make sure to get this one as well and move to the next
     if(popped > id) {
         if (!ways_done_tracker->is_marked(popped) && id_tracker::is_valid(popped)) {
@@ -248,27 +254,39 @@ int output_pgsql_t::pending_way(osmid_t id, int exists) {
 
     // Try to fetch the way from the DB
     if (m_mid->ways_get(id, tags_int, nodes_int)) {
-        /* If the flag says this object may exist already, delete it first */
-        if (exists) {
-            pgsql_delete_way_from_output(id);
-            // TODO: this now only has an effect when called from the iterate_ways
-            // call-back, so we need some alternative way to trigger this within
-            // osmdata_t.
-            const idlist_t rel_ids = m_mid->relations_using_way(id);
-            for (auto &mid: rel_ids) {
-                rels_pending_tracker.mark(mid);
-            }
-        }
+        return pending_way_fetched(id, tags_int, nodes_int, exists);
+    }
+
+    return 0;
+}
 
-        taglist_t outtags;
-        int polygon;
-        int roads;
-        if (!m_tagtransform->filter_way_tags(tags_int, &polygon, &roads,
-                                            *m_export_list.get(), outtags)) {
-            return pgsql_out_way(id, outtags, nodes_int, polygon, roads);
+int output_pgsql_t::pending_way_fetched(osmid_t id, const taglist_t &tags,
+                                        const nodelist_t &nodes, int exists)
+{
+    /* If the flag says this object may exist already, delete it first */
+    if (exists) {
+        pgsql_delete_way_from_output(id);
+        // TODO: this now only has an effect when called from the iterate_ways
+        // call-back, so we need some alternative way to trigger this within
+        // osmdata_t.
+        const idlist_t rel_ids = m_mid->relations_using_way(id);
+        for (auto &mid: rel_ids) {
+            rels_pending_tracker.mark(mid);
         }
     }
 
+    taglist_t outtags;
+    int polygon;
+    int roads;
+    // the way was run through the tag transform already when it was added
+    if (m_way_filter_cache && m_way_filter_cache->take(id, outtags, &polygon, &roads)) {
+        return pgsql_out_way(id, outtags, nodes, polygon, roads);
+    }
+    if (!m_tagtransform->filter_way_tags(tags, &polygon, &roads,
+                                        *m_export_list.get(), outtags)) {
+        return pgsql_out_way(id, outtags, nodes, polygon, roads);
+    }
+
     return 0;
 }
 
@@ -288,18 +306,21 @@ void output_pgsql_t::enqueue_relations(pending_queue_t &job_queue, osmid_t id, s
         added++;
     }
 
-    //grab the first one or bail if its not valid
+    //get all the ones up to the id that was passed in
+    idlist_t popped_ids;
+    while (rels_pending_tracker.pop_marks_before(id, popped_ids, PENDING_BATCH) > 0) {
+        for (osmid_t popped : popped_ids) {
+            job_queue.push(pending_job_t(popped, output_id));
+        }
+        added += popped_ids.size();
+        popped_ids.clear();
+    }
+
+    //grab the next one or bail if its not valid
     osmid_t popped = rels_pending_tracker.pop_mark();
     if(!id_tracker::is_valid(popped))
         return;
 
-    //get all the ones up to the id that was passed in
-    while (popped < id) {
-        job_queue.push(pending_job_t(popped, output_id));
-        added++;
-        popped = rels_pending_tracker.pop_mark();
-    }
-
     //make sure to get this one as well and move to the next
     if(popped > id) {
         if(id_tracker::is_valid(popped)) {
@@ -329,27 +350,29 @@ void output_pgsql_t::commit()
     }
 }
 
-void output_pgsql_t::stop()
+void output_pgsql_t::changes_done(const std::string &expire_filename)
 {
-    if (m_options.parallel_indexing) {
-      std::vector<std::future<void>> outs;
-      outs.reserve(m_tables.size());
+    if (m_options.expire_tiles_zoom_min >= 0) {
+        expire.output_and_destroy(expire_filename.c_str(),
+                                  m_options.expire_tiles_zoom_min);
+    }
 
-      for (auto &t : m_tables) {
-          outs.push_back(std::async(std::launch::async, &table_t::stop, t));
-      }
+    for (const auto &t : m_tables) {
+        t->begin();
+    }
+}
 
-      // XXX If one of the stop functions throws an error, this collects all
-      //     the other threads first before exiting. That might take a very
-      //     long time if large indexes are created.
-      for (auto &f : outs) {
-        f.get();
-      }
+void output_pgsql_t::stop()
+{
+    index_scheduler_t scheduler(m_options.index_procs);
+    schedule_stop(scheduler);
+    scheduler.run();
+}
 
-    } else {
-      for (const auto &t : m_tables) {
-        t->stop();
-      }
+void output_pgsql_t::schedule_stop(index_scheduler_t &scheduler)
+{
+    for (const auto &t : m_tables) {
+        t->schedule_stop(scheduler);
     }
 
     if (m_options.expire_tiles_zoom_min >= 0) {
@@ -377,7 +400,12 @@ int output_pgsql_t::way_add(osmid_t id, const idlist_t &nds, const taglist_t &ta
 
   /* If this isn't a polygon then it can not be part of a multipolygon
      Hence only polygons are "pending" */
-  if (!filter && polygon) { ways_pending_tracker.mark(id); }
+  if (!filter && polygon) {
+      ways_pending_tracker.mark(id);
+      if (m_way_filter_cache) {
+          m_way_filter_cache->add(id, outtags, polygon, roads);
+      }
+  }
 
   if( !polygon && !filter )
   {
@@ -428,8 +456,11 @@ int output_pgsql_t::pgsql_process_relation(osmid_t id, const memberlist_t &membe
               //shares any kind of tag transform and therefore all original tags
               //will come back and need to be filtered by individual outputs before
               //using these ways
-              m_tagtransform->filter_way_tags(xtags2[i], &polygon, &roads,
-                                              *m_export_list.get(), xtags[i]);
+              if (!m_way_filter_cache ||
+                  !m_way_filter_cache->get(xid[i], xtags[i], &polygon, &roads)) {
+                  m_tagtransform->filter_way_tags(xtags2[i], &polygon, &roads,
+                                                  *m_export_list.get(), xtags[i]);
+              }
               //TODO: if the filter says that this member is now not interesting we
               //should decrement the count and remove his nodes and tags etc. for
               //now we'll just keep him with no tags so he will get filtered later
@@ -504,6 +535,9 @@ int output_pgsql_t::way_delete(osmid_t osm_id)
         util::exit_nicely();
     }
     pgsql_delete_way_from_output(osm_id);
+    if (m_way_filter_cache) {
+        m_way_filter_cache->remove(osm_id);
+    }
     return 0;
 }
 
@@ -609,6 +643,12 @@ output_pgsql_t::output_pgsql_t(const middle_query_t* mid, const options_t &o)
         util::exit_nicely();
     }
 
+    // only worth it when the transform is expensive
+    if (m_options.tag_transform_script && m_options.tag_transform_cache > 0) {
+        m_way_filter_cache.reset(new way_filter_cache_t(
+            size_t(m_options.tag_transform_cache) * 1024 * 1024));
+    }
+
     //for each table
     m_tables.reserve(t_MAX);
     for (int i = 0; i < t_MAX; i++) {
@@ -653,6 +693,9 @@ output_pgsql_t::output_pgsql_t(const middle_query_t* mid, const options_t &o)
                 m_options.enable_hstore_index, m_options.tblsmain_data, m_options.tblsmain_index
             )
         ));
+        if (m_options.client_sort_dir) {
+            m_tables.back()->enable_client_sort(*m_options.client_sort_dir, m_options.projection);
+        }
     }
 }
 
@@ -664,7 +707,8 @@ output_pgsql_t::output_pgsql_t(const output_pgsql_t& other):
     reproj(other.reproj),
     //NOTE: we need to know which ways were used by relations so each thread
     //must have a copy of the original marked done ways, its read only so its ok
-    ways_done_tracker(other.ways_done_tracker)
+    ways_done_tracker(other.ways_done_tracker),
+    m_way_filter_cache(other.m_way_filter_cache)
 {
     builder.set_exclude_broken_polygon(m_options.excludepoly);
     if (m_options.reproject_area) builder.set_reprojection(reproj.get());
@@ -681,6 +725,17 @@ size_t output_pgsql_t::pending_count() const {
     return ways_pending_tracker.size() + rels_pending_tracker.size();
 }
 
+void output_pgsql_t::merge_pending_ways(output_t *other)
+{
+    auto opgsql = dynamic_cast<output_pgsql_t *>(other);
+    if (opgsql) {
+        osmid_t id;
+        while (id_tracker::is_valid((id = opgsql->ways_pending_tracker.pop_mark()))) {
+            ways_pending_tracker.mark(id);
+        }
+    }
+}
+
 void output_pgsql_t::merge_pending_relations(output_t *other)
 {
     auto opgsql = dynamic_cast<output_pgsql_t *>(other);
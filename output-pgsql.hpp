@@ -13,6 +13,7 @@
 #include "expire-tiles.hpp"
 #include "id-tracker.hpp"
 #include "table.hpp"
+#include "way-filter-cache.hpp"
 
 #include <vector>
 #include <memory>
@@ -31,10 +32,14 @@ public:
 
     int start();
     void stop();
+    void schedule_stop(index_scheduler_t &scheduler);
     void commit();
+    void changes_done(const std::string &expire_filename);
 
     void enqueue_ways(pending_queue_t &job_queue, osmid_t id, size_t output_id, size_t& added);
     int pending_way(osmid_t id, int exists);
+    int pending_way_fetched(osmid_t id, const taglist_t &tags,
+                            const nodelist_t &nodes, int exists);
 
     void enqueue_relations(pending_queue_t &job_queue, osmid_t id, size_t output_id, size_t& added);
     int pending_relation(osmid_t id, int exists);
@@ -53,6 +58,7 @@ public:
 
     size_t pending_count() const;
 
+    void merge_pending_ways(output_t *other);
     void merge_pending_relations(output_t *other);
     void merge_expire_trees(output_t *other);
 
@@ -85,6 +91,8 @@ protected:
 
     id_tracker ways_pending_tracker, rels_pending_tracker;
     std::shared_ptr<id_tracker> ways_done_tracker;
+    // tag transform results of pending ways, shared by all clones
+    std::shared_ptr<way_filter_cache_t> m_way_filter_cache;
 };
 
 #endif
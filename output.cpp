@@ -1,4 +1,5 @@
 #include "output.hpp"
+#include "index-scheduler.hpp"
 #include "output-pgsql.hpp"
 #include "output-gazetteer.hpp"
 #include "output-null.hpp"
@@ -25,7 +26,7 @@ void override_if(T &t, const std::string &key, const pt::ptree &conf) {
     }
 }
 
-std::shared_ptr<output_t> parse_multi_single(const pt::ptree &conf,
+std::shared_ptr<output_multi_t> parse_multi_single(const pt::ptree &conf,
                              const middle_query_t *mid,
                              const options_t &options) {
     options_t new_opts = options;
@@ -82,7 +83,7 @@ std::shared_ptr<output_t> parse_multi_single(const pt::ptree &conf,
 }
 
 std::vector<std::shared_ptr<output_t> > parse_multi_config(const middle_query_t *mid, const options_t &options) {
-    std::vector<std::shared_ptr<output_t> > outputs;
+    std::vector<std::shared_ptr<output_multi_t> > outputs;
 
     if (!options.style.empty()) {
         const std::string file_name(options.style);
@@ -94,6 +95,7 @@ std::vector<std::shared_ptr<output_t> > parse_multi_config(const middle_query_t
             for (const pt::ptree::value_type &val: conf) {
                 outputs.push_back(parse_multi_single(val.second, mid, options));
             }
+            output_multi_t::share_work(outputs);
 
         } catch (const std::exception &e) {
             throw std::runtime_error((boost::format("Unable to parse multi config file `%1%': %2%")
@@ -103,7 +105,7 @@ std::vector<std::shared_ptr<output_t> > parse_multi_config(const middle_query_t
         throw std::runtime_error("Style file is required for `multi' backend, but was not specified.");
     }
 
-    return outputs;
+    return std::vector<std::shared_ptr<output_t> >(outputs.begin(), outputs.end());
 }
 
 } // anonymous namespace
@@ -146,7 +148,22 @@ const options_t *output_t::get_options() const
     return &m_options;
 }
 
+int output_t::pending_way_fetched(osmid_t id, const taglist_t &, const nodelist_t &,
+                                  int exists)
+{
+    return pending_way(id, exists);
+}
+
+void output_t::merge_pending_ways(output_t*) {}
+
 void output_t::merge_pending_relations(output_t*) {}
 
 void output_t::merge_expire_trees(output_t*) {}
 
+void output_t::schedule_stop(index_scheduler_t &scheduler)
+{
+    index_scheduler_t::job_t job("output", 0);
+    job.add_step("Stopping output", [this]() { stop(); });
+    scheduler.add(std::move(job));
+}
+
@@ -18,6 +18,7 @@
 
 struct expire_tiles;
 struct id_tracker;
+class index_scheduler_t;
 struct middle_query_t;
 
 struct pending_job_t {
@@ -30,6 +31,9 @@ struct pending_job_t {
 
 typedef std::stack<pending_job_t> pending_queue_t;
 
+/// Number of pending ids taken out of an id_tracker at once when enqueuing.
+#define PENDING_BATCH 4096
+
 class output_t : public boost::noncopyable {
 public:
     static std::vector<std::shared_ptr<output_t> > create_outputs(const middle_query_t *mid, const options_t &options);
@@ -41,10 +45,30 @@ public:
 
     virtual int start() = 0;
     virtual void stop() = 0;
+    /**
+     * Queue the work of stop() in the scheduler, so that it can run in
+     * parallel with the other outputs and the middle. By default stop()
+     * is queued as a whole.
+     */
+    virtual void schedule_stop(index_scheduler_t &scheduler);
     virtual void commit() = 0;
+    /**
+     * Called after each change file when several are applied in one run
+     * (see --watch-dir), once the pending objects are processed. Writes
+     * out what belongs to the change file, the expire list is added to
+     * expire_filename, and gets ready for the next one.
+     */
+    virtual void changes_done(const std::string &expire_filename) {}
 
     virtual void enqueue_ways(pending_queue_t &job_queue, osmid_t id, size_t output_id, size_t& added) = 0;
     virtual int pending_way(osmid_t id, int exists) = 0;
+    /**
+     * Process a pending way which the caller already fetched from the
+     * middle. The default implementation fetches it again through
+     * pending_way().
+     */
+    virtual int pending_way_fetched(osmid_t id, const taglist_t &tags,
+                                    const nodelist_t &nodes, int exists);
 
     virtual void enqueue_relations(pending_queue_t &job_queue, osmid_t id, size_t output_id, size_t& added) = 0;
     virtual int pending_relation(osmid_t id, int exists) = 0;
@@ -65,6 +89,7 @@ public:
 
     const options_t *get_options() const;
 
+    virtual void merge_pending_ways(output_t *other);
     virtual void merge_pending_relations(output_t *other);
     virtual void merge_expire_trees(output_t *other);
 
@@ -22,11 +22,14 @@
 
 #include <boost/format.hpp>
 
+#include "node-ram-cache.hpp"
 #include "parse-osmium.hpp"
 #include "reprojection.hpp"
 #include "osmdata.hpp"
 
 #include <osmium/io/any_input.hpp>
+#include <osmium/object_pointer_collection.hpp>
+#include <osmium/osm/object_comparisons.hpp>
 #include <osmium/handler.hpp>
 #include <osmium/visitor.hpp>
 #include <osmium/osm.hpp>
@@ -79,8 +82,9 @@ void parse_stats_t::print_status() const
 parse_osmium_t::parse_osmium_t(bool extra_attrs,
                                const boost::optional<std::string> &bbox,
                                const reprojection *proj, bool do_append,
-                               osmdata_t *osmdata)
-: m_data(osmdata), m_append(do_append), m_attributes(extra_attrs), m_proj(proj)
+                               osmdata_t *osmdata, bool locations_on_ways)
+: m_data(osmdata), m_append(do_append), m_attributes(extra_attrs), m_proj(proj),
+  m_locations_on_ways(locations_on_ways), m_warned_locations(false)
 {
     if (bbox) {
         m_bbox = parse_bbox(bbox);
@@ -106,7 +110,7 @@ osmium::Box parse_osmium_t::parse_bbox(const boost::optional<std::string> &bbox)
     return osmium::Box(minx, miny, maxx, maxy);
 }
 
-void parse_osmium_t::stream_file(const std::string &filename, const std::string &fmt)
+osmium::io::File parse_osmium_t::open_file(const std::string &filename, const std::string &fmt)
 {
     const char* osmium_format = fmt == "auto" ? "" : fmt.c_str();
     osmium::io::File infile(filename, osmium_format);
@@ -119,11 +123,73 @@ void parse_osmium_t::stream_file(const std::string &filename, const std::string
 
     fprintf(stderr, "Using %s parser.\n", osmium::io::as_string(infile.format()));
 
-    osmium::io::Reader reader(infile);
+    return infile;
+}
+
+void parse_osmium_t::stream_file(const std::string &filename, const std::string &fmt)
+{
+    osmium::io::Reader reader(open_file(filename, fmt));
     osmium::apply(reader, *this);
     reader.close();
 }
 
+bool parse_osmium_t::is_change_file(const std::string &filename, const std::string &fmt)
+{
+    osmium::io::File infile(filename, fmt == "auto" ? "" : fmt.c_str());
+    return infile.has_multiple_object_versions();
+}
+
+void parse_osmium_t::stream_changes(const std::vector<std::string> &filenames,
+                                    const std::string &fmt)
+{
+    // the objects point into the buffers, which have to be kept until
+    // everything is applied
+    std::vector<osmium::memory::Buffer> buffers;
+    osmium::ObjectPointerCollection objects;
+
+    for (auto const &filename : filenames) {
+        osmium::io::Reader reader(open_file(filename, fmt),
+                                  osmium::osm_entity_bits::object);
+        while (osmium::memory::Buffer buffer = reader.read()) {
+            osmium::apply(buffer, objects);
+            buffers.push_back(std::move(buffer));
+        }
+        reader.close();
+    }
+
+    // the newest version of an object comes first
+    objects.sort(osmium::object_order_type_id_reverse_version());
+
+    size_t applied = 0;
+    osmium::item_type prev_type = osmium::item_type::undefined;
+    osmium::object_id_type prev_id = 0;
+    for (auto &object : objects) {
+        if (object.type() == prev_type && object.id() == prev_id) {
+            continue;
+        }
+        prev_type = object.type();
+        prev_id = object.id();
+        ++applied;
+
+        switch (object.type()) {
+            case osmium::item_type::node:
+                node(static_cast<osmium::Node &>(object));
+                break;
+            case osmium::item_type::way:
+                way(static_cast<osmium::Way &>(object));
+                break;
+            case osmium::item_type::relation:
+                relation(static_cast<osmium::Relation &>(object));
+                break;
+            default:
+                break;
+        }
+    }
+
+    fprintf(stderr, "Merged %zu changed objects from %zu files into %zu.\n",
+            objects.size(), filenames.size(), applied);
+}
+
 void parse_osmium_t::node(osmium::Node& node)
 {
     if (node.deleted()) {
@@ -209,9 +275,37 @@ void parse_osmium_t::convert_nodes(const osmium::NodeRefList &in_nodes)
 {
     nds.clear();
 
+    if (!m_locations_on_ways) {
+        for (auto const &n : in_nodes) {
+            nds.push_back(n.ref());
+        }
+        return;
+    }
+
+#ifdef FIXED_POINT
+    // The list gets the locations instead of the ids, which the middle
+    // hands back from nodes_get_list(). Nodes without a location or
+    // outside the bounding box are left out, as if they were not in the
+    // node cache.
+    bool has_locations = false;
     for (auto const &n : in_nodes) {
-        nds.push_back(n.ref());
+        if (!n.location().valid()) {
+            continue;
+        }
+        has_locations = true;
+        if (!m_bbox || m_bbox->contains(n.location())) {
+            auto c = m_proj->reproject(n.location());
+            nds.push_back(ramNode(c.x, c.y).packed());
+        }
+    }
+
+    // ways outside of --bbox have locations, they are just left out
+    if (!has_locations && !in_nodes.empty() && !m_warned_locations) {
+        fprintf(stderr, "WARNING: Way has no node locations. Was the input "
+                "prepared with 'osmium add-locations-to-ways'?\n");
+        m_warned_locations = true;
     }
+#endif
 }
 
 void parse_osmium_t::convert_members(const osmium::RelationMemberList &in_rels)
@@ -27,12 +27,15 @@
 
 #include <boost/optional.hpp>
 #include <ctime>
+#include <string>
+#include <vector>
 
 #include "osmtypes.hpp"
 
 #include <osmium/osm/box.hpp>
 #include <osmium/fwd.hpp>
 #include <osmium/handler.hpp>
+#include <osmium/io/file.hpp>
 
 
 class reprojection;
@@ -107,10 +110,26 @@ class parse_osmium_t: public osmium::handler::Handler
 {
 public:
     parse_osmium_t(bool extra_attrs, const boost::optional<std::string> &bbox,
-                   const reprojection *proj, bool do_append, osmdata_t *osmdata);
+                   const reprojection *proj, bool do_append, osmdata_t *osmdata,
+                   bool locations_on_ways = false);
 
     void stream_file(const std::string &filename, const std::string &fmt);
 
+    /**
+     * Read all the change files first and apply only the newest version of
+     * each object, so that objects changed in several of them are written
+     * once. The objects are applied ordered by type and id. All objects of
+     * all files are kept in memory until they are applied.
+     */
+    void stream_changes(const std::vector<std::string> &filenames,
+                        const std::string &fmt);
+
+    /// True if the file can have several versions of an object (a change file).
+    static bool is_change_file(const std::string &filename, const std::string &fmt);
+
+    /// Set up the input file, checking that its format is known.
+    static osmium::io::File open_file(const std::string &filename, const std::string &fmt);
+
     void node(osmium::Node& node);
     void way(osmium::Way& way);
     void relation(osmium::Relation& rel);
@@ -120,7 +139,12 @@ public:
         return m_stats;
     }
 
-private:
+    boost::optional<osmium::Box> const &bbox() const
+    {
+        return m_bbox;
+    }
+
+protected:
     void convert_tags(const osmium::OSMObject &obj);
     void convert_nodes(const osmium::NodeRefList &in_nodes);
     void convert_members(const osmium::RelationMemberList &in_rels);
@@ -133,6 +157,8 @@ private:
     bool m_attributes;
     const reprojection *m_proj;
     parse_stats_t m_stats;
+    bool m_locations_on_ways;
+    bool m_warned_locations;
 
     /* Since {node,way} elements are not nested we can guarantee that
        elements are parsed sequentially and can therefore be cached.
@@ -0,0 +1,496 @@
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+
+#include "middle.hpp"
+#include "node-ram-cache.hpp"
+#include "options.hpp"
+#include "osmdata.hpp"
+#include "output.hpp"
+#include "parse-pipeline.hpp"
+#include "reprojection.hpp"
+
+#include <osmium/io/any_input.hpp>
+#include <osmium/handler.hpp>
+#include <osmium/visitor.hpp>
+#include <osmium/osm.hpp>
+
+namespace {
+
+typedef std::shared_ptr<osmium::memory::Buffer> buffer_ptr;
+typedef std::vector<std::shared_ptr<output_t> > output_vec_t;
+
+const char *unsorted_msg = "Parallel parsing needs sorted input (nodes, then "
+                           "ways, then relations). Try --parse-processes 1.";
+
+/**
+ * Bounded queue of input buffers between the reader and a stage.
+ */
+class buffer_queue_t
+{
+public:
+    explicit buffer_queue_t(size_t max_size)
+    : m_max_size(max_size), m_done(false)
+    {}
+
+    /**
+     * Add a buffer, waiting while the queue is full.
+     * \return false if the queue has been shut down
+     */
+    bool push(buffer_ptr const &buffer)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_not_full.wait(lock, [this] { return m_done || m_queue.size() < m_max_size; });
+        if (m_done) {
+            return false;
+        }
+        m_queue.push_back(buffer);
+        m_not_empty.notify_one();
+        return true;
+    }
+
+    /**
+     * Take the next buffer, waiting while the queue is empty.
+     * \return false once the queue has been shut down and is empty
+     */
+    bool pop(buffer_ptr &buffer)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_not_empty.wait(lock, [this] { return m_done || !m_queue.empty(); });
+        if (m_queue.empty()) {
+            return false;
+        }
+        buffer = m_queue.front();
+        m_queue.pop_front();
+        m_not_full.notify_one();
+        return true;
+    }
+
+    /// No more buffers will come, consumers finish the ones queued.
+    void finish()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_done = true;
+        m_not_empty.notify_all();
+        m_not_full.notify_all();
+    }
+
+    /// Drop all queued buffers, so that producer and consumers stop.
+    void abort()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queue.clear();
+        m_done = true;
+        m_not_empty.notify_all();
+        m_not_full.notify_all();
+    }
+
+private:
+    size_t m_max_size;
+    bool m_done;
+    std::deque<buffer_ptr> m_queue;
+    std::mutex m_mutex;
+    std::condition_variable m_not_empty;
+    std::condition_variable m_not_full;
+};
+
+/**
+ * State shared between the threads working on one input file.
+ */
+struct pipeline_state_t
+{
+    explicit pipeline_state_t(size_t queue_size)
+    : middle_queue(queue_size), work_queue(queue_size),
+      nodes_done(false), failed(false)
+    {}
+
+    /// Called by the middle thread once all nodes are stored.
+    void set_nodes_done()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        nodes_done = true;
+        nodes_cond.notify_all();
+    }
+
+    /// Called by the workers before they ask the middle for node locations.
+    void wait_for_nodes()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        nodes_cond.wait(lock, [this] { return nodes_done || failed; });
+        if (failed) {
+            throw std::runtime_error("Parsing stopped because of an earlier error.");
+        }
+    }
+
+    /// Stop all threads after an error.
+    void abort()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            failed = true;
+            nodes_cond.notify_all();
+        }
+        middle_queue.abort();
+        work_queue.abort();
+    }
+
+    buffer_queue_t middle_queue;
+    buffer_queue_t work_queue;
+
+    std::mutex mutex;
+    std::condition_variable nodes_cond;
+    bool nodes_done;
+    bool failed;
+
+    //serialises merging the worker outputs back into the originals
+    std::mutex merge_mutex;
+};
+
+/**
+ * Stores nodes and ways in the middle in input order.
+ */
+class middle_stage_t : public parse_osmium_t
+{
+public:
+    middle_stage_t(const options_t &options, middle_t *mid, pipeline_state_t &state)
+    : parse_osmium_t(options.extra_attributes, options.bbox,
+                     options.projection.get(), false, nullptr,
+                     options.locations_on_ways),
+      m_mid(mid), m_state(state), m_nodes_done(false)
+    {}
+
+    void node(osmium::Node &node)
+    {
+        if (m_nodes_done) {
+            throw std::runtime_error(unsorted_msg);
+        }
+
+        // deleted objects only appear in change files, which are
+        // never parsed in parallel
+        if (node.deleted()) {
+            return;
+        }
+
+        if (!node.location().valid()) {
+          fprintf(stderr, "WARNING: Node %" PRIdOSMID " (version %ud) has an invalid "
+                  "location and has been ignored. This is not expected to happen with "
+                  "recent planet files, so please check that your input is correct.\n",
+                  node.id(), node.version());
+
+          return;
+        }
+
+        if (!m_bbox || m_bbox->contains(node.location())) {
+            auto c = m_proj->reproject(node.location());
+
+            convert_tags(node);
+            m_mid->nodes_set(node.id(), c.y, c.x, tags);
+            m_stats.add_node(node.id());
+        }
+    }
+
+    void way(osmium::Way &way)
+    {
+        if (!m_nodes_done) {
+            m_mid->flush_nodes();
+            m_state.set_nodes_done();
+            m_nodes_done = true;
+        }
+
+        if (!way.deleted()) {
+            convert_tags(way);
+            convert_nodes(way.nodes());
+            m_mid->ways_set(way.id(), nds, tags);
+        }
+        m_stats.add_way(way.id());
+    }
+
+private:
+    middle_t *m_mid;
+    pipeline_state_t &m_state;
+    bool m_nodes_done;
+};
+
+/**
+ * Hands nodes and ways to a private set of output clones.
+ *
+ * Nodes don't need the middle, so they are written through clones which
+ * use the main middle. Before the first way, these are committed and new
+ * clones are made which query a middle instance of their own.
+ */
+class output_stage_t : public parse_osmium_t
+{
+public:
+    output_stage_t(const options_t &options, const parse_osmium_t &mid_stage,
+                   middle_t *mid, const output_vec_t &outs,
+                   pipeline_state_t &state)
+    : parse_osmium_t(options.extra_attributes, boost::none,
+                     options.projection.get(), false, nullptr,
+                     options.locations_on_ways),
+      m_mid(mid), m_originals(outs), m_state(state), m_ways_started(false)
+    {
+        m_bbox = mid_stage.bbox();
+    }
+
+    void node(osmium::Node &node)
+    {
+        if (node.deleted() || !node.location().valid()
+            || (m_bbox && !m_bbox->contains(node.location()))) {
+            return;
+        }
+
+        if (m_outs.empty()) {
+            clone_outputs(m_mid);
+        }
+
+        auto c = m_proj->reproject(node.location());
+        // guarantee that we use the same values as in the node cache
+        ramNode n(c.x, c.y);
+
+        convert_tags(node);
+        for (auto &out : m_outs) {
+            out->node_add(node.id(), n.lat(), n.lon(), tags);
+        }
+    }
+
+    void way(osmium::Way &way)
+    {
+        if (!m_ways_started) {
+            m_state.wait_for_nodes();
+            finish();
+            m_mid_instance = m_mid->get_instance();
+            clone_outputs(m_mid_instance.get());
+            m_ways_started = true;
+        }
+
+        if (way.deleted()) {
+            return;
+        }
+
+        convert_tags(way);
+        convert_nodes(way.nodes());
+        for (auto &out : m_outs) {
+            out->way_add(way.id(), nds, tags);
+        }
+    }
+
+    /**
+     * Commit the work of the clones and merge what they collected
+     * (pending ways, expired tiles) back into the original outputs.
+     */
+    void finish()
+    {
+        if (m_outs.empty()) {
+            return;
+        }
+
+        for (auto &out : m_outs) {
+            out->commit();
+        }
+
+        std::lock_guard<std::mutex> lock(m_state.merge_mutex);
+        for (size_t i = 0; i < m_outs.size(); ++i) {
+            m_originals[i]->merge_pending_ways(m_outs[i].get());
+            m_originals[i]->merge_expire_trees(m_outs[i].get());
+        }
+        m_outs.clear();
+    }
+
+private:
+    void clone_outputs(const middle_query_t *mid)
+    {
+        for (auto const &out : m_originals) {
+            m_outs.push_back(out->clone(mid));
+        }
+    }
+
+    middle_t *m_mid;
+    std::shared_ptr<const middle_query_t> m_mid_instance;
+    const output_vec_t &m_originals;
+    output_vec_t m_outs;
+    pipeline_state_t &m_state;
+    bool m_ways_started;
+};
+
+/// Passes only relations on to the serial parser.
+struct relation_handler_t : public osmium::handler::Handler
+{
+    explicit relation_handler_t(parse_osmium_t &parser) : m_parser(parser) {}
+
+    void relation(osmium::Relation &rel)
+    {
+        m_parser.relation(rel);
+    }
+
+private:
+    parse_osmium_t &m_parser;
+};
+
+void run_middle(middle_stage_t &stage, pipeline_state_t &state)
+{
+    try {
+        buffer_ptr buffer;
+        while (state.middle_queue.pop(buffer)) {
+            osmium::apply(*buffer, stage);
+        }
+    } catch (...) {
+        state.abort();
+        throw;
+    }
+}
+
+void run_worker(output_stage_t &stage, pipeline_state_t &state)
+{
+#ifdef _MSC_VER
+    // Avoid problems when GEOS WKT-related methods switch the locale
+    _configthreadlocale(_ENABLE_PER_THREAD_LOCALE);
+#endif
+    try {
+        buffer_ptr buffer;
+        while (state.work_queue.pop(buffer)) {
+            osmium::apply(*buffer, stage);
+        }
+        stage.finish();
+    } catch (...) {
+        state.abort();
+        throw;
+    }
+}
+
+} // anonymous namespace
+
+parse_pipeline_t::parse_pipeline_t(const options_t &options,
+                                   std::shared_ptr<middle_t> mid,
+                                   const std::vector<std::shared_ptr<output_t> > &outs)
+: m_options(options), m_mid(mid), m_outs(outs)
+{}
+
+void parse_pipeline_t::stream_file(const std::string &filename, const std::string &fmt)
+{
+    osmium::io::Reader reader(parse_osmium_t::open_file(filename, fmt));
+
+    // The output tables are created inside a transaction. It needs to be
+    // committed before the workers can COPY into them on their connections.
+    for (auto &out : m_outs) {
+        out->commit();
+    }
+
+    const size_t num_workers = m_options.parse_procs;
+    fprintf(stderr, "Using %zu parse processes\n", num_workers);
+
+    pipeline_state_t state(4 * num_workers);
+
+    middle_stage_t mid_stage(m_options, m_mid.get(), state);
+    std::vector<std::unique_ptr<output_stage_t> > stages;
+    for (size_t i = 0; i < num_workers; ++i) {
+        stages.emplace_back(new output_stage_t(m_options, mid_stage, m_mid.get(),
+                                               m_outs, state));
+    }
+
+    std::future<void> middle_worker = std::async(std::launch::async, run_middle,
+                                                 std::ref(mid_stage), std::ref(state));
+    std::vector<std::future<void>> workers;
+    for (auto &stage : stages) {
+        workers.push_back(std::async(std::launch::async, run_worker,
+                                     std::ref(*stage), std::ref(state)));
+    }
+
+    //relations go through the usual serial path on this thread
+    osmdata_t osmdata(m_mid, m_outs);
+    parse_osmium_t rel_parser(m_options.extra_attributes, boost::none,
+                              m_options.projection.get(), false, &osmdata);
+    relation_handler_t rel_handler(rel_parser);
+
+    try {
+        bool relations = false;
+        while (osmium::memory::Buffer input = reader.read()) {
+            auto buffer = std::make_shared<osmium::memory::Buffer>(std::move(input));
+
+            bool has_nodes_or_ways = false;
+            bool has_relations = false;
+            for (auto const &item : *buffer) {
+                if (item.type() == osmium::item_type::relation) {
+                    has_relations = true;
+                } else if (item.type() == osmium::item_type::node
+                           || item.type() == osmium::item_type::way) {
+                    has_nodes_or_ways = true;
+                }
+            }
+
+            if (has_nodes_or_ways) {
+                if (relations) {
+                    throw std::runtime_error(unsorted_msg);
+                }
+                if (!state.middle_queue.push(buffer) || !state.work_queue.push(buffer)) {
+                    break;
+                }
+            }
+
+            if (has_relations) {
+                if (!relations) {
+                    // Relations need all ways stored in the middle. They
+                    // also delete ways from the output tables, so the
+                    // workers must have committed their rows and merged
+                    // their pending ways before.
+                    state.middle_queue.finish();
+                    state.work_queue.finish();
+                    middle_worker.get();
+                    for (auto &w : workers) {
+                        w.get();
+                    }
+                    relations = true;
+                }
+                osmium::apply(*buffer, rel_handler);
+            }
+        }
+        reader.close();
+    } catch (...) {
+        state.abort();
+        if (middle_worker.valid()) {
+            middle_worker.wait();
+        }
+        for (auto &w : workers) {
+            if (w.valid()) {
+                w.wait();
+            }
+        }
+        throw;
+    }
+
+    state.middle_queue.finish();
+    state.work_queue.finish();
+
+    // wait for all threads, but report the first error only
+    std::exception_ptr error;
+    if (middle_worker.valid()) {
+        try {
+            middle_worker.get();
+        } catch (...) {
+            error = std::current_exception();
+        }
+    }
+    for (auto &w : workers) {
+        if (!w.valid()) {
+            continue;
+        }
+        try {
+            w.get();
+        } catch (...) {
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+
+    m_stats.update(mid_stage.stats());
+    m_stats.update(rel_parser.stats());
+}
@@ -0,0 +1,49 @@
+#ifndef PARSE_PIPELINE_H
+#define PARSE_PIPELINE_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "parse-osmium.hpp"
+
+struct middle_t;
+struct options_t;
+class output_t;
+
+/**
+ * Reads an input file with several threads.
+ *
+ * The buffers coming from the reader are handed to a dedicated middle
+ * thread, which stores nodes and ways in input order, and to a pool of
+ * workers, which run the tag transform, build the geometries and write
+ * them out. Each worker uses its own clones of the outputs and therefore
+ * its own COPY streams. A worker only starts on ways once the middle has
+ * seen all nodes. Relations are processed on the calling thread once the
+ * middle and all workers are done with the ways and the workers have
+ * committed their output.
+ *
+ * The input must be sorted (nodes, then ways, then relations). Only used
+ * on import.
+ */
+class parse_pipeline_t
+{
+public:
+    parse_pipeline_t(const options_t &options, std::shared_ptr<middle_t> mid,
+                     const std::vector<std::shared_ptr<output_t> > &outs);
+
+    void stream_file(const std::string &filename, const std::string &fmt);
+
+    parse_stats_t const &stats() const
+    {
+        return m_stats;
+    }
+
+private:
+    const options_t &m_options;
+    std::shared_ptr<middle_t> m_mid;
+    std::vector<std::shared_ptr<output_t> > m_outs;
+    parse_stats_t m_stats;
+};
+
+#endif
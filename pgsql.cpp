@@ -1,12 +1,48 @@
 /* Helper functions for the postgresql connections */
 #include "pgsql.hpp"
 
+#include <cerrno>
 #include <cstdio>
 #include <cstdlib>
 #include <cstdarg>
 #include <memory>
 #include <boost/format.hpp>
 
+#ifdef _WIN32
+#include <winsock2.h>
+#define poll WSAPoll
+#else
+#include <poll.h>
+#endif
+
+namespace {
+
+/* Wait until the socket of a connection in nonblocking mode can take more
+ * data. Anything the server sends meanwhile is read, so that it can't
+ * stall the connection. */
+void wait_for_socket(const char *context, PGconn *sql_conn)
+{
+    // poll() instead of select(), which can't take descriptors beyond
+    // FD_SETSIZE, and there may be many connections
+    struct pollfd fds;
+    fds.fd = PQsocket(sql_conn);
+    fds.events = POLLIN | POLLOUT;
+    fds.revents = 0;
+
+    if (poll(&fds, 1, -1) < 0) {
+        if (errno == EINTR) {
+            return;
+        }
+        throw std::runtime_error((boost::format("%1% - waiting for the database failed: %2%") % context % strerror(errno)).str());
+    }
+
+    if ((fds.revents & (POLLIN | POLLERR | POLLHUP)) && !PQconsumeInput(sql_conn)) {
+        throw std::runtime_error((boost::format("%1%: %2% - bad result during COPY") % PQerrorMessage(sql_conn) % context).str());
+    }
+}
+
+} // anonymous namespace
+
 void escape(const std::string &src, std::string &dst)
 {
     for (const char c: src) {
@@ -43,6 +79,19 @@ std::shared_ptr<PGresult> pgsql_exec_simple(PGconn *sql_conn, const ExecStatusTy
     return std::shared_ptr<PGresult>(res, &PQclear);
 }
 
+uint64_t pgsql_table_size(PGconn *sql_conn, const std::string &table)
+{
+    char *quoted = PQescapeLiteral(sql_conn, table.c_str(), table.size());
+    if (!quoted) {
+        throw std::runtime_error((boost::format("Quoting table name %1% failed: %2%") % table % PQerrorMessage(sql_conn)).str());
+    }
+    std::string sql = std::string("SELECT pg_total_relation_size(") + quoted + ")";
+    PQfreemem(quoted);
+
+    auto res = pgsql_exec_simple(sql_conn, PGRES_TUPLES_OK, sql);
+    return strtoull(PQgetvalue(res.get(), 0, 0), nullptr, 10);
+}
+
 int pgsql_exec(PGconn *sql_conn, const ExecStatusType expect, const char *fmt, ...)
 {
 
@@ -112,13 +161,34 @@ void pgsql_CopyData(const char *context, PGconn *sql_conn, std::string const &sq
     }
 }
 
-PGresult *pgsql_execPrepared( PGconn *sql_conn, const char *stmtName, const int nParams, const char *const * paramValues, const ExecStatusType expect)
+void pgsql_CopySend(const char *context, PGconn *sql_conn, std::string const &data)
+{
+#ifdef DEBUG_PGSQL
+    fprintf(stderr, "%s>>> %zu bytes\n", context, data.size());
+#endif
+    int r;
+    while ((r = PQputCopyData(sql_conn, data.c_str(), data.size())) == 0) {
+        wait_for_socket(context, sql_conn);
+    }
+    if (r < 0) {
+        throw std::runtime_error((boost::format("%1%: %2% - bad result during COPY") % PQerrorMessage(sql_conn) % context).str());
+    }
+
+    while ((r = PQflush(sql_conn)) == 1) {
+        wait_for_socket(context, sql_conn);
+    }
+    if (r < 0) {
+        throw std::runtime_error((boost::format("%1%: %2% - flushing COPY data failed") % PQerrorMessage(sql_conn) % context).str());
+    }
+}
+
+PGresult *pgsql_execPrepared( PGconn *sql_conn, const char *stmtName, const int nParams, const char *const * paramValues, const ExecStatusType expect, int resultFormat)
 {
 #ifdef DEBUG_PGSQL
     fprintf( stderr, "ExecPrepared: %s\n", stmtName );
 #endif
     //run the prepared statement
-    PGresult *res = PQexecPrepared(sql_conn, stmtName, nParams, paramValues, nullptr, nullptr, 0);
+    PGresult *res = PQexecPrepared(sql_conn, stmtName, nParams, paramValues, nullptr, nullptr, resultFormat);
     if(PQresultStatus(res) != expect)
     {
         std::string message = (boost::format("%1% failed: %2%(%3%)\n") % stmtName % PQerrorMessage(sql_conn) % PQresultStatus(res)).str();
@@ -7,12 +7,17 @@
 #define PGSQL_H
 
 #include <string>
+#include <cstdint>
 #include <cstring>
 #include <libpq-fe.h>
 #include <memory>
+#include <type_traits>
 
-PGresult *pgsql_execPrepared( PGconn *sql_conn, const char *stmtName, const int nParams, const char *const * paramValues, const ExecStatusType expect);
+PGresult *pgsql_execPrepared( PGconn *sql_conn, const char *stmtName, const int nParams, const char *const * paramValues, const ExecStatusType expect, int resultFormat = 0);
 void pgsql_CopyData(const char *context, PGconn *sql_conn, std::string const &sql);
+/* Send COPY data on a connection in nonblocking mode and wait until
+ * libpq has passed all of it to the socket. */
+void pgsql_CopySend(const char *context, PGconn *sql_conn, std::string const &data);
 std::shared_ptr<PGresult> pgsql_exec_simple(PGconn *sql_conn, const ExecStatusType expect, const std::string& sql);
 std::shared_ptr<PGresult> pgsql_exec_simple(PGconn *sql_conn, const ExecStatusType expect, const char *sql);
 int pgsql_exec(PGconn *sql_conn, const ExecStatusType expect, const char *fmt, ...)
@@ -21,5 +26,84 @@ int pgsql_exec(PGconn *sql_conn, const ExecStatusType expect, const char *fmt, .
 #endif
 ;
 
+/* size of a table including its indexes and toast data in bytes */
+uint64_t pgsql_table_size(PGconn *sql_conn, const std::string &table);
+
 void escape(const std::string &src, std::string& dst);
+
+/* helpers for the binary COPY format, which is in network byte order */
+
+template <typename T>
+void append_be(std::string &dst, T value)
+{
+    typename std::make_unsigned<T>::type bits = value;
+    for (int shift = (sizeof(T) - 1) * 8; shift >= 0; shift -= 8) {
+        dst.push_back(static_cast<char>((bits >> shift) & 0xff));
+    }
+}
+
+inline void append_float8(std::string &dst, double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    append_be(dst, bits);
+}
+
+inline void append_null(std::string &dst)
+{
+    append_be<int32_t>(dst, -1);
+}
+
+// a length followed by the characters, used for fields, hstores and arrays
+inline void append_text(std::string &dst, const char *src, size_t len)
+{
+    append_be<uint32_t>(dst, len);
+    dst.append(src, len);
+}
+
+// reserve space for a length which is only known afterwards
+inline size_t reserve_length(std::string &dst)
+{
+    size_t pos = dst.size();
+    dst.append(4, '\0');
+    return pos;
+}
+
+inline void put_be32(std::string &dst, size_t pos, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i) {
+        dst[pos + i] = static_cast<char>((value >> (24 - 8 * i)) & 0xff);
+    }
+}
+
+// fill in the length of a field started with reserve_length()
+inline void finish_field(std::string &dst, size_t pos)
+{
+    put_be32(dst, pos, dst.size() - pos - 4);
+}
+
+// signature, flags and length of the header extension
+inline void append_copy_header(std::string &dst)
+{
+    dst.append("PGCOPY\n\377\r\n\0", 11);
+    append_be<uint32_t>(dst, 0);
+    append_be<uint32_t>(dst, 0);
+}
+
+// the field count of -1 which ends the data
+inline void append_copy_trailer(std::string &dst)
+{
+    append_be<int16_t>(dst, -1);
+}
+
+// read a value in network byte order, as found in binary results
+template <typename T>
+T read_be(const char *src)
+{
+    typename std::make_unsigned<T>::type bits = 0;
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        bits = (bits << 8) | static_cast<unsigned char>(src[i]);
+    }
+    return static_cast<T>(bits);
+}
 #endif
@@ -0,0 +1,148 @@
+#include "ram-arena.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+/// FNV-1a, the strings are hashed straight from the arena.
+uint32_t hash_string(const char *str, size_t len)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= uint8_t(str[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+} // anonymous namespace
+
+ram_arena_t::ram_arena_t(size_t slab_size)
+: m_slab_size(slab_size), m_allocated(0), m_current(UINT32_MAX),
+  m_fill(slab_size)
+{}
+
+ram_arena_t::ref_t ram_arena_t::add(const char *data, size_t size)
+{
+    if (size > UINT32_MAX) {
+        throw std::runtime_error("Object too large for the ram middle.");
+    }
+
+    if (m_slabs.size() >= UINT32_MAX - 1) {
+        throw std::runtime_error("Out of slabs in the ram middle.");
+    }
+
+    if (size > m_slab_size) {
+        // oversized records don't disturb the slab being filled
+        m_slabs.emplace_back(new char[size]);
+        m_allocated += size;
+        memcpy(m_slabs.back().get(), data, size);
+        return ref_t(uint32_t(m_slabs.size() - 1), 0);
+    }
+
+    if (m_fill + size > m_slab_size) {
+        m_slabs.emplace_back(new char[m_slab_size]);
+        m_allocated += m_slab_size;
+        m_current = uint32_t(m_slabs.size() - 1);
+        m_fill = 0;
+    }
+
+    ref_t ref(m_current, uint32_t(m_fill));
+    memcpy(m_slabs[m_current].get() + m_fill, data, size);
+    m_fill += size;
+
+    return ref;
+}
+
+void ram_arena_t::clear()
+{
+    m_slabs.clear();
+    m_allocated = 0;
+    m_current = UINT32_MAX;
+    m_fill = m_slab_size;
+}
+
+string_table_t::string_table_t()
+: m_arena(1024 * 1024), m_slots(1024, 0)
+{}
+
+const char *string_table_t::data(uint32_t id, size_t &len) const
+{
+    const char *str = m_arena.get(m_strings[id]);
+    len = varint::read(str);
+    return str;
+}
+
+uint32_t string_table_t::add(const std::string &str)
+{
+    const size_t mask = m_slots.size() - 1;
+    size_t pos = hash_string(str.data(), str.size()) & mask;
+
+    while (m_slots[pos]) {
+        size_t len;
+        const char *known = data(m_slots[pos] - 1, len);
+        if (len == str.size() && memcmp(known, str.data(), len) == 0) {
+            return m_slots[pos] - 1;
+        }
+        pos = (pos + 1) & mask;
+    }
+
+    if (m_strings.size() >= UINT32_MAX - 1) {
+        throw std::runtime_error("Too many different strings for the ram middle.");
+    }
+
+    std::string record;
+    varint::write(record, str.size());
+    record.append(str);
+    m_strings.push_back(m_arena.add(record));
+
+    const uint32_t id = uint32_t(m_strings.size() - 1);
+    m_slots[pos] = id + 1;
+
+    // keep the table at most half full
+    if (m_strings.size() * 2 > m_slots.size()) {
+        grow();
+    }
+
+    return id;
+}
+
+void string_table_t::grow()
+{
+    std::vector<uint32_t> slots(m_slots.size() * 2, 0);
+    const size_t mask = slots.size() - 1;
+
+    for (uint32_t id = 0; id < m_strings.size(); ++id) {
+        size_t len;
+        const char *str = data(id, len);
+        size_t pos = hash_string(str, len) & mask;
+        while (slots[pos]) {
+            pos = (pos + 1) & mask;
+        }
+        slots[pos] = id + 1;
+    }
+
+    m_slots.swap(slots);
+}
+
+std::string string_table_t::get(uint32_t id) const
+{
+    size_t len;
+    const char *str = data(id, len);
+    return std::string(str, len);
+}
+
+size_t string_table_t::allocated() const
+{
+    return m_arena.allocated()
+           + m_strings.capacity() * sizeof(ram_arena_t::ref_t)
+           + m_slots.capacity() * sizeof(uint32_t);
+}
+
+void string_table_t::clear()
+{
+    m_arena.clear();
+    m_strings.clear();
+    m_slots.assign(1024, 0);
+}
@@ -0,0 +1,127 @@
+#ifndef RAM_ARENA_HPP
+#define RAM_ARENA_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * Append-only storage for many small records in large slabs of memory.
+ *
+ * Records are never moved once added, so references to them stay valid
+ * until clear() is called. A record always lies within one slab, records
+ * bigger than a slab get a slab of their own.
+ */
+class ram_arena_t
+{
+public:
+    /// Position of a record: the slab and the offset inside the slab.
+    struct ref_t
+    {
+        uint32_t slab;
+        uint32_t offset;
+
+        ref_t() : slab(UINT32_MAX), offset(0) {}
+        ref_t(uint32_t s, uint32_t o) : slab(s), offset(o) {}
+
+        bool valid() const { return slab != UINT32_MAX; }
+    };
+
+    explicit ram_arena_t(size_t slab_size = 16 * 1024 * 1024);
+
+    ref_t add(const char *data, size_t size);
+
+    ref_t add(const std::string &data) { return add(data.data(), data.size()); }
+
+    const char *get(ref_t ref) const
+    {
+        return m_slabs[ref.slab].get() + ref.offset;
+    }
+
+    /// Number of bytes allocated for slabs.
+    size_t allocated() const { return m_allocated; }
+
+    void clear();
+
+private:
+    std::vector<std::unique_ptr<char[]>> m_slabs;
+    size_t m_slab_size;
+    size_t m_allocated;
+    /// Slab currently filled with normal sized records.
+    uint32_t m_current;
+    size_t m_fill;
+};
+
+/**
+ * Stores every distinct string once and hands out a 32-bit id for it.
+ */
+class string_table_t
+{
+public:
+    string_table_t();
+
+    /// Id of the given string, adding it if it wasn't known yet.
+    uint32_t add(const std::string &str);
+
+    std::string get(uint32_t id) const;
+
+    size_t size() const { return m_strings.size(); }
+
+    /// Number of bytes used by the strings and the lookup table.
+    size_t allocated() const;
+
+    void clear();
+
+private:
+    const char *data(uint32_t id, size_t &len) const;
+    void grow();
+
+    ram_arena_t m_arena;
+    std::vector<ram_arena_t::ref_t> m_strings;
+    /// Open addressing hash table of string id + 1, 0 marks a free slot.
+    std::vector<uint32_t> m_slots;
+};
+
+/**
+ * Variable length encoding of integers with 7 bits per byte. Signed values
+ * are zigzag encoded first, so that small negative numbers stay short.
+ */
+namespace varint {
+
+inline void write(std::string &out, uint64_t value)
+{
+    while (value >= 0x80) {
+        out.push_back(char((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(char(value));
+}
+
+inline uint64_t read(const char *&data)
+{
+    uint64_t value = 0;
+    int shift = 0;
+    while (*data & 0x80) {
+        value |= uint64_t(*data++ & 0x7f) << shift;
+        shift += 7;
+    }
+    value |= uint64_t(*data++) << shift;
+    return value;
+}
+
+inline void write_signed(std::string &out, int64_t value)
+{
+    write(out, (uint64_t(value) << 1) ^ uint64_t(value >> 63));
+}
+
+inline int64_t read_signed(const char *&data)
+{
+    const uint64_t value = read(data);
+    return int64_t(value >> 1) ^ -int64_t(value & 1);
+}
+
+} // namespace varint
+
+#endif
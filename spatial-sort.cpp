@@ -0,0 +1,478 @@
+#include "spatial-sort.hpp"
+#include "reprojection.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <queue>
+#include <stdexcept>
+#include <utility>
+
+#include <boost/format.hpp>
+
+typedef boost::format fmt;
+
+// number of bits per coordinate of the Hilbert curve
+#define SORT_HILBERT_ORDER 24
+
+// memory for the rows of all sorters together before the biggest run buffer
+// is spilled into a run
+#define SORT_MEMORY_SIZE (1024 * 1024 * 1024)
+
+// number of runs merged at once, more are merged into bigger runs first
+#define SORT_MERGE_WAYS 64
+
+// set in the type of an EWKB geometry which contains an SRID
+#define WKB_SRID_FLAG 0x20000000
+
+namespace {
+
+// position of (x, y) on a Hilbert curve through a square with 2^order sides
+uint64_t hilbert_index(uint32_t x, uint32_t y, int order)
+{
+    const uint32_t n = 1u << order;
+    uint64_t d = 0;
+    for (uint32_t s = n / 2; s > 0; s /= 2) {
+        const uint32_t rx = (x & s) ? 1 : 0;
+        const uint32_t ry = (y & s) ? 1 : 0;
+        d += uint64_t(s) * s * ((3 * rx) ^ ry);
+        if (ry == 0) {
+            if (rx == 1) {
+                x = n - 1 - x;
+                y = n - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return d;
+}
+
+/**
+ * Collects the bounding box of a WKB geometry. Handles the EWKB flags
+ * for SRID, Z and M.
+ */
+class wkb_envelope_t
+{
+public:
+    wkb_envelope_t(const char *data, size_t size)
+    : m_pos(data), m_end(data + size), m_little_endian(true), m_dims(2),
+      minx(std::numeric_limits<double>::max()),
+      miny(std::numeric_limits<double>::max()),
+      maxx(std::numeric_limits<double>::lowest()),
+      maxy(std::numeric_limits<double>::lowest())
+    {}
+
+    bool read() { return geometry() && minx <= maxx; }
+
+private:
+    bool uint32(uint32_t &value)
+    {
+        if (m_end - m_pos < 4) {
+            return false;
+        }
+        value = 0;
+        for (int i = 0; i < 4; ++i) {
+            uint32_t byte = static_cast<unsigned char>(m_pos[i]);
+            value |= m_little_endian ? byte << (8 * i) : byte << (24 - 8 * i);
+        }
+        m_pos += 4;
+        return true;
+    }
+
+    bool real(double &value)
+    {
+        if (m_end - m_pos < 8) {
+            return false;
+        }
+        uint64_t bits = 0;
+        for (int i = 0; i < 8; ++i) {
+            uint64_t byte = static_cast<unsigned char>(m_pos[i]);
+            bits |= m_little_endian ? byte << (8 * i) : byte << (56 - 8 * i);
+        }
+        memcpy(&value, &bits, sizeof(value));
+        m_pos += 8;
+        return true;
+    }
+
+    bool points(uint32_t count)
+    {
+        for (uint32_t i = 0; i < count; ++i) {
+            double x, y, ignored;
+            if (!real(x) || !real(y)) {
+                return false;
+            }
+            for (unsigned d = 2; d < m_dims; ++d) {
+                if (!real(ignored)) {
+                    return false;
+                }
+            }
+            minx = std::min(minx, x);
+            maxx = std::max(maxx, x);
+            miny = std::min(miny, y);
+            maxy = std::max(maxy, y);
+        }
+        return true;
+    }
+
+    bool geometry()
+    {
+        if (m_pos >= m_end) {
+            return false;
+        }
+        m_little_endian = *m_pos++ == 1;
+
+        uint32_t type, count;
+        if (!uint32(type)) {
+            return false;
+        }
+        if (type & WKB_SRID_FLAG) {
+            uint32_t srid;
+            if (!uint32(srid)) {
+                return false;
+            }
+        }
+        m_dims = 2 + ((type & 0x80000000) ? 1 : 0) + ((type & 0x40000000) ? 1 : 0);
+        type &= 0x0fffffff;
+        // ISO WKB has the dimensions in the thousands
+        m_dims += (type / 1000 == 3) ? 2 : (type / 1000 ? 1 : 0);
+        type %= 1000;
+
+        switch (type) {
+        case 1: // point
+            return points(1);
+        case 2: // linestring
+            return uint32(count) && points(count);
+        case 3: // polygon
+            if (!uint32(count)) {
+                return false;
+            }
+            for (uint32_t i = 0; i < count; ++i) {
+                uint32_t num_points;
+                if (!uint32(num_points) || !points(num_points)) {
+                    return false;
+                }
+            }
+            return true;
+        case 4: // multi geometries and collections
+        case 5:
+        case 6:
+        case 7:
+            if (!uint32(count)) {
+                return false;
+            }
+            for (uint32_t i = 0; i < count; ++i) {
+                if (!geometry()) {
+                    return false;
+                }
+            }
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    const char *m_pos;
+    const char *m_end;
+    bool m_little_endian;
+    unsigned m_dims;
+
+public:
+    double minx, miny, maxx, maxy;
+};
+
+/// Sequential reader for the records of a run file.
+struct run_reader_t
+{
+    explicit run_reader_t(const std::string &filename)
+    : file(fopen(filename.c_str(), "rb"))
+    {
+        if (!file) {
+            throw std::runtime_error((fmt("Failed to open sort run %1%: %2%") % filename % strerror(errno)).str());
+        }
+        setvbuf(file, nullptr, _IOFBF, 1024 * 1024);
+    }
+
+    ~run_reader_t() { fclose(file); }
+
+    template <typename H>
+    bool next(H &header)
+    {
+        if (fread(&header, sizeof(header), 1, file) != 1) {
+            return false;
+        }
+        row.resize(header.size);
+        if (header.size && fread(&row[0], header.size, 1, file) != 1) {
+            throw std::runtime_error("Sort run is truncated.");
+        }
+        return true;
+    }
+
+    FILE *file;
+    std::string row;
+};
+
+FILE *open_run(const std::string &filename)
+{
+    FILE *file = fopen(filename.c_str(), "wb");
+    if (!file) {
+        throw std::runtime_error((fmt("Failed to create sort run %1%: %2%") % filename % strerror(errno)).str());
+    }
+    setvbuf(file, nullptr, _IOFBF, 1024 * 1024);
+    return file;
+}
+
+void write_run(FILE *file, const std::string &filename, const void *data, size_t size)
+{
+    if (size && fwrite(data, size, 1, file) != 1) {
+        throw std::runtime_error((fmt("Failed to write sort run %1%: %2%") % filename % strerror(errno)).str());
+    }
+}
+
+void close_run(FILE *file, const std::string &filename)
+{
+    if (fclose(file) != 0) {
+        throw std::runtime_error((fmt("Failed to write sort run %1%: %2%") % filename % strerror(errno)).str());
+    }
+}
+
+} // anonymous namespace
+
+sort_budget_t::sort_budget_t(uint64_t limit)
+: m_limit(limit), m_used(0)
+{}
+
+std::shared_ptr<sort_budget_t> sort_budget_t::global()
+{
+    static std::shared_ptr<sort_budget_t> budget =
+        std::make_shared<sort_budget_t>(SORT_MEMORY_SIZE);
+    return budget;
+}
+
+spatial_sorter_t::run_buffer_t::run_buffer_t()
+: m_sorter(nullptr), m_charged(0)
+{}
+
+spatial_sorter_t::run_buffer_t::~run_buffer_t()
+{
+    if (m_budget) {
+        spatial_sorter_t::unregister(*this);
+    }
+}
+
+spatial_sorter_t::spatial_sorter_t(const std::string &dir, const std::string &name,
+                                   std::shared_ptr<reprojection> projection)
+: spatial_sorter_t(dir, name, projection, sort_budget_t::global())
+{}
+
+spatial_sorter_t::spatial_sorter_t(const std::string &dir, const std::string &name,
+                                   std::shared_ptr<reprojection> projection,
+                                   std::shared_ptr<sort_budget_t> budget)
+: m_dir(dir), m_name(name), m_projection(projection), m_budget(budget),
+  m_seq(0), m_run_count(0), m_bytes(0)
+{}
+
+spatial_sorter_t::~spatial_sorter_t()
+{
+    for (auto const &run : m_runs) {
+        std::remove(run.c_str());
+    }
+}
+
+uint64_t spatial_sorter_t::key(double x, double y) const
+{
+    const int map_width = 1 << SORT_HILBERT_ORDER;
+    double tilex, tiley;
+    m_projection->coords_to_tile(&tilex, &tiley, x, y, map_width);
+
+    // coordinates just outside of the tile projection end up on its edge
+    tilex = std::max(0.0, std::min(tilex, map_width - 1.0));
+    tiley = std::max(0.0, std::min(tiley, map_width - 1.0));
+
+    return hilbert_index(static_cast<uint32_t>(tilex), static_cast<uint32_t>(tiley),
+                         SORT_HILBERT_ORDER);
+}
+
+uint64_t spatial_sorter_t::wkb_key(const char *wkb, size_t size) const
+{
+    wkb_envelope_t envelope(wkb, size);
+    if (!envelope.read()) {
+        return std::numeric_limits<uint64_t>::max();
+    }
+
+    return key((envelope.minx + envelope.maxx) / 2, (envelope.miny + envelope.maxy) / 2);
+}
+
+void spatial_sorter_t::add(run_buffer_t &run, uint64_t key, osmid_t id,
+                           const char *row, size_t size)
+{
+    // only the owner of the run sets these, so they are safe to read here
+    if (!run.m_budget) {
+        run.m_sorter = this;
+        run.m_budget = m_budget;
+        std::lock_guard<std::mutex> lock(m_budget->m_mutex);
+        m_budget->m_runs.push_back(&run);
+    }
+
+    const uint64_t charge = size + sizeof(run_buffer_t::entry_t);
+    {
+        std::lock_guard<std::mutex> lock(run.m_mutex);
+        run_buffer_t::entry_t entry = { key, m_seq++, id, run.m_data.size(), size };
+        run.m_entries.push_back(entry);
+        run.m_data.append(row, size);
+        run.m_charged += charge;
+    }
+    m_bytes += size;
+
+    if ((m_budget->m_used += charge) > m_budget->m_limit) {
+        spill_largest();
+    }
+}
+
+void spatial_sorter_t::flush(run_buffer_t &run)
+{
+    std::lock_guard<std::mutex> lock(run.m_mutex);
+    spill(run);
+}
+
+// the run has to be locked by the caller
+void spatial_sorter_t::spill(run_buffer_t &run)
+{
+    if (run.m_entries.empty()) {
+        return;
+    }
+
+    std::sort(run.m_entries.begin(), run.m_entries.end(),
+              [](run_buffer_t::entry_t const &a, run_buffer_t::entry_t const &b) {
+                  return a.key < b.key || (a.key == b.key && a.seq < b.seq);
+              });
+
+    const std::string filename = new_run_name();
+    FILE *file = open_run(filename);
+    for (auto const &entry : run.m_entries) {
+        record_header_t header = { entry.key, entry.seq, entry.id, entry.size };
+        write_run(file, filename, &header, sizeof(header));
+        write_run(file, filename, run.m_data.data() + entry.offset, entry.size);
+    }
+    close_run(file, filename);
+
+    // the memory is given back, it is charged again when the run grows
+    std::vector<run_buffer_t::entry_t>().swap(run.m_entries);
+    std::string().swap(run.m_data);
+    m_budget->m_used -= run.m_charged;
+    run.m_charged = 0;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_runs.push_back(filename);
+}
+
+void spatial_sorter_t::spill_largest()
+{
+    std::lock_guard<std::mutex> lock(m_budget->m_mutex);
+
+    // another writer may have spilled in the meantime
+    if (m_budget->m_used <= m_budget->m_limit) {
+        return;
+    }
+
+    run_buffer_t *largest = nullptr;
+    for (auto *run : m_budget->m_runs) {
+        if (!largest || run->m_charged > largest->m_charged) {
+            largest = run;
+        }
+    }
+
+    if (largest) {
+        std::lock_guard<std::mutex> run_lock(largest->m_mutex);
+        largest->m_sorter->spill(*largest);
+    }
+}
+
+void spatial_sorter_t::unregister(run_buffer_t &run)
+{
+    std::lock_guard<std::mutex> lock(run.m_budget->m_mutex);
+    auto &runs = run.m_budget->m_runs;
+    runs.erase(std::remove(runs.begin(), runs.end(), &run), runs.end());
+    run.m_budget->m_used -= run.m_charged;
+}
+
+void spatial_sorter_t::remove(osmid_t id)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_removed[id] = m_seq++;
+}
+
+void spatial_sorter_t::merge(std::function<void(const char *, size_t)> const &out)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // merge the runs in several passes, so that only a limited number of
+    // files is open at the same time
+    while (m_runs.size() > SORT_MERGE_WAYS) {
+        std::vector<std::string> runs(m_runs.begin(), m_runs.begin() + SORT_MERGE_WAYS);
+
+        const std::string filename = new_run_name();
+        FILE *file = open_run(filename);
+        merge_runs(runs, [&](record_header_t const &header, std::string const &row) {
+            write_run(file, filename, &header, sizeof(header));
+            write_run(file, filename, row.data(), row.size());
+        });
+        close_run(file, filename);
+
+        for (auto const &run : runs) {
+            std::remove(run.c_str());
+        }
+        m_runs.erase(m_runs.begin(), m_runs.begin() + SORT_MERGE_WAYS);
+        m_runs.push_back(filename);
+    }
+
+    merge_runs(m_runs, [&](record_header_t const &header, std::string const &row) {
+        auto removed = m_removed.find(header.id);
+        if (removed == m_removed.end() || removed->second < header.seq) {
+            out(row.data(), row.size());
+        }
+    });
+
+    for (auto const &run : m_runs) {
+        std::remove(run.c_str());
+    }
+    m_runs.clear();
+    m_removed.clear();
+}
+
+std::string spatial_sorter_t::new_run_name()
+{
+    return (fmt("%1%/%2%-%3%.sort") % m_dir % m_name % m_run_count++).str();
+}
+
+void spatial_sorter_t::merge_runs(std::vector<std::string> const &runs,
+                                  std::function<void(record_header_t const &,
+                                                     std::string const &)> const &out)
+{
+    std::vector<std::unique_ptr<run_reader_t> > readers;
+    std::vector<record_header_t> heads(runs.size());
+
+    // smallest key on top, rows of the same key in the order they came in
+    auto later = [&heads](size_t a, size_t b) {
+        return heads[a].key > heads[b].key
+               || (heads[a].key == heads[b].key && heads[a].seq > heads[b].seq);
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(later)> queue(later);
+
+    for (size_t i = 0; i < runs.size(); ++i) {
+        readers.emplace_back(new run_reader_t(runs[i]));
+        if (readers[i]->next(heads[i])) {
+            queue.push(i);
+        }
+    }
+
+    while (!queue.empty()) {
+        size_t i = queue.top();
+        queue.pop();
+        out(heads[i], readers[i]->row);
+        if (readers[i]->next(heads[i])) {
+            queue.push(i);
+        }
+    }
+}
@@ -0,0 +1,160 @@
+#ifndef SPATIAL_SORT_HPP
+#define SPATIAL_SORT_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include "osmtypes.hpp"
+
+class reprojection;
+class sort_budget_t;
+
+/**
+ * Sorts the rows of an output table by the location of their geometry
+ * on the client, so that they can be written to the table in the order
+ * the CLUSTER step in the database would give them (see --client-sort).
+ *
+ * Rows are collected in memory by each writer, sorted and spilled as runs
+ * into files, which are merged at the end. The key is the position of the
+ * centre of the geometry's bounding box on a Hilbert curve over the tile
+ * projection.
+ *
+ * One sorter is shared by a table and all its clones. Each of them has a
+ * run_buffer_t of its own. The run buffers of all sorters are charged
+ * against one sort_budget_t, when it is used up the biggest run buffer is
+ * spilled, no matter which writer it belongs to.
+ */
+class spatial_sorter_t : public boost::noncopyable
+{
+public:
+    /// Rows of one writer which have not been spilled yet.
+    class run_buffer_t : public boost::noncopyable
+    {
+        friend class spatial_sorter_t;
+
+    public:
+        run_buffer_t();
+        ~run_buffer_t();
+
+    private:
+        struct entry_t
+        {
+            uint64_t key;
+            uint64_t seq;
+            osmid_t id;
+            size_t offset;
+            size_t size;
+        };
+
+        // taken by the owner for adding and by other writers for spilling
+        std::mutex m_mutex;
+        std::string m_data;
+        std::vector<entry_t> m_entries;
+        spatial_sorter_t *m_sorter; ///< set on the first row
+        std::shared_ptr<sort_budget_t> m_budget; ///< set on the first row
+        std::atomic<uint64_t> m_charged; ///< memory charged to the budget
+    };
+
+    /// A sorter using the budget shared by all output tables.
+    spatial_sorter_t(const std::string &dir, const std::string &name,
+                     std::shared_ptr<reprojection> projection);
+    spatial_sorter_t(const std::string &dir, const std::string &name,
+                     std::shared_ptr<reprojection> projection,
+                     std::shared_ptr<sort_budget_t> budget);
+    ~spatial_sorter_t();
+
+    /// Sort key of a location in the target projection.
+    uint64_t key(double x, double y) const;
+
+    /// Sort key of a geometry in (E)WKB, the maximum key if it can't be read.
+    uint64_t wkb_key(const char *wkb, size_t size) const;
+
+    /// Add a row, which is a complete row in the COPY format.
+    void add(run_buffer_t &run, uint64_t key, osmid_t id, const char *row,
+             size_t size);
+
+    /// Spill the rows collected in the buffer into a run.
+    void flush(run_buffer_t &run);
+
+    /// Drop all rows for the object which were added so far.
+    void remove(osmid_t id);
+
+    /**
+     * Call out for all rows in the order of their keys, leaving out
+     * removed rows. All run buffers must have been flushed.
+     */
+    void merge(std::function<void(const char *, size_t)> const &out);
+
+    /// Size of all rows added so far.
+    uint64_t bytes() const { return m_bytes; }
+
+private:
+    struct record_header_t
+    {
+        uint64_t key;
+        uint64_t seq;
+        osmid_t id;
+        uint64_t size;
+    };
+
+    void spill(run_buffer_t &run);
+    void spill_largest();
+    static void unregister(run_buffer_t &run);
+
+    std::string new_run_name();
+    void merge_runs(std::vector<std::string> const &runs,
+                    std::function<void(record_header_t const &,
+                                       std::string const &)> const &out);
+
+    std::string m_dir;
+    std::string m_name;
+    std::shared_ptr<reprojection> m_projection;
+    std::shared_ptr<sort_budget_t> m_budget;
+
+    std::atomic<uint64_t> m_seq;
+    std::atomic<uint64_t> m_run_count;
+    std::atomic<uint64_t> m_bytes;
+
+    std::mutex m_mutex;
+    std::vector<std::string> m_runs;
+    // sequence number at the time each removed object was last removed
+    std::unordered_map<osmid_t, uint64_t> m_removed;
+};
+
+/**
+ * Memory for the rows kept in run buffers which are not spilled yet. One
+ * budget is shared by the sorters of all output tables, so that the memory
+ * doesn't grow with the number of tables and threads.
+ */
+class sort_budget_t : public boost::noncopyable
+{
+public:
+    explicit sort_budget_t(uint64_t limit);
+
+    /// The budget used by the sorters of the output tables.
+    static std::shared_ptr<sort_budget_t> global();
+
+    /// Memory charged by all run buffers at the moment.
+    uint64_t used() const { return m_used; }
+
+private:
+    friend class spatial_sorter_t;
+
+    uint64_t m_limit;
+    std::atomic<uint64_t> m_used;
+
+    // held while looking for the biggest run buffer and spilling it
+    std::mutex m_mutex;
+    std::vector<spatial_sorter_t::run_buffer_t *> m_runs;
+};
+
+#endif
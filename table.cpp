@@ -2,25 +2,201 @@
 #include "options.hpp"
 #include "util.hpp"
 #include "taginfo.hpp"
+#include "wkb-writer.hpp"
 
 #include <exception>
 #include <algorithm>
+#include <chrono>
+#include <cstdint>
 #include <cstring>
 #include <cstdio>
+#include <limits>
+#include <map>
 #include <utility>
 #include <time.h>
 
 using std::string;
 typedef boost::format fmt;
 
-#define BUFFER_SEND_SIZE 1024
+// rows are collected in a buffer of this size, while the previous one is sent
+#define BUFFER_SEND_SIZE (2 * 1024 * 1024)
+
+// buffers sent in the background by all tables together, 128 MB in total
+#define MAX_SEND_BUFFERS 64
+
+// set in the type of an EWKB geometry which contains an SRID
+#define WKB_SRID_FLAG 0x20000000
+
+namespace {
+
+std::atomic<int> free_send_buffers(MAX_SEND_BUFFERS);
+
+// For integers we take the first number, or the average if it's a-b
+bool parse_int(const string &value, long &result)
+{
+    long from, to;
+    int items = sscanf(value.c_str(), "%ld-%ld", &from, &to);
+    if (items == 1) {
+        result = from;
+    } else if (items == 2) {
+        result = (from + to) / 2;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/* try to "repair" real values as follows:
+ * assume "," to be a decimal mark which need to be replaced by "."
+ * like int4 take the first number, or the average if it's a-b
+ * assume SI unit (meters)
+ * convert feet to meters (1 foot = 0.3048 meters)
+ * reject anything else
+ */
+bool parse_real(const string &value, double &result)
+{
+    string escaped(value);
+    std::replace(escaped.begin(), escaped.end(), ',', '.');
+
+    double from, to;
+    int items = sscanf(escaped.c_str(), "%lf-%lf", &from, &to);
+    if (items == 1) {
+        if (escaped.size() > 1 && escaped.substr(escaped.size() - 2).compare("ft") == 0) {
+            from *= 0.3048;
+        }
+        result = from;
+    }
+    else if (items == 2) {
+        if (escaped.size() > 1 && escaped.substr(escaped.size() - 2).compare("ft") == 0) {
+            from *= 0.3048;
+            to *= 0.3048;
+        }
+        result = (from + to) / 2;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+unsigned char hex_value(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    throw std::runtime_error((fmt("Invalid character '%1%' in hex geometry") % c).str());
+}
+
+unsigned char hex_byte(const string &hex, size_t pos)
+{
+    return (hex_value(hex[pos]) << 4) | hex_value(hex[pos + 1]);
+}
+
+// 32 bit integer in the byte order of a WKB geometry
+void append_wkb32(string &dst, uint32_t value, bool little_endian)
+{
+    for (int i = 0; i < 4; ++i) {
+        int shift = little_endian ? 8 * i : 24 - 8 * i;
+        dst.push_back(static_cast<char>((value >> shift) & 0xff));
+    }
+}
+
+} // anonymous namespace
+
+copy_sender_t::copy_sender_t(send_func_t send)
+: m_send(std::move(send)), m_busy(false), m_stop(false)
+{}
+
+copy_sender_t::~copy_sender_t()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+        m_cond.notify_all();
+    }
+    if (m_thread.joinable())
+        m_thread.join();
+}
+
+void copy_sender_t::send(std::string &buffer)
+{
+    wait();
+
+    // take one of the buffers for the background, or send it right here
+    int free = free_send_buffers.load();
+    while (free > 0 && !free_send_buffers.compare_exchange_weak(free, free - 1)) {
+    }
+    if (free <= 0) {
+        m_send(buffer);
+        buffer.clear();
+        return;
+    }
+
+    if (!m_thread.joinable())
+        m_thread = std::thread(&copy_sender_t::run, this);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_data.swap(buffer);
+    buffer.clear();
+    m_busy = true;
+    m_cond.notify_all();
+}
+
+bool copy_sender_t::wait()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (!m_busy && !m_error)
+        return false;
+
+    m_cond.wait(lock, [this] { return !m_busy; });
+    if (m_error) {
+        std::exception_ptr error = m_error;
+        m_error = nullptr;
+        std::rethrow_exception(error);
+    }
+    return true;
+}
+
+void copy_sender_t::run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+        m_cond.wait(lock, [this] { return m_busy || m_stop; });
+        if (!m_busy)
+            return;
+
+        // m_data is left alone by the other side while m_busy is set
+        lock.unlock();
+        std::exception_ptr error;
+        try {
+            m_send(m_data);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        // the capacity is kept for the next chunk, the memory is freed
+        // together with the sender at the end of the table
+        m_data.clear();
+        ++free_send_buffers;
+        lock.lock();
+
+        m_error = error;
+        m_busy = false;
+        m_cond.notify_all();
+    }
+}
 
 
 table_t::table_t(const string& conninfo, const string& name, const string& type, const columns_t& columns, const hstores_t& hstore_columns,
     const int srid, const bool append, const bool slim, const bool drop_temp, const int hstore_mode,
     const bool enable_hstore_index, const boost::optional<string>& table_space, const boost::optional<string>& table_space_index) :
-    conninfo(conninfo), name(name), type(type), sql_conn(nullptr), copyMode(false), srid((fmt("%1%") % srid).str()),
-    append(append), slim(slim), drop_temp(drop_temp), hstore_mode(hstore_mode), enable_hstore_index(enable_hstore_index),
+    conninfo(conninfo), name(name), type(type), sql_conn(nullptr), copyMode(false), copy_stats(std::make_shared<copy_stats_t>()), srid((fmt("%1%") % srid).str()),
+    srid_num(srid), binary(false), append(append), slim(slim), drop_temp(drop_temp), hstore_mode(hstore_mode), enable_hstore_index(enable_hstore_index),
     columns(columns), hstore_columns(hstore_columns), table_space(table_space), table_space_index(table_space_index)
 {
     //if we dont have any columns
@@ -32,15 +208,14 @@ table_t::table_t(const string& conninfo, const string& name, const string& type,
 
     //we use these a lot, so instead of constantly allocating them we predefine these
     single_fmt = fmt("%1%");
-    point_fmt = fmt("POINT(%.15g %.15g)");
     del_fmt = fmt("DELETE FROM %1% WHERE osm_id = %2%");
 }
 
 table_t::table_t(const table_t& other):
-    conninfo(other.conninfo), name(other.name), type(other.type), sql_conn(nullptr), copyMode(false), buffer(), srid(other.srid),
-    append(other.append), slim(other.slim), drop_temp(other.drop_temp), hstore_mode(other.hstore_mode), enable_hstore_index(other.enable_hstore_index),
+    conninfo(other.conninfo), name(other.name), type(other.type), sql_conn(nullptr), copyMode(false), buffer(), copy_stats(other.copy_stats), sorter(other.sorter), srid(other.srid),
+    srid_num(other.srid_num), binary(other.binary), binary_types(other.binary_types), append(other.append), slim(other.slim), drop_temp(other.drop_temp), hstore_mode(other.hstore_mode), enable_hstore_index(other.enable_hstore_index),
     columns(other.columns), hstore_columns(other.hstore_columns), copystr(other.copystr), table_space(other.table_space),
-    table_space_index(other.table_space_index), single_fmt(other.single_fmt), point_fmt(other.point_fmt), del_fmt(other.del_fmt)
+    table_space_index(other.table_space_index), single_fmt(other.single_fmt), del_fmt(other.del_fmt)
 {
     // if the other table has already started, then we want to execute
     // the same stuff to get into the same state. but if it hasn't, then
@@ -51,8 +226,7 @@ table_t::table_t(const table_t& other):
         pgsql_exec_simple(sql_conn, PGRES_COMMAND_OK, (fmt("PREPARE get_wkb (" POSTGRES_OSMID_TYPE ") AS SELECT way FROM %1% WHERE osm_id = $1") % name).str());
         //start the copy
         begin();
-        pgsql_exec_simple(sql_conn, PGRES_COPY_IN, copystr);
-        copyMode = true;
+        start_copy();
     }
 }
 
@@ -67,6 +241,9 @@ std::string const& table_t::get_name() {
 
 void table_t::teardown()
 {
+    // the background send must not use the connection after it is closed
+    sender.reset();
+
     if(sql_conn != nullptr)
     {
         PQfinish(sql_conn);
@@ -81,6 +258,8 @@ void table_t::begin()
 
 void table_t::commit()
 {
+    if (sorter)
+        sorter->flush(sort_run);
     stop_copy();
     fprintf(stderr, "Committing transaction for %s\n", name.c_str());
     pgsql_exec_simple(sql_conn, PGRES_COMMAND_OK, "COMMIT");
@@ -200,43 +379,185 @@ void table_t::start()
     else
         cols += "way";
 
+    //binary copy saves the server from parsing everything, but we need to
+    //know the binary representation of every column
+    binary = setup_binary_types();
+
     //get into copy mode
-    copystr = (fmt("COPY %1% (%2%) FROM STDIN") % name % cols).str();
+    copystr = (fmt("COPY %1% (%2%) FROM STDIN%3%") % name % cols %
+               (binary ? " (FORMAT binary)" : "")).str();
+    start_copy();
+}
+
+/* The column types of an existing table by column name. */
+std::map<std::string, std::string> table_t::get_column_types()
+{
+    char *quoted = PQescapeLiteral(sql_conn, name.c_str(), name.size());
+    if (!quoted) {
+        throw std::runtime_error((fmt("Quoting table name %1% failed: %2%") % name % PQerrorMessage(sql_conn)).str());
+    }
+    string sql = (fmt("SELECT attname, format_type(atttypid, atttypmod) FROM pg_attribute "
+                      "WHERE attrelid = %1%::regclass AND attnum > 0 AND NOT attisdropped")
+                  % quoted).str();
+    PQfreemem(quoted);
+
+    auto res = pgsql_exec_simple(sql_conn, PGRES_TUPLES_OK, sql);
+    std::map<std::string, std::string> types;
+    for (int i = 0; i < PQntuples(res.get()); ++i) {
+        types[PQgetvalue(res.get(), i, 0)] = PQgetvalue(res.get(), i, 1);
+    }
+
+    return types;
+}
+
+bool table_t::setup_binary_types()
+{
+    // the types osm2pgsql converts values for, see taginfo.cpp
+    static const std::map<std::string, binary_type_t> types = {
+        {"text", BINARY_TEXT},
+        {"smallint", BINARY_INT2},
+        {"int2", BINARY_INT2},
+        {"integer", BINARY_INT4},
+        {"int4", BINARY_INT4},
+        {"bigint", BINARY_INT8},
+        {"int8", BINARY_INT8},
+        {"real", BINARY_FLOAT4},
+        {"double precision", BINARY_FLOAT8}
+    };
+
+    binary_types.clear();
+
+    // an existing table may have other types than the style says, e.g. when
+    // it was created with an older style, so its own types are used then
+    std::map<std::string, std::string> table_types;
+    if (append) {
+        table_types = get_column_types();
+
+        auto text_copy = [&](const std::string &column) {
+            fprintf(stderr, "Using text COPY for %s because of the type of column %s\n",
+                    name.c_str(), column.c_str());
+            return false;
+        };
+
+        if (table_types["osm_id"] != "bigint")
+            return text_copy("osm_id");
+        for (auto const &hcolumn : hstore_columns) {
+            if (table_types[hcolumn] != "hstore")
+                return text_copy(hcolumn);
+        }
+        if (hstore_mode != HSTORE_NONE && table_types["tags"] != "hstore")
+            return text_copy("tags");
+        if (table_types["way"].compare(0, 8, "geometry") != 0)
+            return text_copy("way");
+    }
+
+    for (auto const &column : columns) {
+        const std::string &type_name = append ? table_types[column.name] : column.type_name;
+        auto it = types.find(type_name);
+        // the value is converted according to the style, so the column must
+        // have a matching type
+        bool matches = false;
+        if (it != types.end()) {
+            switch (column.type) {
+                case COLUMN_TYPE_INT:
+                    matches = it->second == BINARY_INT2 || it->second == BINARY_INT4 ||
+                              it->second == BINARY_INT8;
+                    break;
+                case COLUMN_TYPE_REAL:
+                    matches = it->second == BINARY_FLOAT4 || it->second == BINARY_FLOAT8;
+                    break;
+                case COLUMN_TYPE_TEXT:
+                    matches = it->second == BINARY_TEXT;
+                    break;
+            }
+        }
+        if (!matches) {
+            fprintf(stderr, "Using text COPY for %s because of column type %s\n",
+                    name.c_str(), type_name.c_str());
+            binary_types.clear();
+            return false;
+        }
+        binary_types.push_back(it->second);
+    }
+
+    return true;
+}
+
+void table_t::start_copy()
+{
     pgsql_exec_simple(sql_conn, PGRES_COPY_IN, copystr);
     copyMode = true;
+
+    // the data is sent in the background without blocking in libpq
+    if (PQsetnonblocking(sql_conn, 1) != 0) {
+        throw std::runtime_error((fmt("Setting nonblocking COPY for %1% failed: %2%\n") % name % PQerrorMessage(sql_conn)).str());
+    }
+
+    if (binary) {
+        append_copy_header(buffer);
+    }
 }
 
 void table_t::stop()
 {
-    stop_copy();
-    if (!append)
-    {
-        time_t start, end;
-        time(&start);
+    index_scheduler_t scheduler(1);
+    schedule_stop(scheduler);
+    scheduler.run();
+}
 
-        fprintf(stderr, "Sorting data and creating indexes for %s\n", name.c_str());
+void table_t::schedule_stop(index_scheduler_t &scheduler)
+{
+    if (append)
+    {
+        stop_copy();
+        print_copy_stats();
+        teardown();
+        fprintf(stderr, "Completed %s\n", name.c_str());
+        return;
+    }
 
-        pgsql_exec_simple(sql_conn, PGRES_COMMAND_OK, (fmt("CREATE TABLE %1%_tmp %2% AS SELECT * FROM %1% ORDER BY ST_GeoHash(ST_Transform(ST_Envelope(way),4326),10) COLLATE \"C\"") % name % (table_space ? "TABLESPACE " + table_space.get() : "")).str());
-        pgsql_exec_simple(sql_conn, PGRES_COMMAND_OK, (fmt("DROP TABLE %1%") % name).str());
-        pgsql_exec_simple(sql_conn, PGRES_COMMAND_OK, (fmt("ALTER TABLE %1%_tmp RENAME TO %1%") % name).str());
-        fprintf(stderr, "Copying %s to cluster by geometry finished\n", name.c_str());
-        fprintf(stderr, "Creating geometry index on %s\n", name.c_str());
+    //the COPY isn't finished yet, so the size of the rows stands in for the table size
+    index_scheduler_t::job_t job(name, copy_stats->bytes + buffer.size() +
+                                       (sorter ? sorter->bytes() : 0));
+
+    //finishing the COPY, and for a client side sort the whole COPY, runs
+    //in the job too, so that it happens in parallel with the other tables
+    job.add_step((sorter ? "Writing " + name + " sorted by geometry"
+                         : "Finishing COPY into " + name), [this]() {
+        if (sorter)
+            copy_sorted_rows();
+        stop_copy();
+        print_copy_stats();
+    });
+
+    //the rows of a client side sort were already written in the right order
+    if (!sorter) {
+        job.add_step("Clustering " + name + " by geometry", [this]() {
+            pgsql_exec_simple(sql_conn, PGRES_COMMAND_OK, (fmt("CREATE TABLE %1%_tmp %2% AS SELECT * FROM %1% ORDER BY ST_GeoHash(ST_Transform(ST_Envelope(way),4326),10) COLLATE \"C\"") % name % (table_space ? "TABLESPACE " + table_space.get() : "")).str());
+            pgsql_exec_simple(sql_conn, PGRES_COMMAND_OK, (fmt("DROP TABLE %1%") % name).str());
+            pgsql_exec_simple(sql_conn, PGRES_COMMAND_OK, (fmt("ALTER TABLE %1%_tmp RENAME TO %1%") % name).str());
+        });
+    }
 
+    job.add_step("Creating geometry index on " + name, [this]() {
         // Use fillfactor 100 for un-updatable imports
         pgsql_exec_simple(sql_conn, PGRES_COMMAND_OK, (fmt("CREATE INDEX %1%_index ON %1% USING GIST (way) %2% %3%") % name %
             (slim && !drop_temp ? "" : "WITH (FILLFACTOR=100)") %
             (table_space_index ? "TABLESPACE " + table_space_index.get() : "")).str());
+    });
 
-        /* slim mode needs this to be able to apply diffs */
-        if (slim && !drop_temp)
-        {
-            fprintf(stderr, "Creating osm_id index on %s\n", name.c_str());
+    /* slim mode needs this to be able to apply diffs */
+    if (slim && !drop_temp)
+    {
+        job.add_step("Creating osm_id index on " + name, [this]() {
             pgsql_exec_simple(sql_conn, PGRES_COMMAND_OK, (fmt("CREATE INDEX %1%_pkey ON %1% USING BTREE (osm_id) %2%") % name %
                 (table_space_index ? "TABLESPACE " + table_space_index.get() : "")).str());
-        }
-        /* Create hstore index if selected */
-        if (enable_hstore_index) {
-            fprintf(stderr, "Creating hstore indexes on %s\n", name.c_str());
+        });
+    }
+
+    /* Create hstore index if selected */
+    if (enable_hstore_index) {
+        job.add_step("Creating hstore indexes on " + name, [this]() {
             if (hstore_mode != HSTORE_NONE) {
                 pgsql_exec_simple(sql_conn, PGRES_COMMAND_OK, (fmt("CREATE INDEX %1%_tags_index ON %1% USING GIN (tags) %2%") % name %
                     (table_space_index ? "TABLESPACE " + table_space_index.get() : "")).str());
@@ -245,16 +566,28 @@ void table_t::stop()
                 pgsql_exec_simple(sql_conn, PGRES_COMMAND_OK, (fmt("CREATE INDEX %1%_hstore_%2%_index ON %1% USING GIN (\"%3%\") %4%") % name % i % hstore_columns[i] %
                     (table_space_index ? "TABLESPACE " + table_space_index.get() : "")).str());
             }
-        }
-        fprintf(stderr, "Creating indexes on %s finished\n", name.c_str());
+        });
+    }
+
+    job.add_step("Analyzing " + name, [this]() {
         pgsql_exec_simple(sql_conn, PGRES_COMMAND_OK, (fmt("GRANT SELECT ON %1% TO PUBLIC") % name).str());
         pgsql_exec_simple(sql_conn, PGRES_COMMAND_OK, (fmt("ANALYZE %1%") % name).str());
-        time(&end);
-        fprintf(stderr, "All indexes on %s created in %ds\n", name.c_str(), (int)(end - start));
-    }
-    teardown();
+        teardown();
+        fprintf(stderr, "Completed %s\n", name.c_str());
+    });
+
+    scheduler.add(std::move(job));
+}
 
-    fprintf(stderr, "Completed %s\n", name.c_str());
+void table_t::print_copy_stats()
+{
+    if (copy_stats->bytes > 0) {
+        double send_s = copy_stats->send_ms / 1000.0;
+        fprintf(stderr, "Copied %.1f MB into %s at %.1f MB/s, waited %.1fs for the database\n",
+                copy_stats->bytes / (1024.0 * 1024.0), name.c_str(),
+                send_s > 0 ? copy_stats->bytes / (1024.0 * 1024.0) / send_s : 0.0,
+                copy_stats->wait_ms / 1000.0);
+    }
 }
 
 void table_t::stop_copy()
@@ -265,14 +598,19 @@ void table_t::stop_copy()
     //we werent copying anyway
     if(!copyMode)
         return;
+
+    if (binary)
+        append_copy_trailer(buffer);
+
     //if there is stuff left over in the copy buffer send it offand copy it before we stop
-    else if(buffer.length() != 0)
-    {
-        pgsql_CopyData(name.c_str(), sql_conn, buffer);
-        buffer.clear();
-    };
+    wait_for_copy();
+    send_copy_data(buffer);
+    buffer.clear();
+
+    //stop the copy, back in blocking mode which waits for the data to go out
+    if (PQsetnonblocking(sql_conn, 0) != 0)
+        throw std::runtime_error((fmt("Flushing COPY for %1% failed: %2%\n") % name % PQerrorMessage(sql_conn)).str());
 
-    //stop the copy
     stop = PQputCopyEnd(sql_conn, nullptr);
     if (stop != 1)
        throw std::runtime_error((fmt("stop COPY_END for %1% failed: %2%\n") % name % PQerrorMessage(sql_conn)).str());
@@ -288,18 +626,142 @@ void table_t::stop_copy()
     copyMode = false;
 }
 
+/* Hand the full buffer to the sender of this table, so that the caller can
+ * go on preparing rows in a new buffer meanwhile. */
+void table_t::send_copy_buffer()
+{
+    if (!sender)
+        sender.reset(new copy_sender_t([this](const std::string &data) { send_copy_data(data); }));
+
+    wait_for_copy();
+    sender->send(buffer);
+}
+
+// wait for the background send, reporting its errors
+void table_t::wait_for_copy()
+{
+    if (!sender)
+        return;
+
+    auto start = std::chrono::steady_clock::now();
+    sender->wait();
+    copy_stats->wait_ms += std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+void table_t::send_copy_data(const std::string &data)
+{
+    if (data.empty())
+        return;
+
+    auto start = std::chrono::steady_clock::now();
+    pgsql_CopySend(name.c_str(), sql_conn, data);
+    copy_stats->send_ms += std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    copy_stats->bytes += data.size();
+}
+
 void table_t::write_node(const osmid_t id, const taglist_t &tags, double lat, double lon)
 {
-    write_row(id, tags, (point_fmt % lon % lat).str());
+    if (!binary) {
+        write_row(id, tags, wkb::point(lon, lat));
+        return;
+    }
+
+    if (!copyMode)
+        start_copy();
+
+    const size_t row = buffer.size();
+    write_fields_binary(id, tags);
+    write_point_binary(lon, lat);
+
+    if (sorter) {
+        sort_row(row, id, sorter->key(lon, lat));
+        return;
+    }
+
+    if(buffer.length() > BUFFER_SEND_SIZE)
+        send_copy_buffer();
 }
 
 void table_t::delete_row(const osmid_t id)
 {
+    //rows which are still in the sorter never reached the database
+    if (sorter) {
+        sorter->remove(id);
+        return;
+    }
+
     stop_copy();
     pgsql_exec_simple(sql_conn, PGRES_COMMAND_OK, (del_fmt % name % id).str());
 }
 
 void table_t::write_row(const osmid_t id, const taglist_t &tags, const std::string &geom)
+{
+    //tell the db we are copying if for some reason we arent already
+    if (!copyMode)
+        start_copy();
+
+    const size_t row = buffer.size();
+    if (binary) {
+        write_fields_binary(id, tags);
+        const size_t geom_field = buffer.size();
+        write_geom_binary(geom);
+        if (sorter) {
+            sort_row(row, id, sorter->wkb_key(buffer.data() + geom_field + 4,
+                                              buffer.size() - geom_field - 4));
+            return;
+        }
+    } else {
+        write_row_text(id, tags, geom);
+        if (sorter) {
+            sort_row(row, id, text_sort_key(geom));
+            return;
+        }
+    }
+
+    //send all the data to postgres
+    if(buffer.length() > BUFFER_SEND_SIZE)
+        send_copy_buffer();
+}
+
+// move the row which starts at row_start from the buffer into the sorter
+void table_t::sort_row(size_t row_start, const osmid_t id, uint64_t key)
+{
+    sorter->add(sort_run, key, id, buffer.data() + row_start, buffer.size() - row_start);
+    buffer.resize(row_start);
+}
+
+// sort key of a geometry given as hex WKB
+uint64_t table_t::text_sort_key(const std::string &geom)
+{
+    sort_wkb.clear();
+    for (size_t i = 0; i + 1 < geom.size(); i += 2)
+        sort_wkb.push_back(static_cast<char>(hex_byte(geom, i)));
+    return sorter->wkb_key(sort_wkb.data(), sort_wkb.size());
+}
+
+void table_t::enable_client_sort(const std::string &dir,
+                                 std::shared_ptr<reprojection> projection)
+{
+    sorter = std::make_shared<spatial_sorter_t>(dir, name, projection);
+}
+
+// write the rows of this table and its clones in the order of the sorter
+void table_t::copy_sorted_rows()
+{
+    sorter->flush(sort_run);
+    if (!copyMode)
+        start_copy();
+
+    sorter->merge([this](const char *row, size_t size) {
+        buffer.append(row, size);
+        if (buffer.length() > BUFFER_SEND_SIZE)
+            send_copy_buffer();
+    });
+}
+
+void table_t::write_row_text(const osmid_t id, const taglist_t &tags, const std::string &geom)
 {
     //add the osm id
     buffer.append((single_fmt % id).str());
@@ -329,20 +791,6 @@ void table_t::write_row(const osmid_t id, const taglist_t &tags, const std::stri
     buffer.append(geom);
     //we need \n because we are copying from stdin
     buffer.push_back('\n');
-
-    //tell the db we are copying if for some reason we arent already
-    if (!copyMode)
-    {
-        pgsql_exec_simple(sql_conn, PGRES_COPY_IN, copystr);
-        copyMode = true;
-    }
-
-    //send all the data to postgres
-    if(buffer.length() > BUFFER_SEND_SIZE)
-    {
-        pgsql_CopyData(name.c_str(), sql_conn, buffer);
-        buffer.clear();
-    }
 }
 
 void table_t::write_columns(const taglist_t &tags, string& values, std::vector<bool> *used)
@@ -463,46 +911,20 @@ void table_t::escape_type(const string &value, ColumnType type, string& dst) {
     switch (type) {
         case COLUMN_TYPE_INT:
             {
-                // For integers we take the first number, or the average if it's a-b
-                long from, to;
-                int items = sscanf(value.c_str(), "%ld-%ld", &from, &to);
-                if (items == 1) {
-                    dst.append((single_fmt % from).str());
-                } else if (items == 2) {
-                    dst.append((single_fmt % ((from + to) / 2)).str());
+                long number;
+                if (parse_int(value, number)) {
+                    dst.append((single_fmt % number).str());
                 } else {
                     dst.append("\\N");
                 }
                 break;
             }
         case COLUMN_TYPE_REAL:
-            /* try to "repair" real values as follows:
-             * assume "," to be a decimal mark which need to be replaced by "."
-             * like int4 take the first number, or the average if it's a-b
-             * assume SI unit (meters)
-             * convert feet to meters (1 foot = 0.3048 meters)
-             * reject anything else
-             */
             {
-                string escaped(value);
-                std::replace(escaped.begin(), escaped.end(), ',', '.');
-
-                double from, to;
-                int items = sscanf(escaped.c_str(), "%lf-%lf", &from, &to);
-                if (items == 1) {
-                    if (escaped.size() > 1 && escaped.substr(escaped.size() - 2).compare("ft") == 0) {
-                        from *= 0.3048;
-                    }
-                    dst.append((single_fmt % from).str());
-                }
-                else if (items == 2) {
-                    if (escaped.size() > 1 && escaped.substr(escaped.size() - 2).compare("ft") == 0) {
-                        from *= 0.3048;
-                        to *= 0.3048;
-                    }
-                    dst.append((single_fmt % ((from + to) / 2)).str());
-                }
-                else {
+                double number;
+                if (parse_real(value, number)) {
+                    dst.append((single_fmt % number).str());
+                } else {
                     dst.append("\\N");
                 }
                 break;
@@ -514,6 +936,188 @@ void table_t::escape_type(const string &value, ColumnType type, string& dst) {
     }
 }
 
+void table_t::write_fields_binary(const osmid_t id, const taglist_t &tags)
+{
+    //number of fields: osm_id, columns, hstore columns, tags and way
+    append_be<uint16_t>(buffer, columns.size() + hstore_columns.size()
+                                + (hstore_mode != HSTORE_NONE ? 1 : 0) + 2);
+
+    append_be<uint32_t>(buffer, sizeof(int64_t));
+    append_be<int64_t>(buffer, id);
+
+    std::vector<bool> used;
+
+    if (hstore_mode != HSTORE_NONE)
+        used.assign(tags.size(), false);
+
+    write_columns_binary(tags, hstore_mode == HSTORE_NORM?&used:nullptr);
+    write_hstore_columns_binary(tags);
+
+    if (hstore_mode != HSTORE_NONE)
+        write_tags_column_binary(tags, used);
+}
+
+void table_t::write_columns_binary(const taglist_t &tags, std::vector<bool> *used)
+{
+    for (size_t i = 0; i < columns.size(); ++i) {
+        int idx;
+        if ((idx = tags.indexof(columns[i].name)) >= 0) {
+            write_type_binary(tags[idx].value, columns[i].type, binary_types[i]);
+            if (used)
+                (*used)[idx] = true;
+        }
+        else
+            append_null(buffer);
+    }
+}
+
+/* an hstore is sent as the number of pairs followed by keys and values */
+void table_t::write_tags_column_binary(const taglist_t &tags,
+                                       const std::vector<bool> &used)
+{
+    const size_t field = reserve_length(buffer);
+    const size_t count_pos = reserve_length(buffer);
+
+    uint32_t count = 0;
+    for (size_t i = 0; i < tags.size(); ++i)
+    {
+        const tag_t& xtag = tags[i];
+        //skip z_order tag and keys which have their own column
+        if (used[i] || ("z_order" == xtag.key))
+            continue;
+
+        append_text(buffer, xtag.key.data(), xtag.key.size());
+        append_text(buffer, xtag.value.data(), xtag.value.size());
+        ++count;
+    }
+
+    put_be32(buffer, count_pos, count);
+    finish_field(buffer, field);
+}
+
+void table_t::write_hstore_columns_binary(const taglist_t &tags)
+{
+    for (auto const &hstore_column : hstore_columns)
+    {
+        const size_t field = reserve_length(buffer);
+        const size_t count_pos = reserve_length(buffer);
+
+        uint32_t count = 0;
+        for (auto const &xtag : tags)
+        {
+            //check if the tag's key starts with the name of the hstore column
+            if (xtag.key.compare(0, hstore_column.size(), hstore_column) == 0)
+            {
+                append_text(buffer, xtag.key.data() + hstore_column.size(),
+                            xtag.key.size() - hstore_column.size());
+                append_text(buffer, xtag.value.data(), xtag.value.size());
+                ++count;
+            }
+        }
+
+        //no matching tags, the column is NULL
+        if (count == 0) {
+            buffer.resize(field);
+            append_null(buffer);
+        } else {
+            put_be32(buffer, count_pos, count);
+            finish_field(buffer, field);
+        }
+    }
+}
+
+/* Convert data to the binary representation of the column type. Values out
+ * of range for the column become NULL. */
+void table_t::write_type_binary(const string &value, ColumnType type,
+                                binary_type_t binary_type)
+{
+    switch (type) {
+        case COLUMN_TYPE_INT:
+            {
+                long number;
+                if (!parse_int(value, number)) {
+                    append_null(buffer);
+                } else if (binary_type == BINARY_INT2 &&
+                           number >= std::numeric_limits<int16_t>::min() &&
+                           number <= std::numeric_limits<int16_t>::max()) {
+                    append_be<uint32_t>(buffer, sizeof(int16_t));
+                    append_be<int16_t>(buffer, number);
+                } else if (binary_type == BINARY_INT4 &&
+                           number >= std::numeric_limits<int32_t>::min() &&
+                           number <= std::numeric_limits<int32_t>::max()) {
+                    append_be<uint32_t>(buffer, sizeof(int32_t));
+                    append_be<int32_t>(buffer, number);
+                } else if (binary_type == BINARY_INT8) {
+                    append_be<uint32_t>(buffer, sizeof(int64_t));
+                    append_be<int64_t>(buffer, number);
+                } else {
+                    append_null(buffer);
+                }
+                break;
+            }
+        case COLUMN_TYPE_REAL:
+            {
+                double number;
+                if (!parse_real(value, number)) {
+                    append_null(buffer);
+                } else if (binary_type == BINARY_FLOAT4) {
+                    float number4 = number;
+                    uint32_t bits;
+                    memcpy(&bits, &number4, sizeof(bits));
+                    append_be<uint32_t>(buffer, sizeof(bits));
+                    append_be(buffer, bits);
+                } else {
+                    append_be<uint32_t>(buffer, sizeof(double));
+                    append_float8(buffer, number);
+                }
+                break;
+            }
+        case COLUMN_TYPE_TEXT:
+            append_text(buffer, value.data(), value.size());
+            break;
+    }
+}
+
+/* The geometry comes as hex encoded (E)WKB. It is sent as EWKB with the
+ * SRID of the table. */
+void table_t::write_geom_binary(const string &geom)
+{
+    if (geom.size() < 10 || geom.size() % 2 != 0)
+        throw std::runtime_error((fmt("Invalid hex geometry %1%") % geom).str());
+
+    const size_t field = reserve_length(buffer);
+
+    //byte order and geometry type, followed by the SRID if the flag is set
+    const bool little_endian = hex_byte(geom, 0) == 1;
+    uint32_t wkb_type = 0;
+    for (size_t i = 0; i < 4; ++i) {
+        uint32_t byte = hex_byte(geom, 2 + 2 * i);
+        wkb_type |= little_endian ? byte << (8 * i) : byte << (24 - 8 * i);
+    }
+
+    buffer.push_back(little_endian ? 1 : 0);
+    append_wkb32(buffer, wkb_type | WKB_SRID_FLAG, little_endian);
+    append_wkb32(buffer, srid_num, little_endian);
+
+    const size_t body = (wkb_type & WKB_SRID_FLAG) ? 18 : 10;
+    for (size_t i = body; i < geom.size(); i += 2) {
+        buffer.push_back(static_cast<char>(hex_byte(geom, i)));
+    }
+
+    finish_field(buffer, field);
+}
+
+void table_t::write_point_binary(double lon, double lat)
+{
+    //byte order, type, SRID and two coordinates
+    append_be<uint32_t>(buffer, 1 + 4 + 4 + 2 * sizeof(double));
+    buffer.push_back(0); // big endian
+    append_be<uint32_t>(buffer, 1 | WKB_SRID_FLAG);
+    append_be<uint32_t>(buffer, srid_num);
+    append_float8(buffer, lon);
+    append_float8(buffer, lat);
+}
+
 table_t::wkb_reader table_t::get_wkb_reader(const osmid_t id)
 {
     //cant get wkb using the prepared statement without stopping the copy first
@@ -1,12 +1,22 @@
 #ifndef TABLE_H
 #define TABLE_H
 
+#include "index-scheduler.hpp"
 #include "pgsql.hpp"
 #include "osmtypes.hpp"
+#include "spatial-sort.hpp"
 #include "taginfo.hpp"
 
+#include <atomic>
+#include <condition_variable>
 #include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <map>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 #include <utility>
 #include <memory>
@@ -16,6 +26,57 @@
 
 typedef std::vector<std::string> hstores_t;
 
+class reprojection;
+
+/**
+ * Throughput of the COPY streams of a table and its clones. If the
+ * writers spend much time waiting, the database is the bottleneck.
+ */
+struct copy_stats_t
+{
+    copy_stats_t() : bytes(0), send_ms(0), wait_ms(0) {}
+
+    std::atomic<uint64_t> bytes;   ///< bytes sent
+    std::atomic<uint64_t> send_ms; ///< time spent sending them
+    std::atomic<uint64_t> wait_ms; ///< time the writer waited for a send to finish
+};
+
+/**
+ * Sends the COPY data of one table connection on a thread of its own, so
+ * that the next rows can be prepared meanwhile. At most one buffer is in
+ * flight. All senders together hold no more than a fixed number of such
+ * buffers, beyond that the data is sent on the calling thread.
+ */
+class copy_sender_t
+{
+public:
+    typedef std::function<void(const std::string &)> send_func_t;
+
+    explicit copy_sender_t(send_func_t send);
+    ~copy_sender_t();
+
+    /// Hand over the data in the buffer, which is left empty.
+    void send(std::string &buffer);
+
+    /**
+     * Wait until the data handed over was sent.
+     * \return false if nothing was in flight
+     */
+    bool wait();
+
+private:
+    void run();
+
+    send_func_t m_send;
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::string m_data;
+    bool m_busy;
+    bool m_stop;
+    std::exception_ptr m_error;
+};
+
 class table_t
 {
     public:
@@ -27,6 +88,8 @@ class table_t
 
         void start();
         void stop();
+        /// Finish the COPY and queue clustering and indexing in the scheduler.
+        void schedule_stop(index_scheduler_t &scheduler);
 
         void begin();
         void commit();
@@ -35,6 +98,13 @@ class table_t
         void write_node(const osmid_t id, const taglist_t &tags, double lat, double lon);
         void delete_row(const osmid_t id);
 
+        /**
+         * Sort the rows by geometry on the client instead of in the
+         * database. Only used on import, see --client-sort.
+         */
+        void enable_client_sort(const std::string &dir,
+                                std::shared_ptr<reprojection> projection);
+
         std::string const& get_name();
 
         struct pg_result_closer
@@ -78,10 +148,31 @@ class table_t
         wkb_reader get_wkb_reader(const osmid_t id);
 
     protected:
+        // how a column is sent in binary COPY
+        enum binary_type_t {
+            BINARY_TEXT,
+            BINARY_INT2,
+            BINARY_INT4,
+            BINARY_INT8,
+            BINARY_FLOAT4,
+            BINARY_FLOAT8
+        };
+
         void connect();
+        void start_copy();
         void stop_copy();
+        void print_copy_stats();
+        void send_copy_buffer();
+        void wait_for_copy();
+        void send_copy_data(const std::string &data);
+        void sort_row(size_t row_start, const osmid_t id, uint64_t key);
+        uint64_t text_sort_key(const std::string &geom);
+        void copy_sorted_rows();
         void teardown();
+        std::map<std::string, std::string> get_column_types();
+        bool setup_binary_types();
 
+        void write_row_text(const osmid_t id, const taglist_t &tags, const std::string &geom);
         void write_columns(const taglist_t &tags, std::string& values, std::vector<bool> *used);
         void write_tags_column(const taglist_t &tags, std::string& values,
                                const std::vector<bool> &used);
@@ -90,13 +181,31 @@ class table_t
         void escape4hstore(const char *src, std::string& dst);
         void escape_type(const std::string &value, ColumnType flags, std::string& dst);
 
+        void write_fields_binary(const osmid_t id, const taglist_t &tags);
+        void write_columns_binary(const taglist_t &tags, std::vector<bool> *used);
+        void write_tags_column_binary(const taglist_t &tags,
+                                      const std::vector<bool> &used);
+        void write_hstore_columns_binary(const taglist_t &tags);
+        void write_type_binary(const std::string &value, ColumnType type,
+                               binary_type_t binary_type);
+        void write_geom_binary(const std::string &geom);
+        void write_point_binary(double lon, double lat);
+
         std::string conninfo;
         std::string name;
         std::string type;
         pg_conn *sql_conn;
         bool copyMode;
         std::string buffer;
+        std::unique_ptr<copy_sender_t> sender; ///< created on the first send
+        std::shared_ptr<copy_stats_t> copy_stats;
+        std::shared_ptr<spatial_sorter_t> sorter; ///< shared with the clones
+        spatial_sorter_t::run_buffer_t sort_run;
+        std::string sort_wkb; ///< scratch space for decoding hex geometries
         std::string srid;
+        int srid_num;
+        bool binary; ///< use binary instead of text COPY
+        std::vector<binary_type_t> binary_types; ///< one per column
         bool append;
         bool slim;
         bool drop_temp;
@@ -108,7 +217,7 @@ class table_t
         boost::optional<std::string> table_space;
         boost::optional<std::string> table_space_index;
 
-        boost::format single_fmt, point_fmt, del_fmt;
+        boost::format single_fmt, del_fmt;
 };
 
 #endif
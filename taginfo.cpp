@@ -1,6 +1,8 @@
 #include "taginfo_impl.hpp"
 #include "util.hpp"
+#include "wildcmp.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <map>
@@ -43,23 +45,130 @@ taginfo::taginfo(const taginfo &other)
       flags(other.flags) {
 }
 
+export_matcher::export_matcher()
+    : m_exact(), m_names(), m_trie(1), m_patterns() {
+}
+
+int export_matcher::add_prefix(const std::string &prefix) {
+    int node = 0;
+    for (char c : prefix) {
+        auto &children = m_trie[node].children;
+        auto it = std::find_if(children.begin(), children.end(),
+                               [c](const std::pair<char, int> &child) { return child.first == c; });
+        if (it != children.end()) {
+            node = it->second;
+        } else {
+            const int child = (int) m_trie.size();
+            children.emplace_back(c, child);
+            // m_trie may reallocate, children is not used afterwards
+            m_trie.emplace_back();
+            node = child;
+        }
+    }
+    return node;
+}
+
+void export_matcher::add(const taginfo &info, int index) {
+    // only the first entry with a name or pattern counts
+    m_names.emplace(info.name, index);
+
+    if (!(info.flags & FLAG_DELETE)
+        || info.name.find_first_of("*?") == std::string::npos) {
+        m_exact.emplace(info.name, index);
+        return;
+    }
+
+    const size_t wildcard = info.name.find_first_of("*?");
+    if (wildcard == info.name.size() - 1 && info.name[wildcard] == '*') {
+        trie_node &node = m_trie[add_prefix(info.name.substr(0, wildcard))];
+        if (node.index < 0) {
+            node.index = index;
+        }
+        return;
+    }
+
+    m_patterns.emplace_back(info.name, index);
+}
+
+int export_matcher::match(const std::string &key) const {
+    int best = -1;
+
+    auto exact = m_exact.find(key);
+    if (exact != m_exact.end()) {
+        best = exact->second;
+    }
+
+    // every prefix of the key in the trie matches
+    int node = 0;
+    for (size_t pos = 0; ; ++pos) {
+        const int index = m_trie[node].index;
+        if (index >= 0 && (best < 0 || index < best)) {
+            best = index;
+        }
+        if (pos == key.size()) {
+            break;
+        }
+
+        const char c = key[pos];
+        const auto &children = m_trie[node].children;
+        auto it = std::find_if(children.begin(), children.end(),
+                               [c](const std::pair<char, int> &child) { return child.first == c; });
+        if (it == children.end()) {
+            break;
+        }
+        node = it->second;
+    }
+
+    for (auto const &pattern : m_patterns) {
+        if ((best < 0 || pattern.second < best)
+            && wildMatch(pattern.first.c_str(), key.c_str())) {
+            best = pattern.second;
+        }
+    }
+
+    return best;
+}
+
+int export_matcher::find_name(const std::string &name) const {
+    auto it = m_names.find(name);
+    return it == m_names.end() ? -1 : it->second;
+}
+
 export_list::export_list()
-    : num_tables(0), exportList() {
+    : num_tables(0), exportList(), matchers() {
 }
 
 void export_list::add(enum OsmType id, const taginfo &info) {
     std::vector<taginfo> &infos = get(id);
+    matchers[id].add(info, (int) infos.size());
     infos.push_back(info);
 }
 
 std::vector<taginfo> &export_list::get(enum OsmType id) {
     if (id >= num_tables) {
         exportList.resize(id+1);
+        matchers.resize(id+1);
         num_tables = id + 1;
     }
     return exportList[id];
 }
 
+const taginfo *export_list::find(enum OsmType id, const std::string &key) const {
+    if (id >= num_tables) {
+        return nullptr;
+    }
+    const int index = matchers[id].match(key);
+    return index < 0 ? nullptr : &exportList[id][index];
+}
+
+const taginfo *export_list::find_name(enum OsmType id, const std::string &name) const {
+    if (id >= num_tables) {
+        return nullptr;
+    }
+    const int index = matchers[id].find_name(name);
+    return index < 0 ? nullptr : &exportList[id][index];
+}
+
 const std::vector<taginfo> &export_list::get(enum OsmType id) const {
     // this fakes as if we have infinite taginfo vectors, but
     // means we don't actually have anything allocated unless
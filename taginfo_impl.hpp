@@ -4,6 +4,7 @@
 #include "taginfo.hpp"
 #include "osmtypes.hpp"
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include <utility>
 
@@ -36,6 +37,47 @@ struct taginfo {
     unsigned flags;
 };
 
+/**
+ * Finds the first of a list of taginfos which applies to a key, the same
+ * one a search through the list in order finds. Entries with FLAG_DELETE
+ * match their name as a wildcard pattern (see wildMatch()), all others
+ * only match their exact name.
+ *
+ * Exact names are looked up in a hash table and patterns ending in a
+ * single '*' in a trie of their prefixes, so that matching takes about
+ * the time of reading the key once. Only other patterns are tried one by
+ * one.
+ */
+class export_matcher {
+public:
+    export_matcher();
+
+    /// Add the entry with the given position in the list.
+    void add(const taginfo &info, int index);
+
+    /// Position of the first entry matching key, -1 if none.
+    int match(const std::string &key) const;
+
+    /// Position of the first entry with exactly this name, -1 if none.
+    int find_name(const std::string &name) const;
+
+private:
+    struct trie_node {
+        trie_node() : index(-1) {}
+
+        std::vector<std::pair<char, int> > children;
+        /// first entry with the prefix ending here
+        int index;
+    };
+
+    int add_prefix(const std::string &prefix);
+
+    std::unordered_map<std::string, int> m_exact;
+    std::unordered_map<std::string, int> m_names;
+    std::vector<trie_node> m_trie;
+    std::vector<std::pair<std::string, int> > m_patterns;
+};
+
 struct export_list {
     export_list();
 
@@ -43,10 +85,16 @@ struct export_list {
     std::vector<taginfo> &get(enum OsmType id);
     const std::vector<taginfo> &get(enum OsmType id) const;
 
+    /// The first entry for the type which applies to key, nullptr if none.
+    const taginfo *find(enum OsmType id, const std::string &key) const;
+    /// The first entry for the type with exactly this name, nullptr if none.
+    const taginfo *find_name(enum OsmType id, const std::string &name) const;
+
     columns_t normal_columns(OsmType id) const;
 
     int num_tables;
     std::vector<std::vector<taginfo> > exportList; /* Indexed by enum OsmType */
+    std::vector<export_matcher> matchers; /* Indexed by enum OsmType */
 };
 
 /* Parse a comma or whitespace delimited list of tags to apply to
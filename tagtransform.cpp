@@ -9,7 +9,6 @@
 #include "tagtransform.hpp"
 #include "options.hpp"
 #include "config.h"
-#include "wildcmp.hpp"
 #include "taginfo_impl.hpp"
 
 #ifdef HAVE_LUA
@@ -216,14 +215,9 @@ unsigned int c_filter_rel_member_tags(const taglist_t &rel_tags,
             if (tag.key == "area") {
                 poly_tags.push_back(tag);
             } else {
-                const std::vector<taginfo> &infos = exlist.get(OSMTYPE_WAY);
-                for (const auto& info: infos) {
-                    if (info.name == tag.key) {
-                        if (info.flags & FLAG_POLYGON) {
-                            poly_tags.push_back(tag);
-                        }
-                        break;
-                    }
+                const taginfo *info = exlist.find_name(OSMTYPE_WAY, tag.key);
+                if (info && (info->flags & FLAG_POLYGON)) {
+                    poly_tags.push_back(tag);
                 }
             }
         }
@@ -264,18 +258,9 @@ unsigned int c_filter_rel_member_tags(const taglist_t &rel_tags,
             /* We need to re-check and only keep polygon tags in the list of polytags */
             // TODO what is that for? The list is cleared just below.
             taglist_t::iterator q = poly_tags.begin();
-            const std::vector<taginfo> &infos = exlist.get(OSMTYPE_WAY);
             while (q != poly_tags.end()) {
-                bool contains_tag = false;
-                for (std::vector<taginfo>::const_iterator info = infos.begin();
-                     info != infos.end(); ++info) {
-                    if (info->name == q->key) {
-                        if (info->flags & FLAG_POLYGON) {
-                            contains_tag = true;
-                        }
-                        break;
-                    }
-                }
+                const taginfo *info = exlist.find_name(OSMTYPE_WAY, q->key);
+                bool contains_tag = info && (info->flags & FLAG_POLYGON);
 
                 if (contains_tag)
                     ++q;
@@ -321,41 +306,60 @@ unsigned int c_filter_rel_member_tags(const taglist_t &rel_tags,
 } // anonymous namespace
 
 #ifdef HAVE_LUA
+namespace {
+/* Push the tags as a new key value table. It is sized up front so that
+   it doesn't get rehashed while it is filled. */
+void push_tags(lua_State *L, const taglist_t &tags)
+{
+    lua_createtable(L, 0, tags.size());
+
+    for (const auto& tag: tags) {
+        lua_pushlstring(L, tag.key.data(), tag.key.size());
+        lua_pushlstring(L, tag.value.data(), tag.value.size());
+        lua_rawset(L, -3);
+    }
+}
+
+/* Append the key value table on top of the stack to out_tags and pop it. */
+void pop_tags(lua_State *L, taglist_t &out_tags)
+{
+    lua_pushnil(L);
+    while (lua_next(L, -2) != 0) {
+        size_t key_len, value_len;
+        const char *key = lua_tolstring(L, -2, &key_len);
+        const char *value = lua_tolstring(L, -1, &value_len);
+        if (key && value) {
+            out_tags.push_back(tag_t(std::string(key, key_len),
+                                     std::string(value, value_len)));
+        }
+        lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
+}
+} // anonymous namespace
+
 unsigned tagtransform::lua_filter_rel_member_tags(const taglist_t &rel_tags,
         const multitaglist_t &members_tags, const rolelist_t &member_roles,
         int *member_superseeded, int *make_boundary, int *make_polygon, int *roads,
         taglist_t &out_tags)
 {
-    lua_getglobal(L, m_rel_mem_func.c_str());
+    lua_rawgeti(L, LUA_REGISTRYINDEX, m_rel_mem_ref);
 
-    lua_newtable(L);    /* relations key value table */
-
-    for (const auto& rel_tag: rel_tags) {
-        lua_pushstring(L, rel_tag.key.c_str());
-        lua_pushstring(L, rel_tag.value.c_str());
-        lua_rawset(L, -3);
-    }
+    push_tags(L, rel_tags);    /* relations key value table */
 
-    lua_newtable(L);    /* member tags table */
+    lua_createtable(L, members_tags.size(), 0);    /* member tags table */
 
     int idx = 1;
     for (const auto& member_tags: members_tags) {
-        lua_pushnumber(L, idx++);
-        lua_newtable(L);    /* member key value table */
-        for (const auto& member_tag: member_tags) {
-            lua_pushstring(L, member_tag.key.c_str());
-            lua_pushstring(L, member_tag.value.c_str());
-            lua_rawset(L, -3);
-        }
-        lua_rawset(L, -3);
+        push_tags(L, member_tags);    /* member key value table */
+        lua_rawseti(L, -2, idx++);
     }
 
-    lua_newtable(L);    /* member roles table */
+    lua_createtable(L, member_roles.size(), 0);    /* member roles table */
 
     for (size_t i = 0; i < member_roles.size(); i++) {
-        lua_pushnumber(L, i + 1);
-        lua_pushstring(L, member_roles[i]->c_str());
-        lua_rawset(L, -3);
+        lua_pushlstring(L, member_roles[i]->data(), member_roles[i]->size());
+        lua_rawseti(L, -2, i + 1);
     }
 
     lua_pushnumber(L, member_roles.size());
@@ -363,6 +367,7 @@ unsigned tagtransform::lua_filter_rel_member_tags(const taglist_t &rel_tags,
     if (lua_pcall(L,4,6,0)) {
         fprintf(stderr, "Failed to execute lua function for relation tag processing: %s\n", lua_tostring(L, -1));
         /* lua function failed */
+        lua_pop(L,1);
         return 1;
     }
 
@@ -384,14 +389,7 @@ unsigned tagtransform::lua_filter_rel_member_tags(const taglist_t &rel_tags,
     }
     lua_pop(L,2);
 
-    lua_pushnil(L);
-    while (lua_next(L,-2) != 0) {
-        const char *key = lua_tostring(L,-2);
-        const char *value = lua_tostring(L,-1);
-        out_tags.push_back(tag_t(key, value));
-        lua_pop(L,1);
-    }
-    lua_pop(L,1);
+    pop_tags(L, out_tags);
 
     int filter = lua_tointeger(L, -1);
 
@@ -400,14 +398,14 @@ unsigned tagtransform::lua_filter_rel_member_tags(const taglist_t &rel_tags,
     return filter;
 }
 
-void tagtransform::check_lua_function_exists(const std::string &func_name)
+int tagtransform::lua_function_ref(const std::string &func_name)
 {
     lua_getglobal(L, func_name.c_str());
     if (!lua_isfunction (L, -1)) {
         throw std::runtime_error((boost::format("Tag transform style does not contain a function %1%")
                                   % func_name).str());
     }
-    lua_pop(L,1);
+    return luaL_ref(L, LUA_REGISTRYINDEX);
 }
 #endif
 
@@ -419,19 +417,28 @@ tagtransform::tagtransform(const options_t *options_)
     , m_way_func(    options->tag_transform_way_func.    get_value_or("filter_tags_way"))
     , m_rel_func(    options->tag_transform_rel_func.    get_value_or("filter_basic_tags_rel"))
     , m_rel_mem_func(options->tag_transform_rel_mem_func.get_value_or("filter_tags_relation_member"))
+    , m_node_ref(LUA_NOREF), m_way_ref(LUA_NOREF), m_rel_ref(LUA_NOREF), m_rel_mem_ref(LUA_NOREF)
 #endif /* HAVE_LUA */
 {
     if (transform_method) {
+#ifdef HAVE_LUAJIT
+        fprintf(stderr, "Using LuaJIT based tag processing pipeline with script %s\n", options->tag_transform_script->c_str());
+#else
         fprintf(stderr, "Using lua based tag processing pipeline with script %s\n", options->tag_transform_script->c_str());
+#endif
 #ifdef HAVE_LUA
         L = luaL_newstate();
         luaL_openlibs(L);
-        luaL_dofile(L, options->tag_transform_script->c_str());
+        if (luaL_dofile(L, options->tag_transform_script->c_str())) {
+            std::string msg = lua_tostring(L, -1);
+            lua_close(L);
+            throw std::runtime_error("Failed to load tag transform script: " + msg);
+        }
 
-        check_lua_function_exists(m_node_func);
-        check_lua_function_exists(m_way_func);
-        check_lua_function_exists(m_rel_func);
-        check_lua_function_exists(m_rel_mem_func);
+        m_node_ref = lua_function_ref(m_node_func);
+        m_way_ref = lua_function_ref(m_way_func);
+        m_rel_ref = lua_function_ref(m_rel_func);
+        m_rel_mem_ref = lua_function_ref(m_rel_mem_func);
 #else
         throw std::runtime_error("Error: Could not init lua tag transform, as lua support was not compiled into this version");
 #endif
@@ -497,38 +504,50 @@ unsigned tagtransform::filter_rel_member_tags(const taglist_t &rel_tags,
     }
 }
 
+const std::string *tagtransform::lua_function(OsmType type) const
+{
+#ifdef HAVE_LUA
+    if (transform_method) {
+        switch (type) {
+        case OSMTYPE_NODE:
+            return &m_node_func;
+        case OSMTYPE_WAY:
+            return &m_way_func;
+        case OSMTYPE_RELATION:
+            return &m_rel_func;
+        }
+    }
+#endif
+    return nullptr;
+}
+
 unsigned tagtransform::lua_filter_basic_tags(OsmType type, const taglist_t &tags,
                                              int *polygon, int *roads, taglist_t &out_tags)
 {
 #ifdef HAVE_LUA
     switch (type) {
     case OSMTYPE_NODE: {
-        lua_getglobal(L, m_node_func.c_str());
+        lua_rawgeti(L, LUA_REGISTRYINDEX, m_node_ref);
         break;
     }
     case OSMTYPE_WAY: {
-        lua_getglobal(L, m_way_func.c_str());
+        lua_rawgeti(L, LUA_REGISTRYINDEX, m_way_ref);
         break;
     }
     case OSMTYPE_RELATION: {
-        lua_getglobal(L, m_rel_func.c_str());
+        lua_rawgeti(L, LUA_REGISTRYINDEX, m_rel_ref);
         break;
     }
     }
 
-    lua_newtable(L);    /* key value table */
-
-    for (taglist_t::const_iterator it = tags.begin(); it != tags.end(); ++it) {
-        lua_pushstring(L, it->key.c_str());
-        lua_pushstring(L, it->value.c_str());
-        lua_rawset(L, -3);
-    }
+    push_tags(L, tags);    /* key value table */
 
     lua_pushinteger(L, tags.size());
 
     if (lua_pcall(L,2,type == OSMTYPE_WAY ? 4 : 2,0)) {
         fprintf(stderr, "Failed to execute lua function for basic tag processing: %s\n", lua_tostring(L, -1));
         /* lua function failed */
+        lua_pop(L,1);
         return 1;
     }
 
@@ -541,17 +560,11 @@ unsigned tagtransform::lua_filter_basic_tags(OsmType type, const taglist_t &tags
         lua_pop(L,1);
     }
 
-    lua_pushnil(L);
-    while (lua_next(L,-2) != 0) {
-        const char *key = lua_tostring(L,-2);
-        const char *value = lua_tostring(L,-1);
-        out_tags.push_back(tag_t(key, value));
-        lua_pop(L,1);
-    }
+    pop_tags(L, out_tags);
 
-    int filter = lua_tointeger(L, -2);
+    int filter = lua_tointeger(L, -1);
 
-    lua_pop(L,2);
+    lua_pop(L,1);
 
     return filter;
 #else
@@ -577,7 +590,6 @@ unsigned int tagtransform::c_filter_basic_tags(OsmType type, const taglist_t &ta
     } else {
         export_type = type;
     }
-    const std::vector<taginfo> &infos = exlist.get(export_type);
 
     /* We used to only go far enough to determine if it's a polygon or not,
        but now we go through and filter stuff we don't need
@@ -602,25 +614,17 @@ unsigned int tagtransform::c_filter_basic_tags(OsmType type, const taglist_t &ta
         }
 
         //go through the actual tags found on the item and keep the ones in the export list
-        size_t i = 0;
-        for (; i < infos.size(); i++) {
-            const taginfo &info = infos[i];
-            if (info.flags & FLAG_DELETE) {
-                if (wildMatch(info.name.c_str(), item->key.c_str())) {
-                    break;
-                }
-            } else if (info.name == item->key) {
-                filter = 0;
-                flags |= info.flags;
+        const taginfo *info = exlist.find(export_type, item->key);
+        if (info && !(info->flags & FLAG_DELETE)) {
+            filter = 0;
+            flags |= info->flags;
 
-                out_tags.push_back(*item);
-                break;
-            }
+            out_tags.push_back(*item);
         }
 
         // if we didn't find any tags that we wanted to export
         // and we aren't strictly adhering to the list
-        if (i == infos.size() && !strict) {
+        if (!info && !strict) {
             if (options->hstore_mode != HSTORE_NONE) {
                 /* with hstore, copy all tags... */
                 out_tags.push_back(*item);
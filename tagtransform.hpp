@@ -18,6 +18,15 @@ extern "C" {
 
 
 
+/**
+ * Filters and rewrites the tags of objects, either with the built-in rules
+ * and the export list or with a Lua script.
+ *
+ * With a script every instance has its own Lua state, which must only be
+ * used by one thread at a time. Outputs create a new tagtransform whenever
+ * they are cloned, so every thread of the parse and pending pipelines runs
+ * its own interpreter.
+ */
 class tagtransform {
 public:
 	tagtransform(const options_t *options_);
@@ -34,6 +43,9 @@ public:
         int *member_superseeded, int *make_boundary, int *make_polygon, int *roads,
         const export_list &exlist, taglist_t &out_tags, bool allow_typeless = false);
 
+    /// the Lua function called for objects of the type, nullptr with the built-in transform
+    const std::string *lua_function(OsmType type) const;
+
 private:
     unsigned lua_filter_basic_tags(OsmType type, const taglist_t &tags,
                                    int *polygon, int *roads, taglist_t &out_tags);
@@ -44,7 +56,7 @@ private:
         const multitaglist_t &members_tags, const rolelist_t &member_roles,
         int *member_superseeded, int *make_boundary, int *make_polygon, int *roads,
         taglist_t &out_tags);
-    void check_lua_function_exists(const std::string &func_name);
+    int lua_function_ref(const std::string &func_name);
 
 
 	const options_t* options;
@@ -52,6 +64,8 @@ private:
 #ifdef HAVE_LUA
 	lua_State *L;
     const std::string m_node_func, m_way_func, m_rel_func, m_rel_mem_func;
+    // the filter functions in the registry, saves a global lookup per call
+    int m_node_ref, m_way_ref, m_rel_ref, m_rel_mem_ref;
 #endif
 
 };
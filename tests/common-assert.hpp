@@ -0,0 +1,19 @@
+#ifndef TEST_COMMON_ASSERT_HPP
+#define TEST_COMMON_ASSERT_HPP
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+/* Checks for the tests which don't need a database, a failed one ends the
+ * test with the message. */
+
+inline void assert_true(bool cond, const std::string &msg)
+{
+    if (!cond) {
+        std::cerr << msg << "\n";
+        exit(1);
+    }
+}
+
+#endif /* TEST_COMMON_ASSERT_HPP */
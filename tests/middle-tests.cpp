@@ -156,6 +156,36 @@ struct test_pending_processor : public middle_t::pending_processor {
     std::list<osmid_t> pending_rels;
 };
 
+int test_node_modify(slim_middle_t *mid)
+{
+  taglist_t tags;
+  idlist_t ids;
+  ids.push_back(1234);
+
+  for (int round = 0; round < 3; ++round) {
+    expected_node expected(1234, 12.5 + round, 98.5 - round);
+
+    // the node is modified, then a node from another block follows
+    mid->nodes_delete(expected.id);
+    mid->nodes_set(expected.id, expected.lat, expected.lon, tags);
+    mid->nodes_delete(expected.id + PER_BLOCK * 10);
+    mid->nodes_set(expected.id + PER_BLOCK * 10, expected.lat, expected.lon, tags);
+
+    mid->commit();
+
+    nodelist_t nodes;
+    if (mid->nodes_get_list(nodes, ids) != ids.size()) { std::cerr << "ERROR: Unable to get node list.\n"; return 1; }
+    if (!node_okay(nodes[0], expected)) {
+      std::cerr << "ERROR: Outdated location after change file " << round << ".\n";
+      return 1;
+    }
+
+    mid->changes_done();
+  }
+
+  return 0;
+}
+
 int test_way_set(middle_t *mid)
 {
   osmid_t way_id = 1;
@@ -228,13 +258,23 @@ int test_way_set(middle_t *mid)
       // finally, try touching a node on a non-pending way. that should
       // make it become pending. we just checked that the way is not
       // pending, so any change must be due to the node changing.
+      // the changes are only resolved on commit, changing a node more
+      // than once still marks the way once.
       slim->node_changed(nds[0]);
-      slim->iterate_ways(tpp);
+      slim->node_changed(nds[1]);
+      slim->node_changed(nds[0]);
+      slim->commit();
       if (slim->pending_count() != 1) {
           std::cerr << "ERROR: Was expecting a single pending way from node update, but got "
                     << slim->pending_count() << " from middle.\n";
           return 1;
       }
+      slim->iterate_ways(tpp);
+      if (slim->pending_count() != 0) {
+          std::cerr << "ERROR: Was expecting no pending ways after iterating, but got "
+                    << slim->pending_count() << " from middle.\n";
+          return 1;
+      }
   }
 
   return 0;
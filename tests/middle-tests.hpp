@@ -13,4 +13,8 @@ int test_nodes_comprehensive_set(middle_t *mid);
 // returns 0 on success.
 int test_way_set(middle_t *mid);
 
+// tests that a node modified in successive change files is read back with
+// its latest location. returns 0 on success.
+int test_node_modify(slim_middle_t *mid);
+
 #endif /* TESTS_MIDDLE_TEST_HPP */
@@ -0,0 +1,66 @@
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "change-dir.hpp"
+#include "tests/common-assert.hpp"
+
+namespace fs = boost::filesystem;
+
+void touch(const fs::path &path) {
+  fs::create_directories(path.parent_path());
+  std::ofstream out(path.string());
+  out << "<osmChange/>\n";
+}
+
+int main(int argc, char *argv[]) {
+  const fs::path dir = fs::temp_directory_path() / fs::unique_path("osm2pgsql-test-%%%%-%%%%");
+  fs::create_directories(dir);
+
+  touch(dir / "000" / "001" / "010.osc");
+  touch(dir / "000" / "001" / "002.osc.gz");
+  touch(dir / "000" / "000" / "999.osc.bz2");
+  // files still being downloaded or of other types are left out
+  touch(dir / "000" / "001" / "011.osc.gz.tmp");
+  touch(dir / "000" / "001" / "011.state.txt");
+
+  {
+    change_dir_t changes(dir.string());
+    assert_true(changes.last_applied().empty(), "State without state file.");
+
+    std::vector<std::string> files = changes.new_files();
+    assert_true(files.size() == 3, "Wrong number of change files.");
+    assert_true(files[0] == "000/000/999.osc.bz2", "Wrong first change file.");
+    assert_true(files[1] == "000/001/002.osc.gz", "Wrong second change file.");
+    assert_true(files[2] == "000/001/010.osc", "Wrong third change file.");
+    assert_true(fs::exists(changes.path(files[0])), "Wrong path of change file.");
+
+    changes.applied(files[0]);
+    changes.applied(files[1]);
+    files = changes.new_files();
+    assert_true(files.size() == 1 && files[0] == "000/001/010.osc", "Applied files not skipped.");
+  }
+
+  {
+    // the state survives a restart, new files show up
+    touch(dir / "000" / "002" / "000.osc.gz");
+    change_dir_t changes(dir.string());
+    assert_true(changes.last_applied() == "000/001/002.osc.gz", "State not read back.");
+
+    std::vector<std::string> files = changes.new_files();
+    assert_true(files.size() == 2, "Wrong number of new change files.");
+    assert_true(files[1] == "000/002/000.osc.gz", "New change file missing.");
+  }
+
+  // the expire list of a change file is named after its path
+  assert_true(change_dir_t::expire_list("dirty_tiles", "000/001/002.osc.gz") ==
+              "dirty_tiles.000-001-002", "Wrong expire list name.");
+  assert_true(change_dir_t::expire_list("/tmp/tiles", "diff.osc") == "/tmp/tiles.diff",
+              "Wrong expire list name for a plain file.");
+
+  fs::remove_all(dir);
+
+  return 0;
+}
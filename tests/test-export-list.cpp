@@ -0,0 +1,121 @@
+/*
+ * Test that export_list::find() finds the same entry as going through the
+ * export list in order.
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "taginfo_impl.hpp"
+#include "wildcmp.hpp"
+
+namespace {
+
+const taginfo *linear_find(const std::vector<taginfo> &infos, const std::string &key)
+{
+    for (const auto &info : infos) {
+        if (info.flags & FLAG_DELETE) {
+            if (wildMatch(info.name.c_str(), key.c_str())) {
+                return &info;
+            }
+        } else if (info.name == key) {
+            return &info;
+        }
+    }
+    return nullptr;
+}
+
+void add(export_list &exlist, const std::string &name, unsigned flags)
+{
+    taginfo info;
+    info.name = name;
+    info.type = "text";
+    info.flags = flags;
+    exlist.add(OSMTYPE_WAY, info);
+}
+
+int check(const export_list &exlist, OsmType type, const std::vector<std::string> &keys)
+{
+    int ret = 0;
+
+    for (const auto &key : keys) {
+        const taginfo *expected = linear_find(exlist.get(type), key);
+        const taginfo *found = exlist.find(type, key);
+        if (found != expected) {
+            std::cerr << "Wrong export list entry for key '" << key << "':";
+            std::cerr << "\n  expected: " << (expected ? expected->name : "none");
+            std::cerr << "\n  got: " << (found ? found->name : "none") << "\n";
+            ret = 1;
+        }
+    }
+
+    return ret;
+}
+
+} // anonymous namespace
+
+int main()
+{
+    const std::vector<std::string> keys = {
+        "", "highway", "name", "name:de", "note", "note:en", "notes", "source",
+        "source:geometry", "tiger:county", "tiger", "tig", "building",
+        "addr:housenumber", "fixme", "FIXME", "kinla", "kinxla", "kinxlaa",
+        "bar", "Hausbar", "way_area", "b", "ba", "bazz", "z", "zz"
+    };
+
+    int ret = 0;
+
+    {
+        // delete entries before and after normal ones with the same key
+        export_list exlist;
+        add(exlist, "note", FLAG_DELETE);
+        add(exlist, "note:*", FLAG_DELETE);
+        add(exlist, "highway", FLAG_LINEAR);
+        add(exlist, "highway", FLAG_POLYGON);
+        add(exlist, "name", FLAG_LINEAR);
+        add(exlist, "na*", FLAG_DELETE);
+        add(exlist, "tiger:*", FLAG_DELETE);
+        add(exlist, "kin*la", FLAG_DELETE);
+        add(exlist, "*bar", FLAG_DELETE);
+        add(exlist, "b?", FLAG_DELETE);
+        add(exlist, "bar", FLAG_LINEAR);
+        add(exlist, "building", FLAG_POLYGON);
+        add(exlist, "building*", FLAG_DELETE);
+        add(exlist, "z*", FLAG_DELETE);
+        add(exlist, "z", FLAG_LINEAR);
+        ret |= check(exlist, OSMTYPE_WAY, keys);
+
+        const taginfo *highway = exlist.find(OSMTYPE_WAY, "highway");
+        if (!highway || highway->flags != FLAG_LINEAR) {
+            std::cerr << "Not the first entry for highway.\n";
+            ret = 1;
+        }
+        if (exlist.find(OSMTYPE_NODE, "highway")) {
+            std::cerr << "Found entry for type without entries.\n";
+            ret = 1;
+        }
+        const taginfo *z = exlist.find_name(OSMTYPE_WAY, "z");
+        if (!z || z->flags != FLAG_LINEAR) {
+            std::cerr << "Wrong entry from find_name.\n";
+            ret = 1;
+        }
+    }
+
+    {
+        // a delete-everything pattern goes first
+        export_list exlist;
+        add(exlist, "*", FLAG_DELETE);
+        add(exlist, "highway", FLAG_LINEAR);
+        ret |= check(exlist, OSMTYPE_WAY, keys);
+    }
+
+    {
+        export_list exlist;
+        read_style_file("default.style", &exlist);
+        ret |= check(exlist, OSMTYPE_NODE, keys);
+        ret |= check(exlist, OSMTYPE_WAY, keys);
+    }
+
+    return ret;
+}
@@ -0,0 +1,93 @@
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+
+#include <boost/format.hpp>
+
+#include "geometry-builder.hpp"
+
+namespace {
+
+void run_test(const char* test_name, void (*testfunc)())
+{
+    try
+    {
+        fprintf(stderr, "%s\n", test_name);
+        testfunc();
+    }
+    catch(const std::exception& e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        fprintf(stderr, "FAIL\n");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stderr, "PASS\n");
+}
+#define RUN_TEST(x) run_test(#x, &(x))
+#define ASSERT_EQ(a, b) { if (!((a) == (b))) { throw std::runtime_error((boost::format("Expecting %1% == %2%, but %3% != %4%") % #a % #b % (a) % (b)).str()); } }
+
+nodelist_t square(double min, double max)
+{
+    nodelist_t nodes;
+    nodes.push_back(osmNode(min, min));
+    nodes.push_back(osmNode(max, min));
+    nodes.push_back(osmNode(max, max));
+    nodes.push_back(osmNode(min, max));
+    nodes.push_back(osmNode(min, min));
+    return nodes;
+}
+
+// an outer ring with a hole containing an island with a lake, and a
+// separate small polygon
+multinodelist_t nested_rings()
+{
+    multinodelist_t xnodes;
+    xnodes.push_back(square(3, 7));
+    xnodes.push_back(square(20, 21));
+    xnodes.push_back(square(0, 10));
+    xnodes.push_back(square(2, 8));
+    xnodes.push_back(square(1, 9));
+    return xnodes;
+}
+
+void test_nested_polygons()
+{
+    geometry_builder builder;
+    auto wkbs = builder.build_polygons(nested_rings(), false);
+
+    ASSERT_EQ(wkbs.size(), 3);
+    ASSERT_EQ(wkbs[0].area, 100.0 - 64.0);
+    ASSERT_EQ(wkbs[1].area, 36.0 - 16.0);
+    ASSERT_EQ(wkbs[2].area, 1.0);
+}
+
+void test_nested_multipolygon()
+{
+    geometry_builder builder;
+    auto wkbs = builder.build_polygons(nested_rings(), true);
+
+    ASSERT_EQ(wkbs.size(), 1);
+    ASSERT_EQ(wkbs[0].area, 100.0 - 64.0 + 36.0 - 16.0 + 1.0);
+}
+
+void test_nested_both()
+{
+    geometry_builder builder;
+    auto wkbs = builder.build_both(nested_rings(), true, false, 100000);
+
+    ASSERT_EQ(wkbs.size(), 3);
+    ASSERT_EQ(wkbs[0].area, 100.0 - 64.0);
+    ASSERT_EQ(wkbs[1].area, 36.0 - 16.0);
+    ASSERT_EQ(wkbs[2].area, 1.0);
+}
+
+} // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+    RUN_TEST(test_nested_polygons);
+    RUN_TEST(test_nested_multipolygon);
+    RUN_TEST(test_nested_both);
+
+    return 0;
+}
@@ -0,0 +1,80 @@
+#include <random>
+#include <set>
+
+#include "id-tracker.hpp"
+#include "tests/common-assert.hpp"
+
+// the tracker has to behave like a set of ids, also for ids of all sizes
+// and blocks switching from arrays to bitmaps
+void test_random() {
+  id_tracker tracker;
+  std::set<osmid_t> expected;
+  std::mt19937_64 rng(42);
+
+  auto random_id = [&rng]() -> osmid_t {
+    switch (rng() % 4) {
+    case 0: return osmid_t(rng() % 100000); // dense blocks
+    case 1: return osmid_t(rng() % 5000000000LL); // sparse, several chunks
+    case 2: return -osmid_t(rng() % 70000);
+    default: return osmid_t(rng() % 200) + 3 * 65536;
+    }
+  };
+
+  for (int round = 0; round < 5; ++round) {
+    for (int i = 0; i < 20000; ++i) {
+      osmid_t id = random_id();
+      tracker.mark(id);
+      expected.insert(id);
+    }
+    assert_true(tracker.size() == expected.size(), "Wrong size after marking.");
+
+    for (int i = 0; i < 1000; ++i) {
+      osmid_t id = random_id();
+      assert_true(tracker.is_marked(id) == (expected.count(id) > 0), "Wrong is_marked.");
+    }
+
+    // take out some in bulk and some one by one
+    osmid_t limit = random_id();
+    idlist_t popped;
+    while (tracker.pop_marks_before(limit, popped, 1000) > 0) {}
+    for (osmid_t id : popped) {
+      assert_true(id == *expected.begin() && id < limit, "Wrong id from pop_marks_before.");
+      expected.erase(expected.begin());
+    }
+    assert_true(expected.empty() || *expected.begin() >= limit, "Ids left before limit.");
+
+    for (int i = 0; i < 500 && !expected.empty(); ++i) {
+      assert_true(tracker.pop_mark() == *expected.begin(), "Wrong id from pop_mark.");
+      expected.erase(expected.begin());
+    }
+    assert_true(tracker.size() == expected.size(), "Wrong size after popping.");
+  }
+
+  while (!expected.empty()) {
+    assert_true(tracker.pop_mark() == *expected.begin(), "Wrong id from pop_mark.");
+    expected.erase(expected.begin());
+  }
+  assert_true(!id_tracker::is_valid(tracker.pop_mark()), "Tracker not empty.");
+  assert_true(tracker.size() == 0, "Size of empty tracker not 0.");
+}
+
+int main(int argc, char *argv[]) {
+  test_random();
+
+  {
+    // ids marked again after popping come out again, in order
+    id_tracker tracker;
+    tracker.mark(10);
+    tracker.mark(20);
+    assert_true(tracker.pop_mark() == 10, "Expected 10.");
+    tracker.mark(5);
+    tracker.mark(20);
+    assert_true(tracker.size() == 2, "Marking twice counted twice.");
+    idlist_t ids;
+    assert_true(tracker.pop_marks_before(id_tracker::max(), ids, 10) == 2, "Expected two ids.");
+    assert_true(ids[0] == 5 && ids[1] == 20, "Wrong ids.");
+    assert_true(tracker.last_returned() == 20, "Wrong last returned id.");
+  }
+
+  return 0;
+}
@@ -0,0 +1,100 @@
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "index-scheduler.hpp"
+#include "tests/common-assert.hpp"
+
+int main(int argc, char *argv[]) {
+  {
+    // with one process the biggest table comes first, steps stay in order
+    index_scheduler_t scheduler(1);
+    std::vector<std::string> done;
+
+    for (auto size : {10, 30, 20}) {
+      std::string name = std::to_string(size);
+      index_scheduler_t::job_t job(name, size);
+      job.add_step("first " + name, [&done, name]() { done.push_back(name + "a"); });
+      job.add_step("second " + name, [&done, name]() { done.push_back(name + "b"); });
+      scheduler.add(std::move(job));
+    }
+    scheduler.run();
+
+    std::vector<std::string> expected = {"30a", "30b", "20a", "20b", "10a", "10b"};
+    assert_true(done == expected, "Jobs did not run biggest first.");
+  }
+
+  {
+    // no more jobs than allowed run at the same time
+    index_scheduler_t scheduler(2);
+    std::atomic<int> running(0);
+    std::atomic<int> max_running(0);
+
+    for (int i = 0; i < 6; ++i) {
+      index_scheduler_t::job_t job("job", 0);
+      job.add_step("work", [&running, &max_running]() {
+        int now = ++running;
+        int seen = max_running;
+        while (now > seen && !max_running.compare_exchange_weak(seen, now)) {}
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        --running;
+      });
+      scheduler.add(std::move(job));
+    }
+    scheduler.run();
+
+    assert_true(max_running == 2, "Wrong number of jobs ran at the same time.");
+  }
+
+  {
+    // without a limit all jobs run at the same time
+    index_scheduler_t scheduler(0);
+    std::atomic<int> running(0);
+    std::atomic<int> max_running(0);
+
+    for (int i = 0; i < 4; ++i) {
+      index_scheduler_t::job_t job("job", 0);
+      job.add_step("work", [&running, &max_running]() {
+        int now = ++running;
+        int seen = max_running;
+        while (now > seen && !max_running.compare_exchange_weak(seen, now)) {}
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        --running;
+      });
+      scheduler.add(std::move(job));
+    }
+    scheduler.run();
+
+    assert_true(max_running == 4, "Jobs without a limit did not run at the same time.");
+  }
+
+  {
+    // a failed step is reported and no new jobs are started
+    index_scheduler_t scheduler(1);
+    int later_steps = 0;
+
+    index_scheduler_t::job_t failing("failing", 2);
+    failing.add_step("fail", []() { throw std::runtime_error("index failed"); });
+    failing.add_step("after fail", [&later_steps]() { ++later_steps; });
+    scheduler.add(std::move(failing));
+
+    index_scheduler_t::job_t other("other", 1);
+    other.add_step("other", [&later_steps]() { ++later_steps; });
+    scheduler.add(std::move(other));
+
+    bool thrown = false;
+    try {
+      scheduler.run();
+    } catch (const std::runtime_error &e) {
+      thrown = std::string(e.what()) == "index failed";
+    }
+    assert_true(thrown, "Error of a step was not rethrown.");
+    assert_true(later_steps == 0, "Steps ran after an error.");
+  }
+
+  return 0;
+}
@@ -106,6 +106,10 @@ int main(int argc, char *argv[]) {
     options.alloc_chunkwise = ALLOC_DENSE | ALLOC_DENSE_CHUNK; // what you get with chunk
     run_tests(options, "chunk");
 
+    options.flat_node_mmap = true;
+    options.alloc_chunkwise = ALLOC_SPARSE | ALLOC_DENSE;
+    run_tests(options, "optimized, memory mapped");
+
   } catch (const std::exception &e) {
     std::cerr << "ERROR: " << e.what() << std::endl;
     return 1;
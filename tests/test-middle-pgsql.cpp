@@ -60,6 +60,61 @@ void run_tests(options_t options, const std::string cache_type) {
     mid_pgsql.stop();
   }
 }
+// a node modified in several change files of one run (--watch-dir)
+void run_node_modify(options_t options) {
+  options.append = false;
+  options.create = true;
+  {
+    middle_pgsql_t mid_pgsql;
+    output_null_t out_test(&mid_pgsql, options);
+
+    mid_pgsql.start(&options);
+    mid_pgsql.commit();
+    mid_pgsql.stop();
+  }
+
+  options.append = true;
+  options.create = false;
+  {
+    middle_pgsql_t mid_pgsql;
+    output_null_t out_test(&mid_pgsql, options);
+
+    mid_pgsql.start(&options);
+    if (test_node_modify(&mid_pgsql) != 0) { throw std::runtime_error("test_node_modify failed."); }
+
+    mid_pgsql.stop();
+  }
+}
+
+// updates use the way node table of the import, with or without the option
+void run_way_node_table_update(options_t options, bool option_on_update) {
+  options.append = false;
+  options.create = true;
+  options.way_node_table = true;
+  {
+    middle_pgsql_t mid_pgsql;
+    output_null_t out_test(&mid_pgsql, options);
+
+    mid_pgsql.start(&options);
+    mid_pgsql.commit();
+    mid_pgsql.stop();
+  }
+
+  options.append = true;
+  options.create = false;
+  options.way_node_table = option_on_update;
+  {
+    middle_pgsql_t mid_pgsql;
+    output_null_t out_test(&mid_pgsql, options);
+
+    mid_pgsql.start(&options);
+    if (test_way_set(&mid_pgsql) != 0) { throw std::runtime_error("test_way_set failed."); }
+
+    mid_pgsql.commit();
+    mid_pgsql.stop();
+  }
+}
+
 int main(int argc, char *argv[]) {
   std::unique_ptr<pg::tempdb> db;
 
@@ -89,6 +144,32 @@ int main(int argc, char *argv[]) {
 
     options.alloc_chunkwise = ALLOC_DENSE | ALLOC_DENSE_CHUNK; // what you get with chunk
     run_tests(options, "chunk");
+
+    options.alloc_chunkwise = ALLOC_COMPRESSED;
+    run_tests(options, "compressed");
+
+    options.alloc_chunkwise = ALLOC_SPARSE | ALLOC_DENSE;
+    run_node_modify(options);
+    options.alloc_chunkwise = ALLOC_SPARSE;
+    run_node_modify(options);
+    options.alloc_chunkwise = ALLOC_COMPRESSED;
+    run_node_modify(options);
+
+    options.way_node_table = true;
+    run_tests(options, "way node table");
+    db->assert_has_table("osm2pgsql_test_way_nodes");
+
+    // a new import without the option doesn't keep the old table
+    options.way_node_table = false;
+    run_tests(options, "compressed");
+    db->check_count(0, "SELECT count(*) FROM pg_catalog.pg_class "
+                       "WHERE relname = 'osm2pgsql_test_way_nodes'");
+
+    // an update without the option still keeps the table of the import
+    run_way_node_table_update(options, false);
+    db->check_count(10, "SELECT count(*) FROM osm2pgsql_test_way_nodes WHERE way_id = 1");
+    run_way_node_table_update(options, true);
+    db->check_count(10, "SELECT count(*) FROM osm2pgsql_test_way_nodes WHERE way_id = 1");
   } catch (const std::exception &e) {
     std::cerr << "ERROR: " << e.what() << std::endl;
     return 1;
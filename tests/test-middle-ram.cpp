@@ -9,6 +9,7 @@
 #include "output-null.hpp"
 #include "options.hpp"
 #include "middle-ram.hpp"
+#include "node-ram-cache.hpp"
 
 #include "tests/middle-tests.hpp"
 
@@ -45,6 +46,51 @@ void run_tests(const options_t options, const std::string cache_type) {
   }
 }
 
+// with --locations-on-ways the way node lists carry the locations
+void test_locations_on_ways(options_t options) {
+  options.locations_on_ways = true;
+
+  middle_ram_t mid_ram;
+  output_null_t out_test(&mid_ram, options);
+
+  mid_ram.start(&options);
+
+  std::vector<ramNode> locations;
+  idlist_t nds;
+  for (int i = 0; i < 5; ++i) {
+    locations.push_back(ramNode(98.7654321 - i, -12.3456789 + i));
+    nds.push_back(locations.back().packed());
+  }
+
+  // nodes are not stored at all
+  mid_ram.nodes_set(1, 1.0, 1.0, taglist_t());
+  nodelist_t nodes;
+  idlist_t node_ids(1, 1);
+  if (mid_ram.nodes_get_list(nodes, node_ids) != 1 || nodes[0].lon == 1.0) {
+    throw std::runtime_error("Node list was not read as locations.");
+  }
+
+  mid_ram.ways_set(1, nds, taglist_t());
+
+  idlist_t ways(1, 1), xways;
+  std::vector<taglist_t> xtags;
+  multinodelist_t xnodes;
+  if (mid_ram.ways_get_list(ways, xways, xtags, xnodes) != 1) {
+    throw std::runtime_error("Unable to get way with locations.");
+  }
+  if (xnodes[0].size() != locations.size()) {
+    throw std::runtime_error("Way with locations has wrong number of nodes.");
+  }
+  for (size_t i = 0; i < locations.size(); ++i) {
+    if (xnodes[0][i].lon != locations[i].lon() || xnodes[0][i].lat != locations[i].lat()) {
+      throw std::runtime_error("Way node has wrong location.");
+    }
+  }
+
+  mid_ram.commit();
+  mid_ram.stop();
+}
+
 int main(int argc, char *argv[]) {
   try {
     options_t options;
@@ -62,6 +108,11 @@ int main(int argc, char *argv[]) {
 
     options.alloc_chunkwise = ALLOC_DENSE | ALLOC_DENSE_CHUNK; // what you get with chunk
     run_tests(options, "chunk");
+
+    options.alloc_chunkwise = ALLOC_COMPRESSED;
+    run_tests(options, "compressed");
+
+    test_locations_on_ways(options);
   } catch (const std::exception &e) {
     std::cerr << "ERROR: " << e.what() << std::endl;
     return 1;
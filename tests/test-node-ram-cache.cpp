@@ -0,0 +1,154 @@
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+#include "node-ram-cache.hpp"
+#include "tests/common-assert.hpp"
+
+double lat_of(osmid_t id) { return 10.0 + (id % 1000) * 0.001; }
+double lon_of(osmid_t id) { return 20.0 - (id % 777) * 0.001; }
+
+// every lookup must find exactly the nodes stored, with and without batches
+void test_strategy(int strategy, const std::string &name) {
+  node_ram_cache cache(strategy, 100, 10000000);
+
+  // enough nodes for several levels of the sparse index, with gaps
+  idlist_t stored;
+  for (osmid_t id = 1; id < 300000; id += 1 + (id % 7) * (id % 5)) {
+    cache.set(id, lat_of(id), lon_of(id), taglist_t());
+    stored.push_back(id);
+  }
+
+  idlist_t lookup;
+  for (osmid_t id = -5; id < 300010; id += 3) {
+    lookup.push_back(id);
+  }
+  // ways aren't sorted by node id
+  lookup.insert(lookup.end(), stored.rbegin(), stored.rend());
+
+  nodelist_t batch;
+  size_t hits = cache.get_list(batch, lookup);
+  assert_true(batch.size() == lookup.size(), name + ": wrong size of batch result.");
+
+  size_t expected_hits = 0;
+  for (size_t i = 0; i < lookup.size(); ++i) {
+    const osmid_t id = lookup[i];
+    const bool known = std::binary_search(stored.begin(), stored.end(), id);
+
+    osmNode single;
+    const bool found = cache.get(&single, id) == 0;
+    assert_true(found == known, name + ": get() wrong for node " + std::to_string(id));
+    assert_true(std::isnan(batch[i].lat) == !known,
+                name + ": get_list() wrong for node " + std::to_string(id));
+
+    if (known) {
+      ++expected_hits;
+      assert_true(std::fabs(single.lat - lat_of(id)) < 1e-6 &&
+                  std::fabs(single.lon - lon_of(id)) < 1e-6,
+                  name + ": wrong location from get().");
+      assert_true(batch[i].lat == single.lat && batch[i].lon == single.lon,
+                  name + ": wrong location from get_list().");
+    }
+  }
+  assert_true(hits == expected_hits, name + ": wrong number of hits from get_list().");
+}
+
+// a node for a block which has been compressed already must not get lost
+void test_out_of_order(int strategy, const std::string &name) {
+  node_ram_cache cache(strategy, 100, 10000000);
+
+  const osmid_t ids[] = { 5, 100000, 7, 3 };
+  for (osmid_t id : ids) {
+    cache.set(id, lat_of(id), lon_of(id), taglist_t());
+  }
+
+  for (osmid_t id : ids) {
+    osmNode node;
+    assert_true(cache.get(&node, id) == 0,
+                name + ": out of order node " + std::to_string(id) + " lost.");
+    assert_true(std::fabs(node.lat - lat_of(id)) < 1e-6 &&
+                std::fabs(node.lon - lon_of(id)) < 1e-6,
+                name + ": wrong location for out of order node.");
+  }
+}
+
+// a removed node must not be found any more, also after it has been set
+// again and the cache dropped the new location
+void test_remove(int strategy, const std::string &name) {
+  node_ram_cache cache(strategy | ALLOC_LOSSY, 100, 10000000);
+
+  for (osmid_t id = 1; id < 100000; id += 3) {
+    cache.set(id, lat_of(id), lon_of(id), taglist_t());
+  }
+
+  const osmid_t ids[] = { 1, 4, 50002, 99997 };
+  for (osmid_t id : ids) {
+    cache.remove(id);
+    osmNode node;
+    assert_true(cache.get(&node, id) != 0,
+                name + ": removed node " + std::to_string(id) + " found.");
+    cache.set(id, lat_of(id) + 1.0, lon_of(id), taglist_t());
+    if (cache.get(&node, id) == 0) {
+      assert_true(std::fabs(node.lat - lat_of(id) - 1.0) < 1e-6,
+                  name + ": outdated location for node " + std::to_string(id));
+    }
+  }
+
+  // the other nodes of the blocks are still there
+  idlist_t lookup;
+  lookup.push_back(7);
+  lookup.push_back(50005);
+  nodelist_t batch;
+  assert_true(cache.get_list(batch, lookup) == lookup.size(),
+              name + ": nodes next to a removed node lost.");
+}
+
+// writing blocks again must not leave the space of the old copies in use
+void test_rewrite(int strategy, const std::string &name) {
+  node_ram_cache cache(strategy, 100, 10000000);
+
+  int64_t used = 0;
+  for (int round = 0; round < 3; ++round) {
+    for (osmid_t id = 1; id < 100000; id += 3) {
+      cache.set(id, lat_of(id), lon_of(id), taglist_t());
+    }
+    // a node from another block gets the last one compressed
+    cache.set(1000000, lat_of(1000000), lon_of(1000000), taglist_t());
+
+    if (round == 0) {
+      used = cache.used_memory();
+      assert_true(used > 0, name + ": no memory used.");
+    } else {
+      assert_true(cache.used_memory() == used,
+                  name + ": memory used grows when blocks are written again.");
+    }
+  }
+
+  for (osmid_t id = 1; id < 100000; id += 3) {
+    osmNode node;
+    assert_true(cache.get(&node, id) == 0,
+                name + ": rewritten node " + std::to_string(id) + " lost.");
+    assert_true(std::fabs(node.lat - lat_of(id)) < 1e-6 &&
+                std::fabs(node.lon - lon_of(id)) < 1e-6,
+                name + ": wrong location for rewritten node.");
+  }
+}
+
+int main(int argc, char *argv[]) {
+  test_strategy(ALLOC_SPARSE, "sparse");
+  test_strategy(ALLOC_DENSE, "dense");
+  test_strategy(ALLOC_DENSE | ALLOC_SPARSE, "optimized");
+  test_strategy(ALLOC_DENSE | ALLOC_DENSE_CHUNK, "chunk");
+  test_remove(ALLOC_SPARSE, "sparse");
+  test_remove(ALLOC_DENSE, "dense");
+  test_remove(ALLOC_DENSE | ALLOC_SPARSE, "optimized");
+#ifdef FIXED_POINT
+  test_strategy(ALLOC_COMPRESSED, "compressed");
+  test_out_of_order(ALLOC_COMPRESSED, "compressed");
+  test_rewrite(ALLOC_COMPRESSED, "compressed");
+  test_rewrite(ALLOC_COMPRESSED | ALLOC_LOSSY, "compressed lossy");
+  test_remove(ALLOC_COMPRESSED, "compressed");
+#endif
+
+  return 0;
+}
@@ -63,6 +63,9 @@ void test_incompatible_args()
 
     const char* a3[] = {"osm2pgsql", "-j", "-k", "tests/liechtenstein-2013-08-03.osm.pbf"};
     parse_fail(len(a3), a3, "you can not specify both");
+
+    const char* a4[] = {"osm2pgsql", "--slim", "--watch-dir", "tests"};
+    parse_fail(len(a4), a4, "can only be used with --append");
 }
 
 void test_middles()
@@ -60,6 +60,7 @@ int main(int argc, char *argv[]) {
         db->check_count(1, "select count(*) from pg_catalog.pg_class where relname = 'test_points_1'");
         db->check_count(1, "select count(*) from pg_catalog.pg_class where relname = 'test_points_2'");
         db->check_count(1, "select count(*) from pg_catalog.pg_class where relname = 'test_line_1'");
+        db->check_count(1, "select count(*) from pg_catalog.pg_class where relname = 'test_line_3'");
         db->check_count(1, "select count(*) from pg_catalog.pg_class where relname = 'test_polygon_1'");
         db->check_count(1, "select count(*) from pg_catalog.pg_class where relname = 'test_polygon_2'");
 
@@ -68,6 +69,7 @@ int main(int argc, char *argv[]) {
         db->check_count(2, "select count(*) from test_points_2");
         db->check_count(1, "select count(*) from test_line_1");
         db->check_count(1, "select count(*) from test_line_2");
+        db->check_count(1, "select count(*) from test_line_3");
         db->check_count(1, "select count(*) from test_polygon_1");
         db->check_count(1, "select count(*) from test_polygon_2");
 
@@ -75,6 +77,8 @@ int main(int argc, char *argv[]) {
         db->check_count(1, "SELECT COUNT(*) FROM test_points_1 WHERE foo IS NULL and bar = 'n1' AND baz IS NULL");
         db->check_count(1, "SELECT COUNT(*) FROM test_points_1 WHERE foo IS NULL and bar = 'n2' AND baz IS NULL");
         db->check_count(1, "SELECT COUNT(*) FROM test_line_1 WHERE foo IS NULL and bar = 'w1' AND baz IS NULL");
+        // same transform function as test_line_1, the result is shared
+        db->check_count(1, "SELECT COUNT(*) FROM test_line_3 WHERE foo IS NULL and bar = 'w1' AND baz IS NULL");
         db->check_count(1, "SELECT COUNT(*) FROM test_polygon_1 WHERE foo IS NULL and bar = 'w2' AND baz IS NULL");
 
         // Check that the second table also got the right transform
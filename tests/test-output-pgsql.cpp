@@ -283,6 +283,56 @@ void test_clone() {
     db->check_count(4128, "SELECT count(*) FROM osm2pgsql_test_polygon");
 }
 
+// an update has to work with the columns the tables actually have, even if
+// they were changed after the import
+void test_append_changed_types() {
+    std::unique_ptr<pg::tempdb> db;
+
+    try {
+        db.reset(new pg::tempdb);
+    } catch (const std::exception &e) {
+        std::cerr << "Unable to setup database: " << e.what() << "\n";
+        throw skip_test();
+    }
+
+    std::string proc_name("test-output-pgsql"), input_file("-");
+    char *argv[] = { &proc_name[0], &input_file[0], nullptr };
+
+    options_t options = options_t(2, argv);
+    options.database_options = db->database_options;
+    options.num_procs = 1;
+    options.prefix = "osm2pgsql_test";
+    options.slim = true;
+    options.style = "default.style";
+
+    {
+        std::shared_ptr<middle_pgsql_t> mid_pgsql(new middle_pgsql_t());
+        auto out_test = std::make_shared<output_pgsql_t>(mid_pgsql.get(), options);
+        osmdata_t osmdata(mid_pgsql, out_test);
+
+        testing::parse("tests/test_multipolygon.osm", "xml", options, &osmdata);
+    }
+
+    pg::conn_ptr test_conn = pg::conn::connect(db->database_options);
+    test_conn->exec("ALTER TABLE osm2pgsql_test_polygon ALTER COLUMN way_area TYPE double precision;"
+                    "ALTER TABLE osm2pgsql_test_polygon ALTER COLUMN z_order TYPE bigint;"
+                    "ALTER TABLE osm2pgsql_test_line ALTER COLUMN z_order TYPE text");
+
+    options.append = true;
+    {
+        std::shared_ptr<middle_pgsql_t> mid_pgsql(new middle_pgsql_t());
+        auto out_test = std::make_shared<output_pgsql_t>(mid_pgsql.get(), options);
+        osmdata_t osmdata(mid_pgsql, out_test);
+
+        testing::parse("tests/test_multipolygon_diff.osc", "xml", options, &osmdata);
+    }
+
+    db->check_string("double precision", "SELECT format_type(atttypid, atttypmod) FROM pg_attribute "
+                     "WHERE attrelid = 'osm2pgsql_test_polygon'::regclass AND attname = 'way_area'");
+    db->check_count(0, "SELECT count(*) FROM osm2pgsql_test_polygon WHERE way_area IS NULL AND ST_Area(way) > 0");
+    db->check_count(0, "SELECT count(*) FROM osm2pgsql_test_polygon WHERE abs(way_area - ST_Area(way)) > 1");
+}
+
 } // anonymous namespace
 
 int main(int argc, char *argv[]) {
@@ -295,6 +345,7 @@ int main(int argc, char *argv[]) {
     RUN_TEST(test_clone);
     RUN_TEST(test_area_way_simple);
     RUN_TEST(test_route_rel);
+    RUN_TEST(test_append_changed_types);
 
     return 0;
 }
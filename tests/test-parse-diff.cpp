@@ -1,5 +1,7 @@
 #include <iostream>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include <cassert>
 #include <cstdio>
@@ -122,5 +124,27 @@ int main() {
   assert_equal(out_test->rel.modified, 11);
   assert_equal(out_test->rel.deleted, 1);
 
+  // merged change files: only the newest version of each object is
+  // applied, regardless of the order of the files
+  std::vector<std::vector<std::string> > merges = {
+    { "tests/test_merge_diff_1.osc", "tests/test_merge_diff_2.osc" },
+    { "tests/test_merge_diff_2.osc", "tests/test_merge_diff_1.osc" }
+  };
+  for (auto const &files : merges) {
+    auto out_merge = std::make_shared<test_output_t>(options);
+    osmdata_t osmdata_merge(std::make_shared<dummy_slim_middle_t>(), out_merge);
+    parse_osmium_t merge_parser(false, bbox, projection.get(), true, &osmdata_merge);
+
+    assert_equal(parse_osmium_t::is_change_file(files[0], "auto"), 1);
+    merge_parser.stream_changes(files, "auto");
+
+    assert_equal(out_merge->node.modified, 2);
+    assert_equal(out_merge->node.deleted, 1);
+    assert_equal(out_merge->way.modified, 1);
+    assert_equal(out_merge->way.deleted, 0);
+    assert_equal(out_merge->rel.modified, 0);
+    assert_equal(out_merge->rel.deleted, 1);
+  }
+
   return 0;
 }
@@ -0,0 +1,155 @@
+#include <atomic>
+#include <iostream>
+#include <memory>
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+
+#include "middle.hpp"
+#include "tests/mockups.hpp"
+#include "options.hpp"
+#include "osmtypes.hpp"
+#include "output.hpp"
+#include "parse-pipeline.hpp"
+#include "reprojection.hpp"
+
+struct counters_t {
+    std::atomic<uint64_t> sum_ids, num_nodes, num_ways, num_relations, num_nds, num_members;
+
+    counters_t() : sum_ids(0), num_nodes(0), num_ways(0), num_relations(0),
+                   num_nds(0), num_members(0) {}
+};
+
+// the clones made by the workers count into the same place as the original
+struct test_output_t : public output_t {
+    std::shared_ptr<counters_t> counts;
+    int commits;
+
+    explicit test_output_t(const options_t &options_)
+        : output_t(nullptr, options_), counts(new counters_t()), commits(0) {
+    }
+
+    explicit test_output_t(const test_output_t &other)
+        : output_t(other.m_mid, other.m_options), counts(other.counts), commits(0) {
+    }
+
+    virtual ~test_output_t() {
+    }
+
+    std::shared_ptr<output_t> clone(const middle_query_t *cloned_middle) const{
+        test_output_t *clone = new test_output_t(*this);
+        clone->m_mid = cloned_middle;
+        return std::shared_ptr<output_t>(clone);
+    }
+
+    int node_add(osmid_t id, double, double, const taglist_t &) {
+        assert(id > 0);
+        counts->sum_ids += id;
+        counts->num_nodes += 1;
+        return 0;
+    }
+
+    int way_add(osmid_t id, const idlist_t &nds, const taglist_t &) {
+        assert(id > 0);
+        counts->sum_ids += id;
+        counts->num_ways += 1;
+        counts->num_nds += uint64_t(nds.size());
+        return 0;
+    }
+
+    int relation_add(osmid_t id, const memberlist_t &members, const taglist_t &) {
+        assert(id > 0);
+        counts->sum_ids += id;
+        counts->num_relations += 1;
+        counts->num_members += uint64_t(members.size());
+        return 0;
+    }
+
+    int start() { return 0; }
+    void stop() { }
+    void commit() { ++commits; }
+
+    void enqueue_ways(pending_queue_t &, osmid_t, size_t, size_t&) { }
+    int pending_way(osmid_t, int) { return 0; }
+
+    void enqueue_relations(pending_queue_t &, osmid_t, size_t, size_t&) { }
+    int pending_relation(osmid_t, int) { return 0; }
+
+    int node_modify(osmid_t, double, double, const taglist_t &) { return 0; }
+    int way_modify(osmid_t, const idlist_t &, const taglist_t &) { return 0; }
+    int relation_modify(osmid_t, const memberlist_t &, const taglist_t &) { return 0; }
+
+    int node_delete(osmid_t) { return 0; }
+    int way_delete(osmid_t) { return 0; }
+    int relation_delete(osmid_t) { return 0; }
+};
+
+// checks that the middle sees nodes and ways in input order
+struct ordered_middle_t : public dummy_middle_t {
+    osmid_t last_node = 0, last_way = 0;
+    size_t num_nodes = 0, num_ways = 0, num_relations = 0;
+    bool nodes_flushed = false;
+
+    void nodes_set(osmid_t id, double, double, const taglist_t &) {
+        assert(!nodes_flushed);
+        assert(id > last_node);
+        last_node = id;
+        ++num_nodes;
+    }
+
+    void flush_nodes() { nodes_flushed = true; }
+
+    void ways_set(osmid_t id, const idlist_t &, const taglist_t &) {
+        assert(nodes_flushed);
+        assert(id > last_way);
+        last_way = id;
+        ++num_ways;
+    }
+
+    void relations_set(osmid_t, const memberlist_t &, const taglist_t &) {
+        ++num_relations;
+    }
+};
+
+void assert_equal(uint64_t actual, uint64_t expected) {
+  if (actual != expected) {
+    std::cerr << "Expected " << expected << ", but got " << actual << ".\n";
+    exit(1);
+  }
+}
+
+int main(int argc, char *argv[]) {
+
+  std::string inputfile = "tests/test_multipolygon.osm";
+
+  options_t options;
+  std::shared_ptr<reprojection> projection(reprojection::create_projection(PROJ_SPHERE_MERC));
+  options.projection = projection;
+  options.parse_procs = 3;
+
+  auto mid = std::make_shared<ordered_middle_t>();
+  auto out_test = std::make_shared<test_output_t>(options);
+  std::vector<std::shared_ptr<output_t> > outs;
+  outs.push_back(out_test);
+
+  parse_pipeline_t parser(options, mid, outs);
+  parser.stream_file(inputfile, "");
+
+  // same numbers as the serial parser in test-parse-xml2
+  assert_equal(out_test->counts->sum_ids,       73514L);
+  assert_equal(out_test->counts->num_nodes,       353L);
+  assert_equal(out_test->counts->num_ways,        140L);
+  assert_equal(out_test->counts->num_relations,    40L);
+  assert_equal(out_test->counts->num_nds,         495L);
+  assert_equal(out_test->counts->num_members,     146L);
+
+  assert_equal(mid->num_nodes, 353L);
+  assert_equal(mid->num_ways, 140L);
+  assert_equal(mid->num_relations, 40L);
+
+  // the original output is committed before the workers start
+  assert_equal(out_test->commits, 1L);
+
+  return 0;
+}
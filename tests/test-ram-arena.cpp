@@ -0,0 +1,66 @@
+#include <string>
+
+#include <cstring>
+
+#include "ram-arena.hpp"
+#include "tests/common-assert.hpp"
+
+int main(int argc, char *argv[]) {
+  {
+    // varints of all sizes and signs survive a round trip
+    const int64_t values[] = {0, 1, -1, 63, -64, 127, 128, 300, -300,
+                              1LL << 40, -(1LL << 40), INT64_MAX, INT64_MIN};
+    std::string buffer;
+    for (auto v : values) {
+      varint::write_signed(buffer, v);
+    }
+    varint::write(buffer, UINT64_MAX);
+
+    const char *data = buffer.data();
+    for (auto v : values) {
+      assert_true(varint::read_signed(data) == v, "Wrong signed varint.");
+    }
+    assert_true(varint::read(data) == UINT64_MAX, "Wrong unsigned varint.");
+    assert_true(data == buffer.data() + buffer.size(), "Varints not read completely.");
+
+    buffer.clear();
+    varint::write_signed(buffer, -2);
+    assert_true(buffer.size() == 1, "Small negative varint takes more than a byte.");
+  }
+
+  {
+    // records stay in place when new slabs are added
+    ram_arena_t arena(16);
+    auto a = arena.add(std::string("0123456789"));
+    auto b = arena.add(std::string("abcdefghij"));
+    auto big = arena.add(std::string(100, 'x'));
+    auto c = arena.add(std::string("ABCDE"));
+
+    assert_true(a.slab != b.slab, "Record crosses a slab.");
+    assert_true(b.slab == c.slab, "Oversized record disturbed the current slab.");
+    assert_true(memcmp(arena.get(a), "0123456789", 10) == 0, "First record changed.");
+    assert_true(memcmp(arena.get(b), "abcdefghij", 10) == 0, "Second record changed.");
+    assert_true(std::string(arena.get(big), 100) == std::string(100, 'x'),
+                "Oversized record changed.");
+    assert_true(memcmp(arena.get(c), "ABCDE", 5) == 0, "Last record changed.");
+    assert_true(!ram_arena_t::ref_t().valid(), "Empty reference is valid.");
+  }
+
+  {
+    // every string is stored once, also across growing the table
+    string_table_t strings;
+    for (int i = 0; i < 5000; ++i) {
+      assert_true(strings.add(std::to_string(i)) == uint32_t(i), "Wrong id for new string.");
+    }
+    uint32_t empty = strings.add("");
+    for (int i = 0; i < 5000; ++i) {
+      assert_true(strings.add(std::to_string(i)) == uint32_t(i), "String added twice.");
+      assert_true(strings.get(i) == std::to_string(i), "Wrong string for id.");
+    }
+    assert_true(strings.add("") == empty && strings.get(empty).empty(),
+                "Empty string not found.");
+    assert_true(strings.size() == 5001, "Wrong number of strings.");
+  }
+
+  return 0;
+}
@@ -0,0 +1,130 @@
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <cstdint>
+
+#include "reprojection.hpp"
+#include "spatial-sort.hpp"
+#include "tests/common-assert.hpp"
+
+// little endian WKB linestring with two points
+std::string wkb_line(double x1, double y1, double x2, double y2) {
+  std::string wkb(1, '\1');
+  uint32_t type = 2, count = 2;
+  wkb.append(reinterpret_cast<const char *>(&type), 4);
+  wkb.append(reinterpret_cast<const char *>(&count), 4);
+  for (double c : {x1, y1, x2, y2}) {
+    wkb.append(reinterpret_cast<const char *>(&c), 8);
+  }
+  return wkb;
+}
+
+std::vector<std::string> merge(spatial_sorter_t &sorter) {
+  std::vector<std::string> rows;
+  sorter.merge([&rows](const char *row, size_t size) {
+    rows.push_back(std::string(row, size));
+  });
+  return rows;
+}
+
+int main(int argc, char *argv[]) {
+  std::shared_ptr<reprojection> projection(reprojection::create_projection(PROJ_SPHERE_MERC));
+
+  {
+    spatial_sorter_t sorter(".", "test-spatial-sort", projection);
+
+    // the key of a geometry is the key of the centre of its bounding box
+    std::string line = wkb_line(1000.0, 2000.0, 3000.0, 6000.0);
+    assert_true(sorter.wkb_key(line.data(), line.size()) == sorter.key(2000.0, 4000.0),
+                "Key of linestring differs from key of its centre.");
+    assert_true(sorter.wkb_key(line.data(), 10) == UINT64_MAX,
+                "Truncated WKB should sort last.");
+
+    // close locations are close on the curve
+    uint64_t a = sorter.key(100000.0, 100000.0);
+    uint64_t b = sorter.key(100100.0, 100100.0);
+    uint64_t c = sorter.key(-10000000.0, 5000000.0);
+    assert_true((a > b ? a - b : b - a) < (a > c ? a - c : c - a),
+                "Close locations have keys far apart.");
+  }
+
+  {
+    spatial_sorter_t sorter(".", "test-spatial-sort", projection);
+    spatial_sorter_t::run_buffer_t run1, run2;
+
+    sorter.add(run1, 30, 1, "c", 1);
+    sorter.add(run1, 10, 2, "a", 1);
+    sorter.add(run2, 20, 3, "b", 1);
+    sorter.add(run2, 40, 4, "d", 1);
+
+    // object 2 is removed, object 4 is removed and added again
+    sorter.remove(2);
+    sorter.remove(4);
+    sorter.add(run2, 5, 4, "e", 1);
+
+    sorter.flush(run1);
+    sorter.flush(run2);
+
+    auto rows = merge(sorter);
+    assert_true(rows.size() == 3, "Removed rows were not dropped.");
+    assert_true(rows[0] == "e" && rows[1] == "b" && rows[2] == "c",
+                "Rows are not in key order.");
+  }
+
+  {
+    // more runs than are merged in one pass
+    spatial_sorter_t sorter(".", "test-spatial-sort", projection);
+    spatial_sorter_t::run_buffer_t run;
+
+    for (uint64_t i = 0; i < 150; ++i) {
+      std::string row = std::to_string(i);
+      sorter.add(run, (i * 37) % 150, osmid_t(i), row.data(), row.size());
+      sorter.flush(run);
+    }
+
+    auto rows = merge(sorter);
+    assert_true(rows.size() == 150, "Rows got lost in merge passes.");
+    for (uint64_t key = 0; key < 150; ++key) {
+      uint64_t id = std::stoull(rows[key]);
+      assert_true((id * 37) % 150 == key, "Rows are not in key order after merge passes.");
+    }
+  }
+
+  {
+    // a full budget spills the biggest run buffer, even of another sorter
+    auto budget = std::make_shared<sort_budget_t>(1000);
+    spatial_sorter_t sorter1(".", "test-spatial-sort-1", projection, budget);
+    spatial_sorter_t sorter2(".", "test-spatial-sort-2", projection, budget);
+    spatial_sorter_t::run_buffer_t run1, run2;
+
+    std::string small(100, 's'), big(300, 'b');
+    sorter2.add(run2, 1, 1, small.data(), small.size());
+    sorter1.add(run1, 2, 2, big.data(), big.size());
+    sorter1.add(run1, 3, 3, big.data(), big.size());
+    assert_true(budget->used() > 600, "Run spilled before the budget was used up.");
+
+    sorter1.add(run1, 4, 4, big.data(), big.size());
+    assert_true(budget->used() > 0 && budget->used() < 300,
+                "Biggest run was not spilled when the budget was used up.");
+
+    sorter1.flush(run1);
+    sorter2.flush(run2);
+    assert_true(budget->used() == 0, "Flushed runs are still charged.");
+    assert_true(merge(sorter1).size() == 3, "Rows of the spilled run got lost.");
+    assert_true(merge(sorter2).size() == 1, "Rows of the other sorter got lost.");
+  }
+
+  {
+    // a run buffer which goes away gives its memory back
+    auto budget = std::make_shared<sort_budget_t>(1000);
+    spatial_sorter_t sorter(".", "test-spatial-sort", projection, budget);
+    {
+      spatial_sorter_t::run_buffer_t run;
+      sorter.add(run, 1, 1, "a", 1);
+    }
+    assert_true(budget->used() == 0, "Destroyed run is still charged.");
+  }
+
+  return 0;
+}
@@ -0,0 +1,76 @@
+#include <string>
+
+#include "way-filter-cache.hpp"
+#include "tests/common-assert.hpp"
+
+int main(int argc, char *argv[]) {
+  {
+    // results come back unchanged, also with empty and odd strings
+    way_filter_cache_t cache(1024 * 1024);
+    taglist_t tags;
+    tags.push_back(tag_t("building", "yes"));
+    tags.push_back(tag_t("name", std::string("a\0b", 3)));
+    tags.push_back(tag_t("", ""));
+    tags.push_back(tag_t("note", std::string(300, 'x')));
+    assert_true(cache.add(42, tags, 1, 0), "Could not add to empty cache.");
+    assert_true(cache.add(-7, taglist_t(), 0, -1), "Could not add way without tags.");
+
+    taglist_t out;
+    int polygon = -1, roads = -1;
+    assert_true(cache.get(42, out, &polygon, &roads), "Way not found.");
+    assert_true(polygon == 1 && roads == 0, "Wrong flags.");
+    assert_true(out.size() == tags.size(), "Wrong number of tags.");
+    for (size_t i = 0; i < tags.size(); ++i) {
+      assert_true(out[i].key == tags[i].key && out[i].value == tags[i].value, "Wrong tag.");
+    }
+
+    out.clear();
+    assert_true(cache.take(-7, out, &polygon, &roads), "Way without tags not found.");
+    assert_true(out.empty() && polygon == 0 && roads == -1, "Wrong way without tags.");
+    assert_true(!cache.take(-7, out, &polygon, &roads), "Way still there after take().");
+
+    cache.remove(42);
+    assert_true(!cache.get(42, out, &polygon, &roads), "Way still there after remove().");
+    assert_true(cache.size() == 0, "Cache not empty.");
+  }
+
+  {
+    // ways are only added while there is memory left, removing frees it
+    way_filter_cache_t cache(10 * 1024);
+    taglist_t tags;
+    tags.push_back(tag_t("building", std::string(100, 'y')));
+
+    osmid_t id = 1;
+    while (cache.add(id, tags, 1, 0)) {
+      ++id;
+    }
+    assert_true(id > 10 && id < 100, "Wrong number of ways in full cache.");
+    assert_true(cache.size() == size_t(id - 1), "Wrong size of full cache.");
+
+    // replacing an entry doesn't need more memory
+    assert_true(cache.add(1, tags, 0, 1), "Could not replace entry.");
+    cache.remove(2);
+    assert_true(cache.add(id, tags, 1, 0), "Removing didn't free memory.");
+    assert_true(!cache.add(id + 1, tags, 1, 0), "Cache not full again.");
+  }
+
+  {
+    // caches which share their memory are full together
+    way_filter_cache_t first(10 * 1024);
+    way_filter_cache_t second(10 * 1024);
+    second.share_memory(first);
+    taglist_t tags;
+    tags.push_back(tag_t("building", std::string(100, 'y')));
+
+    osmid_t id = 1;
+    while (first.add(id, tags, 1, 0) && second.add(id, tags, 1, 0)) {
+      ++id;
+    }
+    assert_true(id > 5 && id < 50, "Shared memory not used by both caches.");
+
+    first.remove(1);
+    assert_true(second.add(id, tags, 1, 0), "Removing didn't free shared memory.");
+  }
+
+  return 0;
+}
@@ -0,0 +1,46 @@
+#include <iostream>
+#include <string>
+
+#include <cstdlib>
+
+#include "wkb-writer.hpp"
+
+void assert_equal(const std::string &actual, const std::string &expected, const char *msg) {
+  if (actual != expected) {
+    std::cerr << msg << "\n  expected: " << expected << "\n  actual:   " << actual << "\n";
+    exit(1);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  // point as written by PostGIS (see output-pgsql.cpp)
+  assert_equal(wkb::point(-0.324445339519289, 51.7517275272868, 4326),
+               "0101000020E610000030CCA462B6C3D4BF92998C9B38E04940",
+               "Wrong EWKB for point.");
+  assert_equal(wkb::point(-0.324445339519289, 51.7517275272868),
+               "010100000030CCA462B6C3D4BF92998C9B38E04940",
+               "Wrong WKB for point.");
+
+  nodelist_t nodes;
+  nodes.push_back(osmNode(1.0, 2.0));
+  nodes.push_back(osmNode(3.5, -4.25));
+  assert_equal(wkb::linestring(nodes),
+               "010200000002000000000000000000F03F00000000000000400000000000000C4000000000000011C0",
+               "Wrong WKB for linestring.");
+
+  // repeated points are dropped, the same point later on is kept
+  nodelist_t repeated;
+  repeated.push_back(osmNode(1.0, 2.0));
+  repeated.push_back(osmNode(1.0, 2.0));
+  repeated.push_back(osmNode(3.5, -4.25));
+  repeated.push_back(osmNode(3.5, -4.25));
+  repeated.push_back(osmNode(1.0, 2.0));
+  nodelist_t unique;
+  wkb::remove_repeated(repeated, unique);
+  if (unique.size() != 3 || unique[2].lon != 1.0 || unique[2].lat != 2.0) {
+    std::cerr << "Repeated points were not removed correctly.\n";
+    exit(1);
+  }
+
+  return 0;
+}
@@ -0,0 +1,124 @@
+#include "way-filter-cache.hpp"
+#include "ram-arena.hpp"
+
+#include <cassert>
+
+// rough memory use of a map entry besides the encoded data
+#define ENTRY_OVERHEAD (64)
+
+way_filter_cache_t::way_filter_cache_t(size_t max_bytes)
+: m_memory(std::make_shared<memory_t>(max_bytes))
+{}
+
+bool way_filter_cache_t::add(osmid_t id, const taglist_t &tags, int polygon,
+                             int roads)
+{
+    // encoded as polygon, roads, number of tags and the lengths and
+    // characters of all keys and values
+    std::string data;
+    varint::write_signed(data, polygon);
+    varint::write_signed(data, roads);
+    varint::write(data, tags.size());
+    for (const auto &tag : tags) {
+        varint::write(data, tag.key.size());
+        data.append(tag.key);
+        varint::write(data, tag.value.size());
+        data.append(tag.value);
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_entries.find(id);
+    if (it != m_entries.end()) {
+        erase(it);
+    }
+
+    const size_t bytes = data.size() + ENTRY_OVERHEAD;
+    size_t used = m_memory->used;
+    do {
+        if (used + bytes > m_memory->max) {
+            return false;
+        }
+    } while (!m_memory->used.compare_exchange_weak(used, used + bytes));
+
+    m_entries.emplace(id, std::move(data));
+
+    return true;
+}
+
+bool way_filter_cache_t::get(osmid_t id, taglist_t &tags, int *polygon,
+                             int *roads) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_entries.find(id);
+    if (it == m_entries.end()) {
+        return false;
+    }
+
+    decode(it->second, tags, polygon, roads);
+    return true;
+}
+
+bool way_filter_cache_t::take(osmid_t id, taglist_t &tags, int *polygon,
+                              int *roads)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_entries.find(id);
+    if (it == m_entries.end()) {
+        return false;
+    }
+
+    decode(it->second, tags, polygon, roads);
+    erase(it);
+    return true;
+}
+
+void way_filter_cache_t::remove(osmid_t id)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_entries.find(id);
+    if (it != m_entries.end()) {
+        erase(it);
+    }
+}
+
+size_t way_filter_cache_t::size() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_entries.size();
+}
+
+void way_filter_cache_t::share_memory(const way_filter_cache_t &other)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    assert(m_entries.empty());
+    m_memory = other.m_memory;
+}
+
+void way_filter_cache_t::decode(const std::string &data, taglist_t &tags,
+                                int *polygon, int *roads)
+{
+    const char *ptr = data.data();
+    *polygon = int(varint::read_signed(ptr));
+    *roads = int(varint::read_signed(ptr));
+
+    const size_t count = varint::read(ptr);
+    tags.reserve(tags.size() + count);
+    for (size_t i = 0; i < count; ++i) {
+        const size_t key_len = varint::read(ptr);
+        std::string key(ptr, key_len);
+        ptr += key_len;
+        const size_t value_len = varint::read(ptr);
+        tags.push_back(tag_t(key, std::string(ptr, value_len)));
+        ptr += value_len;
+    }
+}
+
+void way_filter_cache_t::erase(map_t::iterator it)
+{
+    m_memory->used -= it->second.size() + ENTRY_OVERHEAD;
+    m_entries.erase(it);
+}
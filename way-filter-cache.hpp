@@ -0,0 +1,67 @@
+#ifndef WAY_FILTER_CACHE_H
+#define WAY_FILTER_CACHE_H
+
+#include "osmtypes.hpp"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/**
+ * Keeps the result of the tag transform (the filtered tags and the polygon
+ * and roads flags) of ways which are processed again later, so that the
+ * pending stage doesn't need to run the transform a second time.
+ *
+ * The results are stored encoded in a string per way. Once the given
+ * amount of memory is used up, no more ways are added. The cache is
+ * shared between all clones of an output, so access is locked. The caches
+ * of the outputs of a multi config share their memory (see share_memory()).
+ */
+class way_filter_cache_t
+{
+public:
+    explicit way_filter_cache_t(size_t max_bytes);
+
+    /// remember the result for a way, returns false if the cache is full
+    bool add(osmid_t id, const taglist_t &tags, int polygon, int roads);
+
+    /// find the result for a way, true if it was found
+    bool get(osmid_t id, taglist_t &tags, int *polygon, int *roads) const;
+
+    /// like get(), but also removes the way from the cache
+    bool take(osmid_t id, taglist_t &tags, int *polygon, int *roads);
+
+    void remove(osmid_t id);
+
+    size_t size() const;
+
+    /**
+     * Take the memory for the ways from the same budget as the other
+     * cache, so that both together stay below its maximum. Only for an
+     * empty cache.
+     */
+    void share_memory(const way_filter_cache_t &other);
+
+private:
+    typedef std::unordered_map<osmid_t, std::string> map_t;
+
+    struct memory_t
+    {
+        explicit memory_t(size_t max_) : max(max_), used(0) {}
+
+        const size_t max;
+        std::atomic<size_t> used;
+    };
+
+    static void decode(const std::string &data, taglist_t &tags, int *polygon,
+                       int *roads);
+    void erase(map_t::iterator it);
+
+    mutable std::mutex m_mutex;
+    map_t m_entries;
+    std::shared_ptr<memory_t> m_memory;
+};
+
+#endif
@@ -0,0 +1,94 @@
+#include "wkb-writer.hpp"
+
+#include <cstring>
+
+// set in the type of an EWKB geometry which contains an SRID
+#define WKB_SRID_FLAG 0x20000000
+
+#define WKB_POINT 1
+#define WKB_LINESTRING 2
+
+namespace {
+
+const char hex_digits[] = "0123456789ABCDEF";
+
+void append_hex(std::string &out, uint64_t value, int bytes)
+{
+    // little endian: least significant byte first
+    for (int i = 0; i < bytes; ++i) {
+        const unsigned byte = (value >> (8 * i)) & 0xff;
+        out.push_back(hex_digits[byte >> 4]);
+        out.push_back(hex_digits[byte & 0x0f]);
+    }
+}
+
+void append_uint32(std::string &out, uint32_t value)
+{
+    append_hex(out, value, 4);
+}
+
+void append_double(std::string &out, double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    append_hex(out, bits, 8);
+}
+
+void append_header(std::string &out, uint32_t type, int srid)
+{
+    out.append("01"); // little endian
+    if (srid) {
+        append_uint32(out, type | WKB_SRID_FLAG);
+        append_uint32(out, static_cast<uint32_t>(srid));
+    } else {
+        append_uint32(out, type);
+    }
+}
+
+} // anonymous namespace
+
+namespace wkb {
+
+std::string point(double x, double y, int srid)
+{
+    std::string out;
+    out.reserve(2 * (1 + 4 + (srid ? 4 : 0) + 16));
+
+    append_header(out, WKB_POINT, srid);
+    append_double(out, x);
+    append_double(out, y);
+
+    return out;
+}
+
+std::string linestring(nodelist_t::const_iterator begin,
+                       nodelist_t::const_iterator end, int srid)
+{
+    const size_t count = end - begin;
+
+    std::string out;
+    out.reserve(2 * (1 + 4 + (srid ? 4 : 0) + 4 + 16 * count));
+
+    append_header(out, WKB_LINESTRING, srid);
+    append_uint32(out, static_cast<uint32_t>(count));
+    for (auto it = begin; it != end; ++it) {
+        append_double(out, it->lon);
+        append_double(out, it->lat);
+    }
+
+    return out;
+}
+
+void remove_repeated(const nodelist_t &nodes, nodelist_t &out)
+{
+    out.clear();
+    out.reserve(nodes.size());
+
+    for (const auto &nd : nodes) {
+        if (out.empty() || out.back().lon != nd.lon || out.back().lat != nd.lat) {
+            out.push_back(nd);
+        }
+    }
+}
+
+} // namespace wkb
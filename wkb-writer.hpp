@@ -0,0 +1,42 @@
+#ifndef WKB_WRITER_HPP
+#define WKB_WRITER_HPP
+
+#include <cstdint>
+#include <string>
+
+#include "osmtypes.hpp"
+
+/**
+ * Writes points and linestrings as hex encoded WKB directly from the node
+ * coordinates, without building a Geos geometry first. The output is the
+ * same as that of the Geos WKBWriter in the form used by geometry_builder:
+ * two dimensions, little endian and upper case hex digits.
+ *
+ * If an SRID other than 0 is given, EWKB with the SRID is written instead.
+ */
+namespace wkb {
+
+/// Hex encoded WKB of a point.
+std::string point(double x, double y, int srid = 0);
+
+/**
+ * Hex encoded WKB of a linestring through all nodes. The nodes must not
+ * contain repeated points and there must be at least two of them.
+ */
+std::string linestring(nodelist_t::const_iterator begin,
+                       nodelist_t::const_iterator end, int srid = 0);
+
+inline std::string linestring(const nodelist_t &nodes, int srid = 0)
+{
+    return linestring(nodes.begin(), nodes.end(), srid);
+}
+
+/**
+ * Copy the nodes leaving out points which are the same as the one before.
+ * This is what Geos does when the coordinates of a geometry are collected.
+ */
+void remove_repeated(const nodelist_t &nodes, nodelist_t &out);
+
+} // namespace wkb
+
+#endif